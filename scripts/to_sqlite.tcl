@@ -14,7 +14,32 @@ proc convert_sel_list {ch elem_ids db sql} {
 
 proc read_string {ch} {
 	binary scan [read $ch 2] su str_len
-	return [read $ch $str_len]
+	return [encoding convertfrom utf-8 [read $ch $str_len]]
+}
+
+# Returns a dict of chunk ID to offset (version 3 files)
+proc read_chunk_table {ch} {
+	binary scan [read $ch 4] iu num_chunks
+	set chunks [dict create]
+	for {set i 0} {$i < $num_chunks} {incr i} {
+		set chunk_id [string reverse [read $ch 4]]
+		binary scan [read $ch 8] iuiu offset size
+		if {[string is lower [string index $chunk_id 0]]} {
+			error "Compressed files are not supported"
+		}
+		if {$chunk_id == "DELT" && $size != 0} {
+			error "Files with incrementally saved changes are not supported"
+		}
+		dict set chunks $chunk_id $offset
+	}
+	return $chunks
+}
+
+proc goto_chunk {ch chunks chunk_id} {
+	if {![dict exists $chunks $chunk_id]} {
+		error "Missing chunk: $chunk_id"
+	}
+	seek $ch [dict get $chunks $chunk_id] start
 }
 
 proc convert_winged_file {ch db} {
@@ -22,7 +47,7 @@ proc convert_winged_file {ch db} {
 		error "Unrecognized file format"
 	}
 	binary scan [read $ch 4] iu version
-	if {$version != 2} {
+	if {$version != 2 && $version != 3} {
 		error "Unrecognized file version: $version"
 	}
 
@@ -77,10 +102,16 @@ proc convert_winged_file {ch db} {
 		PRAGMA user_version = 3;
 	}
 
-	binary scan [read $ch 4] iu num_paints
-	binary scan [read $ch 4] iu num_faces
-	binary scan [read $ch 4] iu num_verts
-	binary scan [read $ch 4] iu num_edges
+	if {$version == 2} {
+		binary scan [read $ch 4] iu num_paints
+		binary scan [read $ch 4] iu num_faces
+		binary scan [read $ch 4] iu num_verts
+		binary scan [read $ch 4] iu num_edges
+	} else {
+		set chunks [read_chunk_table $ch]
+		goto_chunk $ch $chunks PNTS
+		binary scan [read $ch 4] iu num_paints
+	}
 
 	set paint_ids [list]
 	set paint_mat_uuids [list]
@@ -98,6 +129,10 @@ proc convert_winged_file {ch db} {
 		lappend paint_mat_uuids $mat_uuid
 	}
 
+	if {$version == 3} {
+		goto_chunk $ch $chunks FACE
+		binary scan [read $ch 4] iu num_faces
+	}
 	set face_ids [list]
 	for {set f 0} {$f < $num_faces} {incr f} {
 		binary scan [read $ch 4] iu paint
@@ -106,6 +141,11 @@ proc convert_winged_file {ch db} {
 		lappend face_ids [$db last_insert_rowid]
 	}
 
+	if {$version == 3} {
+		binary scan [read $ch [* 4 [+ $num_faces 1]]] iu* loop_starts
+		goto_chunk $ch $chunks VERT
+		binary scan [read $ch 4] iu num_verts
+	}
 	set vert_ids [list]
 	for {set v 0} {$v < $num_verts} {incr v} {
 		binary scan [read $ch [* 3 4]] fff x y z
@@ -113,6 +153,33 @@ proc convert_winged_file {ch db} {
 		lappend vert_ids [$db last_insert_rowid]
 	}
 
+	# List of vertex indices for each face
+	set face_loops [list]
+	if {$version == 2} {
+		for {set f 0} {$f < $num_faces} {incr f} {
+			set loop [list]
+			while {1} {
+				binary scan [read $ch 4] iu v
+				if {[eof $ch]} {
+					error "Not enough data in file!"
+				} elseif {$v == 0xffffffff} {
+					break
+				}
+				lappend loop $v
+			}
+			lappend face_loops $loop
+		}
+	} else {
+		goto_chunk $ch $chunks LOOP
+		binary scan [read $ch 4] iu num_loop_verts
+		binary scan [read $ch [* 4 $num_loop_verts]] iu* loop_verts
+		for {set f 0} {$f < $num_faces} {incr f} {
+			set start [lindex $loop_starts $f]
+			set end [lindex $loop_starts [+ $f 1]]
+			lappend face_loops [lrange $loop_verts $start [- $end 1]]
+		}
+	}
+
 	set edge_ids [list]
 	set edge_vert_ids [list]
 	set next_edges [list]
@@ -120,14 +187,8 @@ proc convert_winged_file {ch db} {
 	for {set f 0} {$f < $num_faces} {incr f} {
 		set face_id [lindex $face_ids $f]
 		set face_edge_start [llength $edge_ids]
-		while {1} {
-			binary scan [read $ch 4] iu v
-			if {[eof $ch]} {
-				error "Not enough data in file!"
-			} elseif {$v == 0xffffffff} {
-				lappend next_edges $face_edge_start
-				break
-			} elseif {[llength $edge_ids] != $face_edge_start} {
+		foreach v [lindex $face_loops $f] {
+			if {[llength $edge_ids] != $face_edge_start} {
 				lappend next_edges [llength $edge_ids]
 			}
 			set vert_id [lindex $vert_ids $v]
@@ -135,6 +196,7 @@ proc convert_winged_file {ch db} {
 			lappend edge_ids [$db last_insert_rowid]
 			lappend edge_vert_ids $vert_id
 		}
+		lappend next_edges $face_edge_start
 	}
 
 	# Link twins
@@ -153,10 +215,16 @@ proc convert_winged_file {ch db} {
 		}
 	}
 
+	if {$version == 3} {
+		goto_chunk $ch $chunks SELE
+	}
 	convert_sel_list $ch $face_ids $db {INSERT INTO sel_faces VALUES($id)}
 	convert_sel_list $ch $vert_ids $db {INSERT INTO sel_verts VALUES($id)}
 	convert_sel_list $ch $edge_ids $db {INSERT INTO sel_edges VALUES($id)}
 
+	if {$version == 3} {
+		goto_chunk $ch $chunks EDIT
+	}
 	binary scan [read $ch 4] iu sel_mode
 	binary scan [read $ch 4] iu grid_on
 	binary scan [read $ch 4] f grid_size
@@ -175,6 +243,9 @@ proc convert_winged_file {ch db} {
 		)
 	}
 
+	if {$version == 3} {
+		goto_chunk $ch $chunks VIEW
+	}
 	binary scan [read $ch [* 3 4]] fff cam_x cam_y cam_z
 	binary scan [read $ch [* 2 4]] ff rot_x rot_y
 	binary scan [read $ch 4] f zoom
@@ -186,9 +257,13 @@ proc convert_winged_file {ch db} {
 	}
 
 	set lib_uuid_to_id [dict create]
-	while {1} {
+	if {$version == 3} {
+		goto_chunk $ch $chunks LIBR
+		binary scan [read $ch 4] iu num_files
+	}
+	for {set i 0} {$version == 2 || $i < $num_files} {incr i} {
 		set lib_path [read_string $ch]
-		if {$lib_path == ""} {
+		if {$version == 2 && $lib_path == ""} {
 			break
 		}
 		set lib_uuid [read $ch 16]
@@ -207,9 +282,11 @@ proc convert_winged_file {ch db} {
 	if {[eof $ch]} {
 		error "Not enough data in file!"
 	}
-	read $ch 1
-	if {! [eof $ch]} {
-		puts "WARNING: Extra data at end of file!"
+	if {$version == 2} {
+		read $ch 1
+		if {! [eof $ch]} {
+			puts "WARNING: Extra data at end of file!"
+		}
 	}
 
 	$db eval {COMMIT TRANSACTION}
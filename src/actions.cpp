@@ -0,0 +1,507 @@
+#include "actions.h"
+#include <algorithm>
+#include <cfloat>
+#include <queue>
+#include <unordered_set>
+#include <glm/gtc/matrix_transform.hpp>
+#include <immer/set_transient.hpp>
+#include "mathutil.h"
+#include "ops.h"
+#include "resource.h"
+#include "topology.h"
+
+namespace winged {
+
+const char * const ACTION_NAMES[NUM_ACTION_TYPES] = {
+    "command", "knife", "poly", "join", "select", "copyPaint", "dragStart", "drag", "transform",
+    "transformPaint", "assignPaint", "setState"};
+
+static edge_pair edgeOnHoverFace(const Surface &surf, face_id hoverFace, vert_id v) {
+    // TODO: what if there are multiple?
+    for (auto edge : VertEdges(surf, v.in(surf))) {
+        if (edge.second.face == hoverFace)
+            return edge;
+    }
+    throw winged_error();
+}
+
+static tuple<edge_id, edge_id> findClosestOpposingEdges(
+        const Surface &surf, Face face1, Face face2) {
+    float closestDist = FLT_MAX;
+    edge_id e1 = face1.edge, e2 = face2.edge;
+    for (auto f1Edge : FaceEdges(surf, face1)) {
+        auto v1 = f1Edge.second.vert.in(surf).pos;
+        for (auto f2Edge : FaceEdges(surf, face2)) {
+            auto dist = glm::distance(v1, f2Edge.second.vert.in(surf).pos);
+            if (dist < closestDist) {
+                e1 = f1Edge.first;
+                e2 = f2Edge.second.prev;
+                closestDist = dist;
+            }
+        }
+    }
+    return {e1, e2};
+}
+
+static EditorState select(EditorState state, const PickResult pick, bool toggle) {
+    if (state.selMode == SEL_ELEMENTS) {
+        switch (pick.type) {
+            case PICK_VERT:
+                if (state.surf.verts.count(pick.vert)) {
+                    if (toggle && state.selVerts.count(pick.vert))
+                        state.selVerts = std::move(state.selVerts).erase(pick.vert);
+                    else
+                        state.selVerts = std::move(state.selVerts).insert(pick.vert);
+                }
+                break;
+            case PICK_FACE:
+                if (auto face = pick.face.find(state.surf)) {
+                    if (toggle && state.selFaces.count(pick.face)) {
+                        state.selFaces = std::move(state.selFaces).erase(pick.face);
+                    } else {
+                        state.selFaces = std::move(state.selFaces).insert(pick.face);
+                        state.workPlane = facePlane(state.surf, *face);
+                    }
+                }
+                break;
+            case PICK_EDGE:
+                if (auto edge = pick.edge.find(state.surf)) {
+                    edge_id e = primaryEdge({pick.edge, *edge});
+                    if (toggle && state.selEdges.count(pick.edge))
+                        state.selEdges = std::move(state.selEdges).erase(e);
+                    else
+                        state.selEdges = std::move(state.selEdges).insert(e);
+                }
+                break;
+        }
+    } else if (state.selMode == SEL_SOLIDS) {
+        if (auto face = pick.face.find(state.surf)) {
+            auto erase = toggle && state.selFaces.count(pick.face);
+            auto verts = state.selVerts.transient();
+            auto faces = state.selFaces.transient();
+            auto edges = state.selEdges.transient();
+            std::unordered_set<edge_id> visited;
+            // flood-fill
+            std::queue<edge_id> toSelect;
+            toSelect.push(face->edge);
+            while (!toSelect.empty()) {
+                auto e = toSelect.front();
+                toSelect.pop();
+                if (!visited.count(e)) {
+                    auto edge = e.pair(state.surf);
+                    visited.insert(e);
+                    if (erase) {
+                        if (isPrimary(edge)) edges.erase(e);
+                        verts.erase(edge.second.vert);
+                        faces.erase(edge.second.face);
+                    } else {
+                        if (isPrimary(edge)) edges.insert(e);
+                        verts.insert(edge.second.vert);
+                        faces.insert(edge.second.face);
+                    }
+                    toSelect.push(edge.second.twin);
+                    toSelect.push(edge.second.next);
+                }
+            }
+            state.selVerts = verts.persistent();
+            state.selFaces = faces.persistent();
+            state.selEdges = edges.persistent();
+        }
+    }
+    return state;
+}
+
+static EditorState knifeToVert(EditorState state, vert_id vert, face_id hoverFace,
+        std::vector<glm::vec3> *drawVerts) {
+    if (state.selVerts.size() == 1 && hoverFace.find(state.surf)) {
+        auto e1 = edgeOnHoverFace(state.surf, hoverFace, *state.selVerts.begin());
+        auto e2 = edgeOnHoverFace(state.surf, hoverFace, vert);
+
+        if (e1.first == e2.first) {
+            if (drawVerts->empty())
+                return state; // clicked same vertex twice, nothing to do
+            // loop must be clockwise in this case
+            auto start = vert.in(state.surf).pos;
+            glm::vec3 loopNorm = accumPolyNormal(start, (*drawVerts)[0]);
+            for (size_t i = 1; i < drawVerts->size(); i++)
+                loopNorm += accumPolyNormal((*drawVerts)[i - 1], (*drawVerts)[i]);
+            loopNorm += accumPolyNormal(drawVerts->back(), start);
+
+            auto faceNorm = faceNormalNonUnit(state.surf, hoverFace.in(state.surf));
+            if (glm::dot(loopNorm, faceNorm) > 0)
+                std::reverse(drawVerts->begin(), drawVerts->end());
+        }
+
+        edge_id newEdge;
+        tie(state.surf, newEdge) = splitFace(std::move(state.surf),
+            e1.first, e2.first, *drawVerts);
+        for (size_t i = 0; i < drawVerts->size() + 1; i++) {
+            auto pair = newEdge.pair(state.surf);
+            state.selEdges = std::move(state.selEdges).insert(primaryEdge(pair));
+            newEdge = pair.second.next;
+        }
+    }
+
+    state.selVerts = immer::set<vert_id>{}.insert(vert);
+    state.selFaces = {};
+    drawVerts->clear();
+    return state;
+}
+
+static EditorState knifeToDrawVert(EditorState state, int loopI, face_id hoverFace,
+        std::vector<glm::vec3> *drawVerts) {
+    if (state.selVerts.size() != 1 || !hoverFace.find(state.surf))
+        throw winged_error();
+
+    glm::vec3 loopNorm = {};
+    for (size_t i = loopI, j = drawVerts->size() - 1; i < drawVerts->size(); j = i++)
+        loopNorm += accumPolyNormal((*drawVerts)[j], (*drawVerts)[i]);
+    auto faceNorm = faceNormalNonUnit(state.surf, hoverFace.in(state.surf));
+    if (glm::dot(loopNorm, faceNorm) > 0)
+        std::reverse(drawVerts->begin() + loopI + 1, drawVerts->end());
+
+    auto e = edgeOnHoverFace(state.surf, hoverFace, *state.selVerts.begin());
+    edge_id newEdge;
+    tie(state.surf, newEdge) = splitFace(std::move(state.surf),
+        e.first, e.first, *drawVerts, loopI);
+    for (size_t i = 0; i < drawVerts->size() + 1; i++) {
+        auto pair = newEdge.pair(state.surf);
+        state.selEdges = std::move(state.selEdges).insert(primaryEdge(pair));
+        if (int(i) == loopI + 1)
+            state.selVerts = immer::set<vert_id>{}.insert(pair.second.vert);
+        newEdge = pair.second.next;
+    }
+    state.selFaces = {};
+    drawVerts->clear();
+    return state;
+}
+
+static EditorState join(EditorState state, const PickResult &pick, face_id hoverFace) {
+    if (pick.vert.find(state.surf) && state.selVerts.size() == 1) {
+        auto e1 = edgeOnHoverFace(state.surf, hoverFace, *state.selVerts.begin()).first;
+        auto e2 = edgeOnHoverFace(state.surf, hoverFace, pick.vert).first;
+        state.surf = joinVerts(std::move(state.surf), e1, e2);
+    } else if (auto hovEdge = pick.edge.find(state.surf)) {
+        if (state.selEdges.size() != 1) throw winged_error();
+        edge_pair edge1 = state.selEdges.begin()->pair(state.surf);
+        edge_pair twin1 = edge1.second.twin.pair(state.surf);
+        edge_pair edge2 = {pick.edge, *hovEdge};
+        edge_pair twin2 = edge2.second.twin.pair(state.surf);
+        if (edge1.second.face == edge2.second.face) {} // do nothing
+        else if (edge1.second.face == twin2.second.face) {
+            std::swap(edge2, twin2);
+        } else if (twin1.second.face == edge2.second.face) {
+            std::swap(edge1, twin1);
+        } else if (twin1.second.face == twin2.second.face) {
+            std::swap(edge1, twin1); std::swap(edge2, twin2);
+        }
+        state.surf = joinEdges(state.surf, edge1.first, edge2.first);
+    } else if (auto face2 = pick.face.find(state.surf)) {
+        if (state.selFaces.size() != 1) throw winged_error();
+        const auto &face1 = state.selFaces.begin()->in(state.surf);
+        auto edges = findClosestOpposingEdges(state.surf, face1, *face2);
+        // twins of the first face's edges remain as the joined edge loop
+        std::vector<edge_id> loop;
+        for (auto faceEdge : FaceEdges(state.surf, face1))
+            loop.push_back(faceEdge.second.twin);
+        state.surf = joinEdgeLoops(std::move(state.surf), get<0>(edges), get<1>(edges));
+        state.selFaces = {};
+        auto selEdges = immer::set<edge_id>{}.transient();
+        for (const auto &e : loop)
+            selEdges.insert(primaryEdge(e.pair(state.surf)));
+        state.selEdges = selEdges.persistent();
+    } else {
+        throw winged_error();
+    }
+    return state;
+}
+
+static EditorState erase(EditorState state) {
+    EditorState newState = state;
+    if (state.selMode == SEL_ELEMENTS) {
+        // edges first, then vertices
+        bool anyDeleted = false;
+        for (const auto &e : state.selEdges) {
+            if (e.find(newState.surf)) { // could have been deleted previously
+                newState.surf = mergeFaces(std::move(newState.surf), e);
+                anyDeleted = true;
+            }
+        }
+        for (const auto &v : state.selVerts) {
+            if (auto vert = v.find(newState.surf)) {
+                // make sure vert has only two edges
+                const auto &edge = vert->edge.in(newState.surf);
+                const auto &twin = edge.twin.in(newState.surf);
+                const auto &twinNext = twin.next.in(newState.surf);
+                if (twinNext.twin.in(newState.surf).next == vert->edge) {
+                    newState.surf = joinVerts(std::move(newState.surf), edge.prev, vert->edge);
+                    anyDeleted = true;
+                }
+            }
+        }
+        if (!anyDeleted)
+            throw winged_error();
+    } else if (state.selMode == SEL_SOLIDS) {
+        for (const auto &v : state.selVerts)
+            newState.surf.verts = std::move(newState.surf.verts).erase(v);
+        for (const auto &f : state.selFaces)
+            newState.surf.faces = std::move(newState.surf.faces).erase(f);
+        for (const auto &e : state.selEdges)
+            newState.surf.edges = std::move(newState.surf.edges).erase(e)
+                .erase(e.in(state.surf).twin);
+    } else {
+        throw winged_error();
+    }
+    return newState;
+}
+
+// Type of the pick, or PICK_NONE if its element no longer exists
+static PickType pickType(const Surface &surf, const PickResult &pick) {
+    switch (pick.type) {
+        case PICK_VERT: return pick.vert.find(surf) ? PICK_VERT : PICK_NONE;
+        case PICK_FACE: return pick.face.find(surf) ? PICK_FACE : PICK_NONE;
+        case PICK_EDGE: return pick.edge.find(surf) ? PICK_EDGE : PICK_NONE;
+        default: return pick.type;
+    }
+}
+
+bool isEditCommand(int id) {
+    switch (id) {
+        case IDM_CLEAR_SELECT: case IDM_SEL_ELEMENTS: case IDM_SEL_SOLIDS:
+        case IDM_SELECT_LOOP: case IDM_SELECT_RING: case IDM_SELECT_BOUNDARY:
+        case IDM_GROW_SELECT: case IDM_SHRINK_SELECT:
+        case IDM_UNDO: case IDM_REDO:
+        case IDM_TOGGLE_GRID: case IDM_GRID_DOUBLE: case IDM_GRID_HALF:
+        case IDM_ERASE: case IDM_EXTRUDE: case IDM_SPLIT_LOOP:
+        case IDM_DUPLICATE: case IDM_FLIP_NORMALS: case IDM_SNAP: case IDM_MARK_HOLE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void applyCommand(ActionResult *result, const EditorState &state, int id) {
+    auto &newState = result->state;
+    switch (id) {
+        /* Select */
+        case IDM_CLEAR_SELECT:
+            newState = clearSelection(std::move(newState));
+            break;
+        case IDM_SEL_ELEMENTS:
+            newState.selMode = SEL_ELEMENTS;
+            break;
+        case IDM_SEL_SOLIDS:
+            if (state.selMode != SEL_SOLIDS)
+                newState = clearSelection(std::move(newState));
+            newState.selMode = SEL_SOLIDS;
+            break;
+        case IDM_SELECT_LOOP:
+            newState = selectEdgeLoops(std::move(newState));
+            break;
+        case IDM_SELECT_RING:
+            newState = selectEdgeRings(std::move(newState));
+            break;
+        case IDM_SELECT_BOUNDARY:
+            newState = selectBoundary(std::move(newState));
+            break;
+        case IDM_GROW_SELECT:
+            newState = growSelection(std::move(newState));
+            break;
+        case IDM_SHRINK_SELECT:
+            newState = shrinkSelection(std::move(newState));
+            break;
+        /* Edit */
+        case IDM_UNDO:
+            result->kind = ActionResult::UNDO;
+            break;
+        case IDM_REDO:
+            result->kind = ActionResult::REDO;
+            break;
+        case IDM_TOGGLE_GRID:
+            newState.gridOn ^= true;
+            break;
+        case IDM_GRID_DOUBLE:
+            newState.gridSize *= 2;
+            break;
+        case IDM_GRID_HALF:
+            newState.gridSize /= 2;
+            break;
+        /* undoable operations... */
+        case IDM_ERASE:
+            result->kind = ActionResult::PUSH;
+            newState = erase(state);
+            break;
+        /* element */
+        case IDM_EXTRUDE: {
+            result->kind = ActionResult::PUSH;
+            result->flash = true;
+            // only edges bordering the selected faces limit the extrusion
+            immer::set_transient<edge_id> extEdges;
+            for (const auto &e : state.selEdges) {
+                const auto &edge = e.in(state.surf);
+                if (state.selFaces.count(edge.face)
+                        || state.selFaces.count(edge.twin.in(state.surf).face))
+                    extEdges.insert(e);
+            }
+            auto ext = extEdges.persistent();
+            newState.surf = extrudeFaces(state.surf, state.selFaces, ext);
+            newState.selVerts = {};
+            // the face side of each edge stays on top, its twin becomes part of the base
+            immer::set_transient<edge_id> topEdges;
+            for (const auto &e : ext) {
+                const auto &edge = e.in(state.surf);
+                edge_id top = state.selFaces.count(edge.face) ? e : edge.twin;
+                topEdges.insert(primaryEdge(top.pair(newState.surf)));
+            }
+            newState.selEdges = topEdges.persistent();
+            break;
+        }
+        case IDM_SPLIT_LOOP: {
+            result->kind = ActionResult::PUSH;
+            result->flash = true;
+            auto loop = sortEdgeLoop(state.surf, state.selEdges);
+            newState.surf = splitEdgeLoop(state.surf, loop);
+            newState.selVerts = {};
+            newState.selEdges = {};
+            for (const auto &e : loop) {
+                edge_id primary = primaryEdge(e.pair(newState.surf));
+                newState.selEdges = std::move(newState.selEdges).insert(primary);
+            }
+            break;
+        }
+        /* solid */
+        case IDM_DUPLICATE:
+            result->kind = ActionResult::PUSH;
+            newState.surf = duplicate(state.surf, state.selEdges, state.selVerts, state.selFaces);
+            break;
+        case IDM_FLIP_NORMALS:
+            result->kind = ActionResult::PUSH;
+            if (state.selMode == SEL_SOLIDS && hasSelection(state))
+                newState.surf = flipNormals(state.surf, state.selEdges, state.selVerts);
+            else
+                newState.surf = flipAllNormals(state.surf);
+            break;
+        case IDM_SNAP:
+            result->kind = ActionResult::PUSH;
+            newState.surf = snapVertices(state.surf, selAttachedVerts(state), state.gridSize);
+            break;
+        case IDM_MARK_HOLE:
+            result->kind = ActionResult::PUSH;
+            newState.surf = assignPaint(state.surf, state.selFaces,
+                Paint{Paint::HOLE_MATERIAL});
+            break;
+        default:
+            throw winged_error();
+    }
+}
+
+ActionResult applyAction(const EditorState &state, const Action &action) {
+    ActionResult result;
+    result.state = state;
+    result.drawVerts = action.drawVerts;
+    auto &newState = result.state;
+    const auto &pick = action.pick;
+    switch (action.type) {
+        case ACT_COMMAND:
+            applyCommand(&result, state, action.id);
+            break;
+        case ACT_KNIFE:
+            switch (pickType(state.surf, pick)) {
+                case PICK_EDGE: {
+                    result.kind = ActionResult::PUSH;
+                    newState.surf = splitEdge(state.surf, pick.edge, pick.point);
+                    auto newVert = pick.edge.in(newState.surf).next.in(newState.surf).vert;
+                    newState = knifeToVert(std::move(newState), newVert, action.hoverFace,
+                        &result.drawVerts);
+                    break;
+                }
+                case PICK_VERT:
+                    result.kind = ActionResult::PUSH;
+                    newState = knifeToVert(std::move(newState), pick.vert, action.hoverFace,
+                        &result.drawVerts);
+                    break;
+                case PICK_DRAWVERT:
+                    result.kind = ActionResult::PUSH;
+                    newState = knifeToDrawVert(std::move(newState), int(pick.val),
+                        action.hoverFace, &result.drawVerts);
+                    break;
+                case PICK_FACE:
+                    if (state.selVerts.size() != 1)
+                        throw winged_error(); // TODO
+                    result.drawVerts.push_back(pick.point);
+                    break;
+                case PICK_NONE:
+                    newState = clearSelection(std::move(newState));
+                    break;
+            }
+            break;
+        case ACT_POLY:
+            if (pick.type == PICK_WORKPLANE) {
+                result.drawVerts.push_back(pick.point);
+            } else if (pick.type == PICK_DRAWVERT && pick.val == 0) {
+                result.kind = ActionResult::PUSH;
+                result.finishTool = true;
+                newState = clearSelection(std::move(newState));
+                face_id newFace;
+                tie(newState.surf, newFace) = makePolygonPlane(state.surf, action.drawVerts);
+                newState.selFaces = std::move(newState.selFaces).insert(newFace);
+                result.drawVerts.clear();
+            } else {
+                throw winged_error();
+            }
+            break;
+        case ACT_JOIN:
+            result.kind = ActionResult::PUSH;
+            result.flash = true;
+            result.finishTool = true;
+            newState = join(std::move(newState), pick, action.hoverFace);
+            break;
+        case ACT_SELECT: {
+            auto toggle = bool(action.keyFlags & MK_SHIFT);
+            if (!toggle)
+                newState = clearSelection(std::move(newState));
+            newState = select(std::move(newState), pick, toggle);
+            break;
+        }
+        case ACT_COPY_PAINT: {
+            if (state.selFaces.empty() || !action.hoverFace.find(state.surf))
+                throw winged_error();
+            result.kind = ActionResult::PUSH;
+            auto paint = state.selFaces.begin()->in(state.surf).paint;
+            newState.surf = assignPaint(state.surf, {action.hoverFace}, paint);
+            break;
+        }
+        case ACT_DRAG_START:
+            result.kind = ActionResult::PUSH_CURRENT;
+            break;
+        case ACT_DRAG:
+            newState.surf = transformVertices(std::move(newState.surf), selAttachedVerts(state),
+                glm::translate(glm::mat4(1), action.vec));
+            break;
+        case ACT_TRANSFORM: {
+            result.kind = ActionResult::PUSH;
+            auto verts = selAttachedVerts(state);
+            auto center = vertsCenter(state.surf, verts);
+            newState.surf = transformVertices(state.surf, verts, glm::translate(
+                glm::translate(glm::mat4(1), center) * glm::mat4(action.mat), -center));
+            break;
+        }
+        case ACT_TRANSFORM_PAINT:
+            result.kind = ActionResult::PUSH;
+            newState.surf = transformPaint(state.surf, state.selFaces, glm::inverse(action.mat));
+            break;
+        case ACT_ASSIGN_PAINT:
+            result.kind = ActionResult::PUSH;
+            newState.surf = assignPaint(state.surf, state.selFaces, Paint{action.material});
+            break;
+        case ACT_SET_STATE:
+            result.kind = ActionResult::PUSH;
+            newState = action.state;
+            break;
+        default:
+            throw winged_error();
+    }
+    return result;
+}
+
+} // namespace
@@ -0,0 +1,71 @@
+// Edits made by commands and tool clicks. Each is described by an Action, which holds everything it
+// depends on besides the editor state, so it can be recorded to a command log and replayed without
+// a window (see cmdlog.h).
+
+#pragma once
+#include "common.h"
+
+#include <vector>
+#include "winchroma.h"
+#include <glm/mat3x3.hpp>
+#include "editor.h"
+
+namespace winged {
+
+// Picked by drawing tools, in addition to the elements in picking.h
+const PickType
+    PICK_WORKPLANE = 0x8,
+    PICK_DRAWVERT = 0x10;
+
+enum ActionType : uint32_t {
+    ACT_COMMAND,            // menu command (id), see isEditCommand
+    ACT_KNIFE,              // knife tool click (pick, hoverFace, drawVerts)
+    ACT_POLY,               // polygon tool click (pick, drawVerts)
+    ACT_JOIN,               // join tool click (pick, hoverFace)
+    ACT_SELECT,             // select tool click (pick), toggles instead of replacing with MK_SHIFT
+    ACT_COPY_PAINT,         // alt+click to paint a face like the selected face (hoverFace)
+    ACT_DRAG_START,         // start moving the selection
+    ACT_DRAG,               // move the selection (vec)
+    ACT_TRANSFORM,          // transform the selection around its center (mat)
+    ACT_TRANSFORM_PAINT,    // transform the paint of the selected faces (mat)
+    ACT_ASSIGN_PAINT,       // paint the selected faces (material)
+    ACT_SET_STATE,          // result of an operation which can't be repeated, like import (state)
+    NUM_ACTION_TYPES
+};
+
+struct Action {
+    ActionType type = ACT_COMMAND;
+    int id = 0;
+    UINT keyFlags = 0; // MK_ flags
+    PickResult pick;
+    face_id hoverFace = {};
+    std::vector<glm::vec3> drawVerts; // tool state, applies to every action
+    glm::vec3 vec = {};
+    glm::mat3 mat = glm::mat3(1);
+    id_t material = {};
+    EditorState state;
+};
+
+struct ActionResult {
+    enum Kind {
+        REPLACE,        // replace the current state, not undoable (selection, grid)
+        PUSH,           // push the current state to the undo history, then replace it
+        PUSH_CURRENT,   // push the current state, before a drag changes it in place
+        UNDO,
+        REDO,
+    } kind = REPLACE;
+    EditorState state;
+    std::vector<glm::vec3> drawVerts;
+    bool flash = false; // flash the new selection
+    bool finishTool = false; // return to the select tool, unless shift is held
+};
+
+extern const char * const ACTION_NAMES[NUM_ACTION_TYPES];
+
+// Commands which change the editor state, applied with ACT_COMMAND
+bool isEditCommand(int id);
+// UNDO and REDO results are left to the caller, which owns the undo history. Throws winged_error
+// if the action can't be applied to this state.
+ActionResult applyAction(const EditorState &state, const Action &action);
+
+} // namespace
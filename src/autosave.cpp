@@ -0,0 +1,42 @@
+#include "autosave.h"
+#include "file.h"
+#include "strutil.h"
+
+namespace winged {
+
+BackgroundSave::~BackgroundSave() {
+    wait();
+}
+
+void BackgroundSave::begin(HWND wnd, SaveSnapshot snapshot) {
+    notifyWnd = wnd;
+    saved = std::move(snapshot);
+    succeeded = false;
+    thread = CreateThread(NULL, 0, threadProc, this, 0, NULL);
+    if (!thread)
+        PostMessage(notifyWnd, WM_SAVE_COMPLETE, false, 0);
+}
+
+bool BackgroundSave::wait() {
+    if (thread) {
+        WaitForSingleObject(thread, INFINITE);
+        CloseHandle(thread);
+        thread = NULL;
+    }
+    return succeeded;
+}
+
+DWORD WINAPI BackgroundSave::threadProc(LPVOID param) {
+    auto self = static_cast<BackgroundSave *>(param);
+    auto &saved = self->saved;
+    try {
+        saveFile(narrow(saved.path), saved.state, saved.view, saved.library, saved.compress,
+            saved.incremental, &saved.file);
+        self->succeeded = true;
+    } catch (winged_error const&) {
+    } catch (std::exception const&) {}
+    PostMessage(self->notifyWnd, WM_SAVE_COMPLETE, self->succeeded, 0);
+    return 0;
+}
+
+} // namespace
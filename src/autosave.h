@@ -0,0 +1,51 @@
+// Saves files on a background thread from a snapshot of the editor state, so the editor stays
+// responsive while large files are written.
+
+#pragma once
+#include "common.h"
+
+#include <string>
+#include "winchroma.h"
+#include "editor.h"
+#include "library.h"
+#include "file.h"
+
+namespace winged {
+
+// Posted to the notify window when a background save finishes. wParam is nonzero on success.
+const UINT WM_SAVE_COMPLETE = WM_APP + 0;
+
+struct SaveSnapshot {
+    std::wstring path;
+    EditorState state;
+    ViewState view;
+    Library library;
+    bool compress, incremental;
+    SavedFile file; // updated by the save
+};
+
+class BackgroundSave {
+public:
+    BackgroundSave() = default;
+    ~BackgroundSave();
+    BackgroundSave(const BackgroundSave &) = delete;
+    BackgroundSave & operator=(const BackgroundSave &) = delete;
+
+    bool busy() const { return thread != NULL; }
+    // Must not be busy
+    void begin(HWND notifyWnd, SaveSnapshot snapshot);
+    // Block until the save finishes. Returns false if it failed.
+    bool wait();
+    // The snapshot that was last saved
+    const SaveSnapshot & snapshot() const { return saved; }
+
+private:
+    HANDLE thread = NULL;
+    HWND notifyWnd = NULL;
+    SaveSnapshot saved;
+    bool succeeded = false;
+
+    static DWORD WINAPI threadProc(LPVOID param);
+};
+
+} // namespace
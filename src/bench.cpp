@@ -0,0 +1,321 @@
+// Benchmarks of core operations on generated scenes, built with make entry=ENTRY_BENCH_SUITE.
+// Results are printed as CSV, to compare between releases.
+
+#ifdef ENTRY_BENCH_SUITE
+#include "common.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <vector>
+#include "winchroma.h"
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "file.h"
+#include "ops.h"
+#include "picking.h"
+#include "rendermesh.h"
+#include "strutil.h"
+using namespace winged;
+
+struct SceneGen {
+    const char *name;
+    // Generate a scene with about this many half-edges
+    std::function<Surface(size_t halfEdges)> make;
+};
+
+static std::string g_objPath, g_wingPath, g_exportPath;
+
+// Scenes are written as OBJ text and imported, which welds the shared vertices
+class ObjWriter {
+public:
+    int numVerts = 0;
+
+    ObjWriter() : file(fopen(g_objPath.c_str(), "w")) {}
+    ~ObjWriter() {
+        if (file)
+            fclose(file);
+    }
+    void vert(double x, double y, double z) {
+        fprintf(file, "v %g %g %g\n", x, y, z);
+        numVerts++;
+    }
+    // 1-based indices, counter-clockwise from outside
+    void quad(int a, int b, int c, int d) {
+        fprintf(file, "f %d %d %d %d\n", a, b, c, d);
+    }
+    Surface read() {
+        fclose(file);
+        file = nullptr;
+        return readObj(g_objPath);
+    }
+
+private:
+    FILE *file;
+};
+
+// A cube with each side divided into a grid of quads
+static Surface makeBox(size_t halfEdges) {
+    int n = std::max(1, int(std::sqrt(double(halfEdges) / 24)));
+    ObjWriter obj;
+    std::vector<int> lattice(size_t((n + 1) * (n + 1) * (n + 1)));
+    auto vert = [&](int x, int y, int z) {
+        auto &index = lattice[size_t((z * (n + 1) + y) * (n + 1) + x)];
+        if (!index) {
+            obj.vert(x, y, z);
+            index = obj.numVerts;
+        }
+        return index;
+    };
+    for (int axis = 0; axis < 3; axis++) {
+        for (int side = 0; side <= n; side += n) {
+            for (int v = 0; v < n; v++) {
+                for (int u = 0; u < n; u++) {
+                    // (axis, u, v) is a right-handed rotation of (x, y, z)
+                    auto corner = [&](int du, int dv) {
+                        int p[3];
+                        p[axis] = side;
+                        p[(axis + 1) % 3] = u + du;
+                        p[(axis + 2) % 3] = v + dv;
+                        return vert(p[0], p[1], p[2]);
+                    };
+                    if (side)
+                        obj.quad(corner(0, 0), corner(1, 0), corner(1, 1), corner(0, 1));
+                    else
+                        obj.quad(corner(0, 0), corner(0, 1), corner(1, 1), corner(1, 0));
+                }
+            }
+        }
+    }
+    return obj.read();
+}
+
+// A grid of raised tiles, each a square frustum sharing its base edges with its neighbors
+static Surface makeTiles(size_t halfEdges) {
+    int n = std::max(1, int(std::sqrt(double(halfEdges) / 20)));
+    ObjWriter obj;
+    for (int y = 0; y <= n; y++)
+        for (int x = 0; x <= n; x++)
+            obj.vert(x, y, 0);
+    auto base = [&](int x, int y) { return y * (n + 1) + x + 1; };
+    for (int y = 0; y < n; y++) {
+        for (int x = 0; x < n; x++) {
+            auto top = obj.numVerts + 1;
+            obj.vert(x + 0.2, y + 0.2, 1);
+            obj.vert(x + 0.8, y + 0.2, 1);
+            obj.vert(x + 0.8, y + 0.8, 1);
+            obj.vert(x + 0.2, y + 0.8, 1);
+            obj.quad(top, top + 1, top + 2, top + 3);
+            obj.quad(base(x, y), base(x + 1, y), top + 1, top);
+            obj.quad(base(x + 1, y), base(x + 1, y + 1), top + 2, top + 1);
+            obj.quad(base(x + 1, y + 1), base(x, y + 1), top + 3, top + 2);
+            obj.quad(base(x, y + 1), base(x, y), top, top + 3);
+        }
+    }
+    return obj.read();
+}
+
+// Both sides of a single polygon
+static Surface makeNGon(size_t halfEdges) {
+    auto n = std::max(size_t(3), halfEdges / 2);
+    std::vector<glm::vec3> points;
+    for (size_t i = 0; i < n; i++) {
+        auto angle = float(i) * glm::two_pi<float>() / float(n);
+        points.push_back({glm::cos(angle) * 16, glm::sin(angle) * 16, 0});
+    }
+    return get<0>(makePolygonPlane({}, points));
+}
+
+// Separate cubes in a grid
+static Surface makeSolids(size_t halfEdges) {
+    auto n = std::max(1, int(halfEdges / 24));
+    int width = std::max(1, int(std::sqrt(double(n))));
+    const int CUBE_FACES[6][4] = {
+        {0, 2, 3, 1}, {4, 5, 7, 6}, {0, 1, 5, 4}, {2, 6, 7, 3}, {0, 4, 6, 2}, {1, 3, 7, 5}};
+    ObjWriter obj;
+    for (int i = 0; i < n; i++) {
+        auto first = obj.numVerts + 1;
+        for (int c = 0; c < 8; c++)
+            obj.vert((i % width) * 3 + (c & 1), (i / width) * 3 + ((c >> 1) & 1), (c >> 2) & 1);
+        for (const auto &face : CUBE_FACES)
+            obj.quad(first + face[0], first + face[1], first + face[2], first + face[3]);
+    }
+    return obj.read();
+}
+
+// Best of a few runs, fewer if slow
+static double timeMs(const std::function<void()> &fn) {
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    double best = INFINITY, total = 0;
+    for (int run = 0; run < 3 && total < 1000; run++) {
+        LARGE_INTEGER start, end;
+        QueryPerformanceCounter(&start);
+        fn();
+        QueryPerformanceCounter(&end);
+        auto ms = double(end.QuadPart - start.QuadPart) * 1000 / double(freq.QuadPart);
+        best = std::min(best, ms);
+        total += ms;
+    }
+    return best;
+}
+
+static void printRow(const char *gen, const Surface &surf, const char *op) {
+    printf("%s,%u,%u,%u,%s,", gen, unsigned(surf.edges.size()), unsigned(surf.faces.size()),
+        unsigned(surf.verts.size()), op);
+}
+
+static void benchOp(const char *gen, const Surface &surf, const char *op,
+        const std::function<void()> &fn) {
+    printRow(gen, surf, op);
+    try {
+        printf("%.3f\n", timeMs(fn));
+    } catch (winged_error &) {
+        printf("error\n");
+    }
+    fflush(stdout);
+}
+
+// Keeps a row for every operation and scene, so gaps are visible when comparing results
+static void skipOp(const char *gen, const Surface &surf, const char *op) {
+    printRow(gen, surf, op);
+    printf("skipped\n");
+    fflush(stdout);
+}
+
+static bool isHole(const Surface &surf, face_id f) {
+    return f.in(surf).paint->material == Paint::HOLE_MATERIAL;
+}
+
+// An edge between two faces which aren't holes, and which also have other neighbors (so the shared
+// edges are a chain, not the whole boundary)
+static edge_id findMergeEdge(const Surface &surf) {
+    for (const auto &pair : surf.faces) {
+        if (isHole(surf, pair.first))
+            continue;
+        edge_id mergeEdge = {};
+        face_id firstNeighbor = {};
+        bool otherNeighbors = false;
+        for (auto edge : FaceEdges(surf, pair.second)) {
+            auto twinFace = edge.second.twin.in(surf).face;
+            if (firstNeighbor == face_id{})
+                firstNeighbor = twinFace;
+            else if (twinFace != firstNeighbor)
+                otherNeighbors = true;
+            if (mergeEdge == edge_id{} && twinFace != pair.first && !isHole(surf, twinFace))
+                mergeEdge = edge.first;
+        }
+        if (mergeEdge != edge_id{} && otherNeighbors)
+            return mergeEdge;
+    }
+    return {};
+}
+
+static void benchScene(const char *gen, const Surface &surf) {
+    Face face;
+    for (const auto &pair : surf.faces) {
+        if (!isHole(surf, pair.first)) {
+            face = pair.second;
+            break;
+        }
+    }
+    auto mergeEdge = findMergeEdge(surf);
+
+    EditorState state;
+    state.surf = surf;
+    if (surf.edges.size() < size_t(index_t(-1))) { // vertices must fit in index_t
+        benchOp(gen, surf, "generateRenderMesh", [&]() {
+            RenderMesh mesh;
+            generateRenderMesh(&mesh, state);
+        });
+    } else {
+        skipOp(gen, surf, "generateRenderMesh");
+    }
+
+    glm::vec3 min = surf.verts.begin()->second.pos, max = min;
+    for (const auto &pair : surf.verts) {
+        min = glm::min(min, pair.second.pos);
+        max = glm::max(max, pair.second.pos);
+    }
+    auto center = (min + max) / 2.0f;
+    auto radius = glm::length(max - min) / 2 + 1;
+    glm::vec2 windowDim = {1280, 720};
+    auto project = glm::perspective(glm::radians(60.0f), windowDim.x / windowDim.y,
+        radius / 100, radius * 4) * glm::lookAt(center + glm::vec3(radius, radius, radius * 2),
+        center, glm::vec3(0, 0, 1));
+    // aim at the center of a face, so the timing includes a hit
+    glm::vec3 faceCenter = {};
+    int faceVerts = 0;
+    for (auto edge : FaceEdges(surf, face)) {
+        faceCenter += edge.second.vert.in(surf).pos;
+        faceVerts++;
+    }
+    auto clipPos = project * glm::vec4(faceCenter / float(faceVerts), 1);
+    auto normCur = glm::vec2(clipPos) / clipPos.w;
+    benchOp(gen, surf, "pickElement", [&]() {
+        pickElement(surf, PICK_ELEMENT, normCur, windowDim, project);
+    });
+
+    auto faceId = face.edge.in(surf).face;
+    benchOp(gen, surf, "extrudeFace", [&]() { extrudeFace(surf, faceId, {}); });
+    auto e2 = face.edge.in(surf).next.in(surf).next; // faces are never triangles here
+    benchOp(gen, surf, "splitFace", [&]() { splitFace(surf, face.edge, e2, {}); });
+    if (mergeEdge != edge_id{})
+        benchOp(gen, surf, "mergeFaces", [&]() { mergeFaces(surf, mergeEdge); });
+    else
+        skipOp(gen, surf, "mergeFaces"); // no faces which can be merged
+
+    auto edges = immer::set<edge_id>{}.transient();
+    auto verts = immer::set<vert_id>{}.transient();
+    auto faces = immer::set<face_id>{}.transient();
+    for (const auto &pair : surf.edges)
+        edges.insert(pair.first);
+    for (const auto &pair : surf.verts)
+        verts.insert(pair.first);
+    for (const auto &pair : surf.faces)
+        faces.insert(pair.first);
+    auto allEdges = edges.persistent();
+    auto allVerts = verts.persistent();
+    auto allFaces = faces.persistent();
+    benchOp(gen, surf, "duplicate", [&]() { duplicate(surf, allEdges, allVerts, allFaces); });
+    benchOp(gen, surf, "flipAllNormals", [&]() { flipAllNormals(surf); });
+
+    benchOp(gen, surf, "writeFile", [&]() { writeFile(g_wingPath, state, {}, {}); });
+    benchOp(gen, surf, "readFile", [&]() { readFile(g_wingPath, ""); });
+    benchOp(gen, surf, "writeObj", [&]() { writeObj(g_exportPath, surf, {}, "", false); });
+    // validateSurface is empty in release builds
+    benchOp(gen, surf, "checkSurface", [&]() { checkSurface(surf); });
+}
+
+// Optional argument: largest number of half-edges (default 1000000)
+int main(int argc, char **argv) {
+    seedIds(1);
+    initRenderMesh();
+    wchar_t dir[MAX_PATH];
+    GetTempPath(_countof(dir), dir);
+    g_objPath = narrow(std::wstring(dir) + L"winged_bench_scene.obj");
+    g_wingPath = narrow(std::wstring(dir) + L"winged_bench_scene.wing");
+    g_exportPath = narrow(std::wstring(dir) + L"winged_bench_export.obj");
+    size_t maxSize = argc > 1 ? size_t(strtoul(argv[1], nullptr, 10)) : 1000000;
+
+    const SceneGen GENERATORS[] = {
+        {"box", makeBox}, {"tiles", makeTiles}, {"ngon", makeNGon}, {"solids", makeSolids}};
+    printf("scene,half_edges,faces,verts,operation,ms\n");
+    for (size_t size = 1000; size <= maxSize; size *= 10) {
+        for (const auto &gen : GENERATORS) {
+            try {
+                benchScene(gen.name, gen.make(size));
+            } catch (winged_error &) {
+                fprintf(stderr, "Error generating %s scene\n", gen.name);
+            }
+        }
+    }
+    DeleteFileA(g_objPath.c_str());
+    DeleteFileA(g_wingPath.c_str());
+    DeleteFileA(g_exportPath.c_str());
+}
+#endif // ENTRY_BENCH_SUITE
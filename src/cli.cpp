@@ -0,0 +1,207 @@
+// Command line tool for processing many .wing files at once, for asset pipelines.
+// Built with make entry=ENTRY_CLI instead of the editor.
+
+#ifdef ENTRY_CLI
+#include "common.h"
+#include <cstdio>
+#include <new>
+#include <string>
+#include <vector>
+#include "winchroma.h"
+#include <shellapi.h>
+#include <shlwapi.h>
+#include "file.h"
+#include "memusage.h"
+#include "ops.h"
+#include "parallel.h"
+#include "strutil.h"
+using namespace winged;
+
+const wchar_t USAGE[] =
+    L"usage: winged <command> [options] <files or folders>...\n"
+    L"Folders are searched for .wing files, including subfolders.\n"
+    L"\n"
+    L"commands:\n"
+    L"  stats       print element counts\n"
+    L"  validate    check the half-edge structure\n"
+    L"  convert     rewrite in the current .wing format\n"
+    L"  obj         export .obj and .mtl files\n"
+    L"  glb         export .glb files\n"
+    L"  memory      print memory used by the model and library\n"
+    L"\n"
+    L"options:\n"
+    L"  -o <folder>   write output files to this folder instead of next to each input\n"
+    L"  -compress     (convert) write compressed files\n"
+    L"  -roundtrip    (obj) write numbers which read back exactly\n";
+
+enum Command {
+    CMD_STATS, CMD_VALIDATE, CMD_CONVERT, CMD_OBJ, CMD_GLB, CMD_MEMORY, CMD_COUNT
+};
+const wchar_t * const COMMAND_NAMES[CMD_COUNT] = {
+    L"stats", L"validate", L"convert", L"obj", L"glb", L"memory"};
+
+struct CliOptions {
+    Command command = CMD_COUNT;
+    std::wstring outFolder;
+    bool compress = false;
+    bool roundTrip = false;
+};
+
+struct FileResult {
+    std::wstring path;
+    size_t faces = 0, edges = 0, verts = 0;
+    double readMs = 0, commandMs = 0;
+    std::wstring error; // empty if succeeded
+    std::wstring detail; // printed after the file name
+};
+
+static double elapsedMs(LARGE_INTEGER start, LARGE_INTEGER end) {
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    return double(end.QuadPart - start.QuadPart) * 1000 / double(freq.QuadPart);
+}
+
+static void findFiles(std::vector<FileResult> *files, const std::wstring &path) {
+    auto attributes = GetFileAttributes(path.c_str());
+    if (attributes == INVALID_FILE_ATTRIBUTES || !(attributes & FILE_ATTRIBUTE_DIRECTORY)) {
+        files->push_back({path}); // missing files fail when read
+        return;
+    }
+    WIN32_FIND_DATA find;
+    auto handle = FindFirstFile((path + L"\\*").c_str(), &find);
+    if (handle == INVALID_HANDLE_VALUE)
+        return;
+    do {
+        if (!lstrcmp(find.cFileName, L".") || !lstrcmp(find.cFileName, L".."))
+            continue;
+        auto child = path + L"\\" + find.cFileName;
+        if (find.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            findFiles(files, child);
+        else if (!lstrcmpi(PathFindExtension(find.cFileName), L".wing"))
+            files->push_back({child});
+    } while (FindNextFile(handle, &find));
+    FindClose(handle);
+}
+
+static std::string outputPath(const CliOptions &options, const std::wstring &input,
+        const wchar_t *ext) {
+    wchar_t path[MAX_PATH];
+    if (options.outFolder.empty())
+        lstrcpyn(path, input.c_str(), _countof(path));
+    else
+        PathCombine(path, options.outFolder.c_str(), PathFindFileName(input.c_str()));
+    PathRenameExtension(path, ext);
+    return narrow(path);
+}
+
+static void processFile(FileResult *result, const CliOptions &options) {
+    LARGE_INTEGER start, read, end;
+    QueryPerformanceCounter(&start);
+    read = start;
+    try {
+        auto file = readFile(narrow(result->path), "");
+        QueryPerformanceCounter(&read);
+        const auto &state = get<EditorState>(file);
+        const auto &library = get<Library>(file);
+        result->faces = state.surf.faces.size();
+        result->edges = state.surf.edges.size();
+        result->verts = state.surf.verts.size();
+        switch (options.command) {
+            case CMD_VALIDATE:
+                checkSurface(state.surf);
+                break;
+            case CMD_CONVERT:
+                writeFile(outputPath(options, result->path, L".wing"), state, get<ViewState>(file),
+                    library, options.compress);
+                break;
+            case CMD_OBJ: {
+                auto mtlPath = widen(outputPath(options, result->path, L".mtl"));
+                writeObj(outputPath(options, result->path, L".obj"), state.surf, library,
+                    narrow(PathFindFileName(mtlPath.c_str())), true, options.roundTrip);
+                break;
+            }
+            case CMD_GLB:
+                writeGlb(outputPath(options, result->path, L".glb"), state.surf, library);
+                break;
+            case CMD_MEMORY: {
+                auto mem = NodeAccounting{}.measure(state);
+                wchar_t detail[256];
+                _swprintf(detail, L"verts %.1f KB, faces %.1f KB, edges %.1f KB, library %.1f KB",
+                    double(mem.verts.bytes) / 1024, double(mem.faces.bytes) / 1024,
+                    double(mem.edges.bytes) / 1024, double(libraryBytes(library)) / 1024);
+                result->detail = detail;
+                break;
+            }
+            default:
+                break;
+        }
+    } catch (winged_error &err) {
+        result->error = err.message ? err.message : L"Failed";
+    } catch (std::bad_alloc &) {
+        result->error = L"Out of memory";
+    } catch (std::exception &) {
+        result->error = L"Unexpected error";
+    }
+    QueryPerformanceCounter(&end);
+    result->readMs = elapsedMs(start, read);
+    result->commandMs = elapsedMs(read, end);
+}
+
+int main() {
+    int argc;
+    auto argv = CommandLineToArgvW(GetCommandLine(), &argc);
+    CliOptions options;
+    std::vector<FileResult> files;
+    for (int i = 1; i < argc; i++) {
+        if (i == 1) {
+            for (int c = 0; c < CMD_COUNT; c++)
+                if (!lstrcmp(argv[i], COMMAND_NAMES[c]))
+                    options.command = Command(c);
+        } else if (!lstrcmp(argv[i], L"-o") && i + 1 < argc) {
+            options.outFolder = argv[++i];
+        } else if (!lstrcmp(argv[i], L"-compress")) {
+            options.compress = true;
+        } else if (!lstrcmp(argv[i], L"-roundtrip")) {
+            options.roundTrip = true;
+        } else if (argv[i][0] == '-') {
+            options.command = CMD_COUNT;
+            break;
+        } else {
+            findFiles(&files, argv[i]);
+        }
+    }
+    LocalFree(argv);
+    if (options.command == CMD_COUNT || argc < 3) {
+        fputws(USAGE, stderr);
+        return 2;
+    }
+
+    // files take very different amounts of time, so each worker takes the next one when it's done
+    LARGE_INTEGER start, end;
+    QueryPerformanceCounter(&start);
+    volatile LONG nextFile = -1;
+    parallelFor(numWorkers(), 1, [&](size_t, size_t) {
+        LONG i;
+        while ((i = InterlockedIncrement(&nextFile)) < LONG(files.size()))
+            processFile(&files[size_t(i)], options);
+    });
+    QueryPerformanceCounter(&end);
+
+    wprintf(L"%10s %10s %10s %10s %10s  %s\n", L"faces", L"edges", L"verts", L"read (ms)",
+        L"run (ms)", L"file");
+    int failed = 0;
+    for (const auto &file : files) {
+        if (file.error.empty()) {
+            wprintf(L"%10u %10u %10u %10.1f %10.1f  %s%s%s\n", unsigned(file.faces),
+                unsigned(file.edges), unsigned(file.verts), file.readMs, file.commandMs,
+                file.path.c_str(), file.detail.empty() ? L"" : L": ", file.detail.c_str());
+        } else {
+            wprintf(L"%10s %10s %10s %10.1f %10.1f  %s: %s\n", L"-", L"-", L"-", file.readMs,
+                file.commandMs, file.path.c_str(), file.error.c_str());
+            failed++;
+        }
+    }
+    wprintf(L"%d files, %d failed, %.1f ms\n", int(files.size()), failed, elapsedMs(start, end));
+    return failed ? 1 : 0;
+}
+#endif // ENTRY_CLI
@@ -0,0 +1,310 @@
+#include "cmdlog.h"
+#include "id.h"
+#include "snapshot.h"
+
+namespace winged {
+
+// File layout: header, then records of [type, size, payload]. The first record has the starting
+// state, and each one after it an action. A record which is incomplete ends the log.
+const uint32_t LOG_MAGIC = 'WLOG', LOG_VERSION = 1;
+const uint32_t RECORD_START = 'STRT', RECORD_ACTION = 'ACTN';
+
+static void putPath(std::vector<char> *buf, const std::wstring &str) {
+    put(buf, uint16_t(str.size()));
+    auto bytes = reinterpret_cast<const char *>(str.data());
+    buf->insert(buf->end(), bytes, bytes + str.size() * sizeof(wchar_t));
+}
+
+static std::wstring takePath(const char **ptr, const char *end) {
+    auto len = take<uint16_t>(ptr, end);
+    if (size_t(end - *ptr) < len * sizeof(wchar_t))
+        throw winged_error(L"State data is corrupt");
+    std::wstring str(len, 0);
+    memcpy(&str[0], *ptr, len * sizeof(wchar_t));
+    *ptr += len * sizeof(wchar_t);
+    return str;
+}
+
+static void putBytes(std::vector<char> *buf, const std::vector<char> &bytes) {
+    put(buf, uint32_t(bytes.size()));
+    buf->insert(buf->end(), bytes.begin(), bytes.end());
+}
+
+static std::vector<char> takeBytes(const char **ptr, const char *end) {
+    auto size = take<uint32_t>(ptr, end);
+    if (size_t(end - *ptr) < size)
+        throw winged_error(L"State data is corrupt");
+    std::vector<char> bytes(*ptr, *ptr + size);
+    *ptr += size;
+    return bytes;
+}
+
+static void writeRecord(HANDLE file, uint32_t type, const std::vector<char> &payload) {
+    std::vector<char> out;
+    put(&out, type);
+    put(&out, uint32_t(payload.size()));
+    out.insert(out.end(), payload.begin(), payload.end());
+    // not flushed, the system still writes it if the process crashes
+    DWORD written;
+    if (!WriteFile(file, out.data(), DWORD(out.size()), &written, NULL) || written != out.size())
+        throw winged_error(L"Error writing command log");
+}
+
+CommandLog::~CommandLog() {
+    stop();
+}
+
+void CommandLog::start(const wchar_t *path, const wchar_t *filePath, const EditorState &state) {
+    stop();
+    // can be replayed while still recording
+    file = CreateFile(path, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        throw winged_error(L"Error creating command log");
+    QueryPerformanceCounter(&startTime);
+    lastState = state;
+    try {
+        std::vector<char> header;
+        put(&header, LOG_MAGIC);
+        put(&header, LOG_VERSION);
+        DWORD written;
+        if (!WriteFile(file, header.data(), DWORD(header.size()), &written, NULL))
+            throw winged_error(L"Error writing command log");
+        std::vector<char> payload;
+        put(&payload, idPrefix());
+        putPath(&payload, filePath);
+        putState(&payload, state);
+        writeRecord(file, RECORD_START, payload);
+    } catch (winged_error const&) {
+        stop();
+        throw;
+    }
+}
+
+void CommandLog::record(const Action &action, ActionResult::Kind kind, uint64_t ids,
+        const EditorState &before, const EditorState &after) {
+    if (!recording())
+        return;
+    LARGE_INTEGER now, freq;
+    QueryPerformanceCounter(&now);
+    QueryPerformanceFrequency(&freq);
+
+    std::vector<char> payload;
+    put(&payload, double(now.QuadPart - startTime.QuadPart) * 1000 / double(freq.QuadPart));
+    put(&payload, ids);
+    put(&payload, uint32_t(action.type));
+    put(&payload, int32_t(action.id));
+    put(&payload, uint32_t(action.keyFlags));
+    put(&payload, action.pick.type);
+    put(&payload, action.pick.id);
+    put(&payload, action.pick.point);
+    put(&payload, action.pick.depth);
+    put(&payload, action.hoverFace);
+    put(&payload, uint32_t(action.drawVerts.size()));
+    for (const auto &v : action.drawVerts)
+        put(&payload, v);
+    put(&payload, action.vec);
+    put(&payload, action.mat);
+    put(&payload, action.material);
+    std::vector<char> delta;
+    putStateDelta(&delta, lastState, before);
+    putBytes(&payload, delta);
+    delta.clear();
+    if (action.type == ACT_SET_STATE)
+        putStateDelta(&delta, before, action.state);
+    else if (kind == ActionResult::UNDO || kind == ActionResult::REDO)
+        putStateDelta(&delta, before, after);
+    putBytes(&payload, delta);
+    try {
+        writeRecord(file, RECORD_ACTION, payload);
+        lastState = after;
+    } catch (winged_error const&) {
+        stop(); // what was written so far can still be replayed
+    }
+}
+
+void CommandLog::stop() {
+    if (file != INVALID_HANDLE_VALUE)
+        CloseHandle(file);
+    file = INVALID_HANDLE_VALUE;
+    lastState = {};
+}
+
+CommandLogContents readCommandLog(const std::string &path) {
+    HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE)
+        throw winged_error(L"Error opening command log");
+    LARGE_INTEGER size;
+    std::vector<char> data;
+    DWORD bytesRead = 0;
+    bool ok = GetFileSizeEx(handle, &size) && size.QuadPart < 0x7FFFFFFF;
+    if (ok) {
+        data.resize(size_t(size.QuadPart));
+        ok = ReadFile(handle, data.data(), DWORD(data.size()), &bytesRead, NULL)
+            && bytesRead == data.size();
+    }
+    CloseHandle(handle);
+    if (!ok)
+        throw winged_error(L"Error reading command log");
+
+    const char *ptr = data.data(), *end = data.data() + data.size();
+    if (data.size() < 8 || take<uint32_t>(&ptr, end) != LOG_MAGIC
+            || take<uint32_t>(&ptr, end) != LOG_VERSION)
+        throw winged_error(L"Unrecognized command log format");
+
+    CommandLogContents contents;
+    bool haveStart = false;
+    while (end - ptr >= 8) {
+        auto type = take<uint32_t>(&ptr, end);
+        auto recordSize = take<uint32_t>(&ptr, end);
+        if (recordSize > size_t(end - ptr))
+            break; // incomplete
+        const char *rec = ptr, *recEnd = ptr + recordSize;
+        ptr = recEnd;
+        try {
+            if (type == RECORD_START && !haveStart) {
+                contents.idPrefix = take<uint64_t>(&rec, recEnd);
+                contents.filePath = takePath(&rec, recEnd);
+                contents.state = takeState(&rec, recEnd);
+                haveStart = true;
+            } else if (type == RECORD_ACTION && haveStart) {
+                LoggedAction logged;
+                logged.ms = take<double>(&rec, recEnd);
+                logged.idCounter = take<uint64_t>(&rec, recEnd);
+                auto &action = logged.action;
+                auto actionType = take<uint32_t>(&rec, recEnd);
+                if (actionType >= NUM_ACTION_TYPES)
+                    break;
+                action.type = ActionType(actionType);
+                action.id = take<int32_t>(&rec, recEnd);
+                action.keyFlags = take<uint32_t>(&rec, recEnd);
+                action.pick.type = take<PickType>(&rec, recEnd);
+                action.pick.id = take<id_t>(&rec, recEnd);
+                action.pick.point = take<glm::vec3>(&rec, recEnd);
+                action.pick.depth = take<float>(&rec, recEnd);
+                action.hoverFace = take<face_id>(&rec, recEnd);
+                auto numDrawVerts = take<uint32_t>(&rec, recEnd);
+                for (uint32_t i = 0; i < numDrawVerts; i++)
+                    action.drawVerts.push_back(take<glm::vec3>(&rec, recEnd));
+                action.vec = take<glm::vec3>(&rec, recEnd);
+                action.mat = take<glm::mat3>(&rec, recEnd);
+                action.material = take<id_t>(&rec, recEnd);
+                logged.syncDelta = takeBytes(&rec, recEnd);
+                logged.stateDelta = takeBytes(&rec, recEnd);
+                contents.actions.push_back(std::move(logged));
+            }
+        } catch (winged_error const&) {
+            break;
+        }
+    }
+    if (!haveStart)
+        throw winged_error(L"Command log is empty or damaged");
+    return contents;
+}
+
+} // namespace
+
+#ifdef ENTRY_REPLAY
+#include <algorithm>
+#include <cstdio>
+#include "history.h"
+#include "ops.h"
+#include "strutil.h"
+using namespace winged;
+
+static double elapsedMs(LARGE_INTEGER start, LARGE_INTEGER end) {
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    return double(end.QuadPart - start.QuadPart) * 1000 / double(freq.QuadPart);
+}
+
+static EditorState decodeDelta(const EditorState &state, const std::vector<char> &delta) {
+    if (delta.empty())
+        return state;
+    const char *ptr = delta.data();
+    return takeStateDelta(state, &ptr, delta.data() + delta.size());
+}
+
+// Replay a command log from File > Record Command Log, and print the time taken by each action as
+// CSV. Undo steps are pushed the same way as in the editor, so their time is included.
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: winged <command log>\n");
+        return 2;
+    }
+    CommandLogContents log;
+    try {
+        log = readCommandLog(argv[1]);
+    } catch (winged_error const &err) {
+        fwprintf(stderr, L"%s\n", err.message ? err.message : L"Error reading command log");
+        return 1;
+    }
+    fwprintf(stderr, L"%s: %u actions\n", log.filePath.empty() ? L"(untitled)" :
+        log.filePath.c_str(), unsigned(log.actions.size()));
+
+    UndoHistory history;
+    auto state = log.state;
+    double total = 0, slowest = 0;
+    int failed = 0;
+    printf("step,time_ms,action,command,edges,ms,result\n");
+    for (size_t i = 0; i < log.actions.size(); i++) {
+        auto &logged = log.actions[i];
+        std::wstring error;
+        LARGE_INTEGER start, end;
+        QueryPerformanceCounter(&start);
+        try {
+            state = decodeDelta(state, logged.syncDelta);
+            if (logged.action.type == ACT_SET_STATE)
+                logged.action.state = decodeDelta(state, logged.stateDelta);
+            EditorState undoTarget; // state after undo or redo, as it was in the editor
+            if (logged.action.type != ACT_SET_STATE)
+                undoTarget = decodeDelta(state, logged.stateDelta);
+            setIdSequence(log.idPrefix, logged.idCounter);
+            QueryPerformanceCounter(&start);
+            auto result = applyAction(state, logged.action);
+            switch (result.kind) {
+                case ActionResult::REPLACE:
+                    state = std::move(result.state);
+                    break;
+                case ActionResult::PUSH:
+                    validateSurface(result.state.surf);
+                    result.state = cleanSelection(result.state);
+                    history.push(state, result.state);
+                    state = std::move(result.state);
+                    break;
+                case ActionResult::PUSH_CURRENT:
+                    history.push(state, state);
+                    break;
+                // still done for the time taken, but the history here starts when recording
+                // started, and the editor's can go back further
+                case ActionResult::UNDO:
+                    if (history.canUndo())
+                        state = history.undo(std::move(state));
+                    if (!logged.stateDelta.empty())
+                        state = std::move(undoTarget);
+                    break;
+                case ActionResult::REDO:
+                    if (history.canRedo())
+                        state = history.redo(std::move(state));
+                    if (!logged.stateDelta.empty())
+                        state = std::move(undoTarget);
+                    break;
+            }
+            QueryPerformanceCounter(&end);
+        } catch (winged_error const &err) {
+            QueryPerformanceCounter(&end);
+            error = err.message ? err.message : L"failed";
+            failed++;
+        }
+        auto ms = elapsedMs(start, end);
+        total += ms;
+        slowest = std::max(slowest, ms);
+        printf("%u,%.1f,%s,%d,%u,%.4f,%s\n", unsigned(i), logged.ms,
+            ACTION_NAMES[logged.action.type], logged.action.id,
+            unsigned(state.surf.edges.size()), ms, error.empty() ? "ok" : narrow(error).c_str());
+    }
+    fprintf(stderr, "total %.2f ms, slowest %.2f ms, %d failed\n", total, slowest, failed);
+    return failed ? 1 : 0;
+}
+#endif // ENTRY_REPLAY
@@ -0,0 +1,61 @@
+// Log of the actions made in a session, for profiling. The log starts with the editor state, then
+// each action with its arguments, so it can be replayed without a window to measure how long
+// each edit takes (make entry=ENTRY_REPLAY).
+
+#pragma once
+#include "common.h"
+
+#include <string>
+#include <vector>
+#include "winchroma.h"
+#include "actions.h"
+#include "editor.h"
+
+namespace winged {
+
+class CommandLog {
+public:
+    CommandLog() = default;
+    ~CommandLog();
+    CommandLog(const CommandLog &) = delete;
+    CommandLog & operator=(const CommandLog &) = delete;
+
+    bool recording() const { return file != INVALID_HANDLE_VALUE; }
+    // Throws winged_error if the log can't be created
+    void start(const wchar_t *path, const wchar_t *filePath, const EditorState &state);
+    // Call after the action was applied. ids is the ID counter before it was applied. Each record
+    // is written immediately, so the log is complete up to the last action if the editor crashes.
+    // The results of undo and redo are recorded too, since they can reach states from before
+    // recording started, which aren't in the replayer's history.
+    void record(const Action &action, ActionResult::Kind kind, uint64_t ids,
+        const EditorState &before, const EditorState &after);
+    void stop();
+
+private:
+    HANDLE file = INVALID_HANDLE_VALUE;
+    LARGE_INTEGER startTime = {};
+    EditorState lastState; // after the last recorded action
+};
+
+struct LoggedAction {
+    double ms; // time since recording started
+    uint64_t idCounter;
+    Action action;
+    // Changes made between actions which aren't recorded as actions (work plane, select mode)
+    std::vector<char> syncDelta;
+    // For ACT_SET_STATE, the delta from the state before to action.state. For undo and redo, the
+    // delta to the state after (empty in logs from before this was recorded).
+    std::vector<char> stateDelta;
+};
+
+struct CommandLogContents {
+    std::wstring filePath; // file which was open, for reference only
+    EditorState state;
+    uint64_t idPrefix = 0;
+    std::vector<LoggedAction> actions;
+};
+
+// Actions up to the last complete record
+CommandLogContents readCommandLog(const std::string &path);
+
+} // namespace
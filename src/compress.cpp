@@ -0,0 +1,135 @@
+#include "compress.h"
+#include <cstring>
+
+namespace winged {
+
+// Each sequence is a token (literal length : 4, match length - MIN_MATCH : 4), extra literal length
+// bytes, literals, match offset (2 bytes), extra match length bytes. Lengths of 15 continue in
+// following bytes, each adding up to 255. The last sequence has only literals.
+const size_t MIN_MATCH = 4;
+const size_t MAX_OFFSET = 0xFFFF;
+const int HASH_BITS = 16;
+// matches may not start this close to the end, so the decoder can finish with literals
+const size_t END_LITERALS = 5;
+
+static uint32_t read32(const char *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static uint32_t hash4(uint32_t v) {
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static void putLength(std::vector<char> *out, size_t len) {
+    while (len >= 255) {
+        out->push_back(char(255));
+        len -= 255;
+    }
+    out->push_back(char(len));
+}
+
+static void putSequence(std::vector<char> *out, const char *literals, size_t numLiterals,
+        size_t offset, size_t matchLen) {
+    auto litToken = numLiterals < 15 ? numLiterals : 15;
+    auto matchToken = (matchLen == 0) ? 0 : (matchLen - MIN_MATCH < 15 ? matchLen - MIN_MATCH : 15);
+    out->push_back(char(litToken << 4 | matchToken));
+    if (litToken == 15)
+        putLength(out, numLiterals - 15);
+    out->insert(out->end(), literals, literals + numLiterals);
+    if (matchLen) {
+        out->push_back(char(offset & 0xFF));
+        out->push_back(char(offset >> 8));
+        if (matchToken == 15)
+            putLength(out, matchLen - MIN_MATCH - 15);
+    }
+}
+
+void lzCompress(std::vector<char> *out, const char *src, size_t srcSize) {
+    std::vector<uint32_t> table(size_t(1) << HASH_BITS, uint32_t(-1));
+    size_t anchor = 0, pos = 0;
+    while (srcSize >= MIN_MATCH + END_LITERALS && pos < srcSize - MIN_MATCH - END_LITERALS) {
+        auto seq = read32(src + pos);
+        auto &entry = table[hash4(seq)];
+        auto candidate = entry;
+        entry = uint32_t(pos);
+        if (candidate == uint32_t(-1) || pos - candidate > MAX_OFFSET
+                || read32(src + candidate) != seq) {
+            pos++;
+            continue;
+        }
+        auto matchLen = MIN_MATCH;
+        auto maxLen = srcSize - END_LITERALS - pos;
+        while (matchLen < maxLen && src[candidate + matchLen] == src[pos + matchLen])
+            matchLen++;
+        putSequence(out, src + anchor, pos - anchor, pos - candidate, matchLen);
+        pos += matchLen;
+        anchor = pos;
+    }
+    putSequence(out, src + anchor, srcSize - anchor, 0, 0);
+}
+
+static size_t takeLength(const char **ptr, const char *end, size_t len) {
+    if (len == 15) {
+        uint8_t b;
+        do {
+            if (*ptr >= end)
+                throw winged_error(L"Error reading file");
+            b = uint8_t(*(*ptr)++);
+            len += b;
+        } while (b == 255);
+    }
+    return len;
+}
+
+void lzDecompress(const char *src, size_t srcSize, char *dst, size_t dstSize) {
+    const char *ptr = src, *end = src + srcSize;
+    size_t pos = 0;
+    while (1) {
+        if (ptr >= end)
+            throw winged_error(L"Error reading file");
+        auto token = uint8_t(*ptr++);
+        auto numLiterals = takeLength(&ptr, end, token >> 4);
+        if (numLiterals > size_t(end - ptr) || numLiterals > dstSize - pos)
+            throw winged_error(L"Error reading file");
+        memcpy(dst + pos, ptr, numLiterals);
+        ptr += numLiterals;
+        pos += numLiterals;
+        if (ptr == end)
+            break; // last sequence
+        if (end - ptr < 2)
+            throw winged_error(L"Error reading file");
+        size_t offset = uint8_t(ptr[0]) | size_t(uint8_t(ptr[1])) << 8;
+        ptr += 2;
+        auto matchLen = takeLength(&ptr, end, token & 15) + MIN_MATCH;
+        if (offset == 0 || offset > pos || matchLen > dstSize - pos)
+            throw winged_error(L"Error reading file");
+        char *out = dst + pos;
+        const char *match = out - offset;
+        if (offset >= matchLen) {
+            memcpy(out, match, matchLen);
+        } else {
+            for (size_t i = 0; i < matchLen; i++) // overlapping (repeating pattern)
+                out[i] = match[i];
+        }
+        pos += matchLen;
+    }
+    if (pos != dstSize)
+        throw winged_error(L"Error reading file");
+}
+
+uint32_t takeVarint(const char **ptr, const char *end) {
+    uint32_t v = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (*ptr >= end)
+            throw winged_error(L"Error reading file");
+        auto b = uint8_t(*(*ptr)++);
+        v |= uint32_t(b & 0x7F) << shift;
+        if (!(b & 0x80))
+            return v;
+    }
+    throw winged_error(L"Error reading file");
+}
+
+} // namespace
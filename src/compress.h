@@ -0,0 +1,35 @@
+// Block compression (a byte-oriented LZ77 similar to LZ4, favoring decode speed over ratio) and
+// variable-length integer encoding
+
+#pragma once
+#include "common.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace winged {
+
+void lzCompress(std::vector<char> *out, const char *src, size_t srcSize);
+// dstSize must be exactly the decompressed size. Throws winged_error if data is corrupt.
+void lzDecompress(const char *src, size_t srcSize, char *dst, size_t dstSize);
+
+inline uint32_t zigzag(int32_t v) {
+    return (uint32_t(v) << 1) ^ uint32_t(v >> 31);
+}
+inline int32_t unzigzag(uint32_t v) {
+    return int32_t(v >> 1) ^ -int32_t(v & 1);
+}
+
+inline void putVarint(std::vector<char> *buf, uint32_t v) {
+    while (v >= 0x80) {
+        buf->push_back(char(v | 0x80));
+        v >>= 7;
+    }
+    buf->push_back(char(v));
+}
+
+// Throws winged_error if the buffer ends first
+uint32_t takeVarint(const char **ptr, const char *end);
+
+} // namespace
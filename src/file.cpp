@@ -2,11 +2,23 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
 #include "winchroma.h"
 #include <shlwapi.h>
 #include "rendermesh.h"
+#include "meshorder.h"
 #include "stdutil.h"
 #include "strutil.h"
+#include "stream.h"
+#include "snapshot.h"
+#include "parallel.h"
+#include "compress.h"
+#include "mathutil.h"
+#include <immer/map_transient.hpp>
+#include <immer/set_transient.hpp>
+#include <glm/common.hpp>
 
 using namespace chroma;
 
@@ -16,27 +28,6 @@ inline std::size_t hashCombine(std::size_t seed, const T& v) {
     return seed ^ (std::hash<T>{}(v) + 0x9e3779b9 + (seed << 6) + (seed >> 2));
 }
 
-template<>
-struct std::hash<tuple<winged::vert_id, winged::vert_id>> {
-    std::size_t operator() (const tuple<winged::vert_id, winged::vert_id> &key) const {
-        return hashCombine(hashCombine(0, get<0>(key)), get<1>(key));
-    }
-};
-
-template<>
-struct std::hash<glm::vec2> {
-    std::size_t operator() (const glm::vec2 &key) const {
-        return hashCombine(hashCombine(0, key.x), key.y);
-    }
-};
-
-template<>
-struct std::hash<glm::vec3> {
-    std::size_t operator() (const glm::vec3 &key) const {
-        return hashCombine(hashCombine(hashCombine(0, key.x), key.y), key.z);
-    }
-};
-
 template<>
 struct std::hash<winged::Paint> {
     std::size_t operator() (const winged::Paint &key) const {
@@ -70,34 +61,98 @@ static bool operator==(const Paint &a, const Paint &b) {
     return a.material == b.material && a.texAxes == b.texAxes && a.texTF == b.texTF;
 }
 
-static void write(HANDLE handle, const void *buf, DWORD size) {
-    if (!CHECKERR(WriteFile(handle, buf, size, NULL, NULL)))
-        throw winged_error(L"Error writing to file");
+// File layout (version 3): header, chunk table, then chunks in any order. Each chunk holds
+// length-prefixed arrays, so it can be read in one step, and unknown chunks are skipped.
+const uint32_t FILE_MAGIC = 'WING', FILE_VERSION = 3;
+const uint32_t
+    CHUNK_PAINTS = 'PNTS', // count, Paint[]
+    CHUNK_FACES = 'FACE', // count, paint index[], loop start[] (count + 1)
+    CHUNK_VERTS = 'VERT', // count, position[]
+    CHUNK_LOOPS = 'LOOP', // count, vertex index[] (one per edge, in face order)
+    CHUNK_SELECT = 'SELE', // count, face index[], count, vertex index[], count, edge index[]
+    CHUNK_EDITOR = 'EDIT', // editor SAVE_DATA
+    CHUNK_VIEW = 'VIEW', // ViewState
+    CHUNK_LIBRARY = 'LIBR', // count, {path (relative), id}[]
+    // only in incremental files:
+    CHUNK_IDS = 'IDS ', // count, face ID[], count, vertex ID[], count, edge ID[] (in loop order)
+    // Last, starts empty. Each incremental save appends the changes since the full write to the
+    // end of the file, then points this entry to them. Older appended changes are unused.
+    CHUNK_DELTA = 'DELT'; // view, library (as in CHUNK_LIBRARY), state delta (see snapshot.h)
+// Set in the ID (lowercase first letter) if the chunk is compressed: decompressed size, then LZ
+// data, which decompresses to the chunk after a reversible filter for its type
+const uint32_t CHUNK_COMPRESSED = 0x20000000;
+// finest grid (as a power of two) that positions are checked against
+const int MAX_POSITION_SHIFT = 16;
+// faces are sent for preview in batches of up to this many vertices, which index_t can address
+const uint32_t PREVIEW_BATCH_VERTS = 16384;
+// appended changes are written into a full file once they pass this fraction of its size
+const uint64_t MAX_DELTA_PERCENT = 50;
+const size_t SAVE_DATA_SIZE = sizeof(EditorState) - offsetof(EditorState, SAVE_DATA);
+
+struct ChunkEntry {
+    uint32_t id, offset, size;
+};
+
+// Index-based contents of a file, independent of format version
+struct FileContents {
+    std::vector<Paint> paints;
+    std::vector<uint32_t> facePaints;
+    std::vector<uint32_t> loopStarts; // start of each face in loopVerts, plus the end
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t> loopVerts;
+    std::vector<uint32_t> selFaces, selVerts, selEdges;
+    char saveData[SAVE_DATA_SIZE]; // defaults for anything missing from the file
+    ViewState view;
+    std::vector<std::pair<std::string, id_t>> files;
+    bool hasIds = false;
+    std::vector<id_t> faceIds, vertIds, edgeIds;
+    bool hasDelta = false;
+    std::vector<char> delta;
+    uint32_t deltaEntry = 0;
+    uint64_t baseSize = 0, fileSize = 0;
+
+    FileContents() {
+        EditorState defaults;
+        memcpy(saveData, &defaults.SAVE_DATA, SAVE_DATA_SIZE);
+    }
+};
+
+template<typename T>
+static void putArray(std::vector<char> *buf, const std::vector<T> &vec, bool prefix = true) {
+    if (prefix)
+        put(buf, uint32_t(vec.size()));
+    auto bytes = reinterpret_cast<const char *>(vec.data());
+    buf->insert(buf->end(), bytes, bytes + vec.size() * sizeof(T));
 }
 
 template<typename T, typename U>
-static void writeSet(HANDLE handle, const immer::set<T> &set, const std::unordered_map<T, U> &map) {
-    write(handle, tempPtr(set.size()), 4);
+static std::vector<uint32_t> selIndices(const immer::set<T> &set,
+        const std::unordered_map<T, U> &map) {
+    std::vector<uint32_t> indices;
+    indices.reserve(set.size());
     for (const auto &v : set)
-        write(handle, &map.at(v), sizeof(U));
+        indices.push_back(map.at(v));
+    return indices;
 }
 
-static void writeString(HANDLE handle, const std::string &str) {
-    auto len = uint16_t(str.size());
-    write(handle, &len, 2);
-    write(handle, str.data(), len);
+static std::string relativePath(const std::wstring &wfile, const Library &library,
+        const std::string &path) {
+    wchar_t relative[MAX_PATH] = L"";
+    auto wpath = widen(path);
+    if (library.rootPath.empty()) {
+        PathRelativePathTo(relative, wfile.c_str(), 0, wpath.c_str(), 0);
+    } else {
+        PathRelativePathTo(relative, widen(library.rootPath).c_str(),
+            FILE_ATTRIBUTE_DIRECTORY, wpath.c_str(), 0);
+    }
+    // absolute path if there is no relative path
+    return relative[0] ? narrow(relative) : path;
 }
 
-void writeFile(const std::string &file, const EditorState &state, const ViewState &view,
-        const Library &library) {
-    auto wfile = widen(file);
-    CHandle handle(CreateFile(wfile.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
-        FILE_ATTRIBUTE_NORMAL, NULL));
-    if (handle == INVALID_HANDLE_VALUE)
-        throw winged_error(L"Error saving file");
-    write(handle, tempPtr('WING'), 4);
-    write(handle, tempPtr(2), 4);
-
+static FileContents flatten(const std::wstring &wfile, const EditorState &state,
+        const ViewState &view, const Library &library, bool withIds) {
+    FileContents contents;
+    contents.hasIds = withIds;
     std::unordered_map<Paint, uint32_t> paintIndices;
     std::unordered_map<face_id, uint32_t> faceIndices;
     faceIndices.reserve(state.surf.faces.size());
@@ -106,179 +161,899 @@ void writeFile(const std::string &file, const EditorState &state, const ViewStat
     std::unordered_map<edge_id, uint32_t> edgeIndices;
     edgeIndices.reserve(state.surf.edges.size());
 
-    std::vector<uint32_t> facePaintIndices;
-    std::vector<Paint> paints;
     std::unordered_set<id_t> usedFiles;
+    contents.facePaints.reserve(state.surf.faces.size());
     for (const auto &face : state.surf.faces) {
         if (auto paintIndex = tryGet(paintIndices, *face.second.paint)) {
-            facePaintIndices.push_back(*paintIndex);
+            contents.facePaints.push_back(*paintIndex);
         } else {
-            paintIndices[face.second.paint] = uint32_t(paints.size());
-            facePaintIndices.push_back(uint32_t(paints.size()));
-            paints.push_back(face.second.paint);
+            paintIndices[face.second.paint] = uint32_t(contents.paints.size());
+            contents.facePaints.push_back(uint32_t(contents.paints.size()));
+            contents.paints.push_back(face.second.paint);
             usedFiles.insert(face.second.paint->material);
         }
         faceIndices.insert({face.first, uint32_t(faceIndices.size())});
+        if (withIds)
+            contents.faceIds.push_back(face.first);
     }
-    write(handle, tempPtr(paints.size()), 4);
-    write(handle, tempPtr(state.surf.faces.size()), 4);
-    write(handle, tempPtr(state.surf.verts.size()), 4);
-    write(handle, tempPtr(state.surf.edges.size()), 4);
-
-    write(handle, paints.data(), DWORD(paints.size() * sizeof(Paint)));
-    write(handle, facePaintIndices.data(), DWORD(facePaintIndices.size() * sizeof(uint32_t)));
-
+    contents.positions.reserve(state.surf.verts.size());
     for (const auto &vert : state.surf.verts) {
-        write(handle, &vert.second.pos, sizeof(vert.second.pos));
+        contents.positions.push_back(vert.second.pos);
         vertIndices.insert({vert.first, uint32_t(vertIndices.size())});
+        if (withIds)
+            contents.vertIds.push_back(vert.first);
     }
+    contents.loopStarts.reserve(state.surf.faces.size() + 1);
+    contents.loopVerts.reserve(state.surf.edges.size());
     for (const auto &face : state.surf.faces) {
+        contents.loopStarts.push_back(uint32_t(contents.loopVerts.size()));
         for (auto edge : FaceEdges(state.surf, face.second)) {
-            write(handle, &vertIndices[edge.second.vert], 4);
+            contents.loopVerts.push_back(vertIndices[edge.second.vert]);
             edgeIndices.insert({edge.first, uint32_t(edgeIndices.size())});
+            if (withIds)
+                contents.edgeIds.push_back(edge.first);
         }
-        write(handle, tempPtr(-1), 4);
     }
+    contents.loopStarts.push_back(uint32_t(contents.loopVerts.size()));
 
-    writeSet(handle, state.selFaces, faceIndices);
-    writeSet(handle, state.selVerts, vertIndices);
-    writeSet(handle, state.selEdges, edgeIndices);
-    write(handle, &state.SAVE_DATA, sizeof(EditorState) - offsetof(EditorState, SAVE_DATA));
-    write(handle, &view, sizeof(view));
+    contents.selFaces = selIndices(state.selFaces, faceIndices);
+    contents.selVerts = selIndices(state.selVerts, vertIndices);
+    contents.selEdges = selIndices(state.selEdges, edgeIndices);
+    memcpy(contents.saveData, &state.SAVE_DATA, SAVE_DATA_SIZE);
+    contents.view = view;
 
-    for (const auto &id : usedFiles) {
-        if (auto path = tryGet(library.idPaths, id)) {
-            wchar_t relative[MAX_PATH] = L"";
-            auto wpath = widen(*path);
-            if (library.rootPath.empty()) {
-                PathRelativePathTo(relative, wfile.c_str(), 0, wpath.c_str(), 0);
-            } else {
-                PathRelativePathTo(relative, widen(library.rootPath).c_str(),
-                    FILE_ATTRIBUTE_DIRECTORY, wpath.c_str(), 0);
+    for (const auto &id : usedFiles)
+        if (auto path = tryGet(library.idPaths, id))
+            contents.files.push_back({relativePath(wfile, library, *path), id});
+    return contents;
+}
+
+// Smallest power of two scale which makes every coordinate an integer, or -1 if there is none
+static int positionShift(const std::vector<glm::vec3> &positions) {
+    auto quantizes = [](float v, int shift) {
+        auto scaled = std::ldexp(v, shift);
+        if (!(std::abs(scaled) < float(1 << 30)))
+            return false;
+        auto back = std::ldexp(float(int32_t(scaled)), -shift);
+        return memcmp(&back, &v, sizeof(v)) == 0; // bitwise, so -0 is not lost
+    };
+    int shift = 0;
+    for (const auto &pos : positions) {
+        for (int c = 0; c < 3; c++) {
+            while (!quantizes(pos[c], shift))
+                if (++shift > MAX_POSITION_SHIFT)
+                    return -1;
+        }
+    }
+    // earlier coordinates might be out of range at the final scale
+    for (const auto &pos : positions)
+        for (int c = 0; c < 3; c++)
+            if (!quantizes(pos[c], shift))
+                return -1;
+    return shift;
+}
+
+// IDs generated in one session share a prefix, followed by a counter which mostly increases by one
+static void splitId(const id_t &elemId, uint64_t *prefix, uint64_t *counter) {
+    memcpy(prefix, &elemId, 8);
+    memcpy(counter, reinterpret_cast<const char *>(&elemId) + 8, 8);
+}
+
+// Positions as deltas of grid coordinates if possible, otherwise XOR of float bits. Loop offsets
+// as lengths, vertex indices as deltas, and IDs as counter deltas when the prefix repeats. Other
+// chunks are unchanged.
+static std::vector<char> filterChunk(uint32_t id, const std::vector<char> &payload) {
+    std::vector<char> out;
+    InStream in(payload.data(), payload.size());
+    if (id == CHUNK_VERTS) {
+        std::vector<glm::vec3> positions;
+        in.readArray(&positions, in.get<uint32_t>());
+        putVarint(&out, uint32_t(positions.size()));
+        auto shift = positionShift(positions);
+        out.push_back(char(shift));
+        if (shift >= 0) {
+            int32_t last[3] = {};
+            for (const auto &pos : positions) {
+                for (int c = 0; c < 3; c++) {
+                    auto q = int32_t(std::ldexp(pos[c], shift));
+                    putVarint(&out, zigzag(q - last[c]));
+                    last[c] = q;
+                }
             }
-            if (relative[0]) {
-                writeString(handle, narrow(relative));
-            } else {
-                writeString(handle, *path); // absolute path
+        } else {
+            uint32_t last[3] = {};
+            for (const auto &pos : positions) {
+                for (int c = 0; c < 3; c++) {
+                    uint32_t bits;
+                    memcpy(&bits, &pos[c], 4);
+                    put(&out, bits ^ last[c]);
+                    last[c] = bits;
+                }
             }
-            write(handle, &id, sizeof(id));
         }
+    } else if (id == CHUNK_FACES) {
+        auto numFaces = in.get<uint32_t>();
+        putVarint(&out, numFaces);
+        for (uint32_t f = 0; f < numFaces; f++)
+            putVarint(&out, in.get<uint32_t>());
+        uint32_t last = 0;
+        for (uint32_t f = 0; f <= numFaces; f++) {
+            auto start = in.get<uint32_t>();
+            putVarint(&out, start - last);
+            last = start;
+        }
+    } else if (id == CHUNK_LOOPS) {
+        auto count = in.get<uint32_t>();
+        putVarint(&out, count);
+        uint32_t last = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            auto v = in.get<uint32_t>();
+            putVarint(&out, zigzag(int32_t(v - last)));
+            last = v;
+        }
+    } else if (id == CHUNK_IDS) {
+        uint64_t lastPrefix = 0, lastCounter = 0;
+        for (int array = 0; array < 3; array++) {
+            auto count = in.get<uint32_t>();
+            putVarint(&out, count);
+            for (uint32_t i = 0; i < count; i++) {
+                auto elemId = in.get<id_t>();
+                uint64_t prefix, counter;
+                splitId(elemId, &prefix, &counter);
+                auto delta = int64_t(counter - lastCounter);
+                if (prefix == lastPrefix && delta >= -(1 << 29) && delta < (1 << 29)) {
+                    putVarint(&out, zigzag(int32_t(delta)) << 1);
+                } else {
+                    putVarint(&out, 1);
+                    put(&out, elemId);
+                }
+                lastPrefix = prefix;
+                lastCounter = counter;
+            }
+        }
+    } else {
+        return payload;
     }
-    writeString(handle, "");
+    return out;
 }
 
-static void read(HANDLE handle, void *buf, DWORD size) {
-    if (!CHECKERR(ReadFile(handle, buf, size, NULL, NULL)))
+static std::vector<char> unfilterChunk(uint32_t id, const std::vector<char> &filtered) {
+    std::vector<char> out;
+    const char *ptr = filtered.data(), *end = filtered.data() + filtered.size();
+    if (id == CHUNK_VERTS) {
+        auto count = takeVarint(&ptr, end);
+        if (ptr >= end || count > size_t(end - ptr)) // at least one byte per position
+            throw winged_error(L"Error reading file");
+        auto shift = int(int8_t(*ptr++));
+        if (shift > MAX_POSITION_SHIFT)
+            throw winged_error(L"Error reading file");
+        out.reserve(4 + count * sizeof(glm::vec3));
+        put(&out, count);
+        if (shift >= 0) {
+            int32_t last[3] = {};
+            for (uint32_t i = 0; i < count; i++) {
+                glm::vec3 pos;
+                for (int c = 0; c < 3; c++) {
+                    last[c] += unzigzag(takeVarint(&ptr, end));
+                    pos[c] = std::ldexp(float(last[c]), -shift);
+                }
+                put(&out, pos);
+            }
+        } else {
+            if (count > size_t(end - ptr) / sizeof(glm::vec3))
+                throw winged_error(L"Error reading file");
+            uint32_t last[3] = {};
+            for (uint32_t i = 0; i < count; i++) {
+                glm::vec3 pos;
+                for (int c = 0; c < 3; c++) {
+                    last[c] ^= take<uint32_t>(&ptr, end);
+                    memcpy(&pos[c], &last[c], 4);
+                }
+                put(&out, pos);
+            }
+        }
+    } else if (id == CHUNK_FACES) {
+        auto numFaces = takeVarint(&ptr, end);
+        if (numFaces > size_t(end - ptr))
+            throw winged_error(L"Error reading file");
+        out.reserve(4 + (size_t(numFaces) * 2 + 1) * 4);
+        put(&out, numFaces);
+        for (uint32_t f = 0; f < numFaces; f++)
+            put(&out, takeVarint(&ptr, end));
+        uint32_t last = 0;
+        for (uint32_t f = 0; f <= numFaces; f++) {
+            last += takeVarint(&ptr, end);
+            put(&out, last);
+        }
+    } else if (id == CHUNK_LOOPS) {
+        auto count = takeVarint(&ptr, end);
+        if (count > size_t(end - ptr))
+            throw winged_error(L"Error reading file");
+        out.reserve(4 + size_t(count) * 4);
+        put(&out, count);
+        uint32_t last = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            last += uint32_t(unzigzag(takeVarint(&ptr, end)));
+            put(&out, last);
+        }
+    } else if (id == CHUNK_IDS) {
+        uint64_t lastPrefix = 0, lastCounter = 0;
+        for (int array = 0; array < 3; array++) {
+            auto count = takeVarint(&ptr, end);
+            if (count > size_t(end - ptr))
+                throw winged_error(L"Error reading file");
+            put(&out, count);
+            for (uint32_t i = 0; i < count; i++) {
+                auto tag = takeVarint(&ptr, end);
+                if (tag & 1) {
+                    if (size_t(end - ptr) < sizeof(id_t))
+                        throw winged_error(L"Error reading file");
+                    auto elemId = take<id_t>(&ptr, end);
+                    splitId(elemId, &lastPrefix, &lastCounter);
+                    put(&out, elemId);
+                } else {
+                    lastCounter += uint64_t(int64_t(unzigzag(tag >> 1)));
+                    id_t elemId;
+                    memcpy(&elemId, &lastPrefix, 8);
+                    memcpy(reinterpret_cast<char *>(&elemId) + 8, &lastCounter, 8);
+                    put(&out, elemId);
+                }
+            }
+        }
+    } else {
+        return filtered;
+    }
+    return out;
+}
+
+static std::vector<char> compressChunk(uint32_t id, const std::vector<char> &payload) {
+    auto filtered = filterChunk(id, payload);
+    std::vector<char> out;
+    put(&out, uint32_t(filtered.size()));
+    lzCompress(&out, filtered.data(), filtered.size());
+    return out;
+}
+
+static std::vector<char> decompressChunk(uint32_t id, const char *data, size_t size) {
+    if (size < 4)
         throw winged_error(L"Error reading file");
+    const char *end = data + size;
+    auto filteredSize = take<uint32_t>(&data, end);
+    if (filteredSize > size_t(end - data) * 256) // beyond the maximum compression ratio
+        throw winged_error(L"Error reading file");
+    std::vector<char> filtered(filteredSize);
+    lzDecompress(data, size_t(end - data), filtered.data(), filtered.size());
+    return unfilterChunk(id, filtered);
 }
 
-template<typename T>
-static T readVal(HANDLE handle, DWORD size = sizeof(T)) {
-    T val;
-    read(handle, &val, size);
-    return val;
+// saved (optional) receives the location of the delta chunk, for incremental files
+static void writeContents(OutStream &out, const FileContents &contents, bool compress,
+        SavedFile *saved) {
+    std::vector<std::pair<uint32_t, std::vector<char>>> chunks(8);
+    chunks[0].first = CHUNK_PAINTS;
+    putArray(&chunks[0].second, contents.paints);
+    chunks[1].first = CHUNK_FACES;
+    putArray(&chunks[1].second, contents.facePaints);
+    putArray(&chunks[1].second, contents.loopStarts, false);
+    chunks[2].first = CHUNK_VERTS;
+    putArray(&chunks[2].second, contents.positions);
+    chunks[3].first = CHUNK_LOOPS;
+    putArray(&chunks[3].second, contents.loopVerts);
+    chunks[4].first = CHUNK_SELECT;
+    putArray(&chunks[4].second, contents.selFaces);
+    putArray(&chunks[4].second, contents.selVerts);
+    putArray(&chunks[4].second, contents.selEdges);
+    chunks[5].first = CHUNK_EDITOR;
+    chunks[5].second.assign(contents.saveData, contents.saveData + SAVE_DATA_SIZE);
+    chunks[6].first = CHUNK_VIEW;
+    put(&chunks[6].second, contents.view);
+    chunks[7].first = CHUNK_LIBRARY;
+    put(&chunks[7].second, uint32_t(contents.files.size()));
+    for (const auto &file : contents.files) {
+        put(&chunks[7].second, uint16_t(file.first.size()));
+        chunks[7].second.insert(chunks[7].second.end(), file.first.begin(), file.first.end());
+        put(&chunks[7].second, file.second);
+    }
+    if (contents.hasIds) {
+        chunks.push_back({CHUNK_IDS, {}});
+        putArray(&chunks.back().second, contents.faceIds);
+        putArray(&chunks.back().second, contents.vertIds);
+        putArray(&chunks.back().second, contents.edgeIds);
+    }
+    if (compress) {
+        parallelFor(chunks.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                auto compressed = compressChunk(chunks[i].first, chunks[i].second);
+                if (compressed.size() < chunks[i].second.size()) {
+                    chunks[i].first |= CHUNK_COMPRESSED;
+                    chunks[i].second = std::move(compressed);
+                }
+            }
+        });
+    }
+    if (contents.hasIds)
+        chunks.push_back({CHUNK_DELTA, {}});
+
+    out.put(FILE_MAGIC);
+    out.put(FILE_VERSION);
+    out.put(uint32_t(chunks.size()));
+    uint64_t offset = 12 + chunks.size() * sizeof(ChunkEntry);
+    for (const auto &chunk : chunks) {
+        offset = (offset + 3) & ~uint64_t(3); // keep arrays aligned
+        if (offset + chunk.second.size() > UINT32_MAX)
+            throw winged_error(L"File is too large");
+        out.put(ChunkEntry{chunk.first, uint32_t(offset), uint32_t(chunk.second.size())});
+        offset += chunk.second.size();
+    }
+    uint64_t pos = 12 + chunks.size() * sizeof(ChunkEntry);
+    for (const auto &chunk : chunks) {
+        const char padding[4] = {};
+        out.write(padding, size_t(((pos + 3) & ~uint64_t(3)) - pos));
+        out.write(chunk.second.data(), chunk.second.size());
+        pos = ((pos + 3) & ~uint64_t(3)) + chunk.second.size();
+    }
+    if (saved && contents.hasIds) {
+        saved->deltaEntry = uint32_t(12 + (chunks.size() - 1) * sizeof(ChunkEntry));
+        saved->baseSize = saved->fileSize = pos;
+    }
 }
 
-template<typename T, typename U>
-static immer::set<T> readSet(HANDLE handle, const std::vector<std::pair<T, U>> &vec) {
-    immer::set<T> set;
-    auto size = readVal<uint32_t>(handle);
-    for (uint32_t i = 0; i < size; i++)
-        set = std::move(set).insert(vec[readVal<uint32_t>(handle)].first);
-    return set;
+// saved (optional) makes an incremental file, and is filled in to describe it
+static void writeFull(const std::wstring &wfile, const EditorState &state, const ViewState &view,
+        const Library &library, bool compress, SavedFile *saved) {
+    // write next to the destination then replace it, so a failed save leaves the old file intact
+    auto tempFile = wfile + L".tmp";
+    SavedFile written;
+    try {
+        auto contents = flatten(wfile, state, view, library, saved != nullptr);
+        CHandle handle(CreateFile(tempFile.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+            FILE_ATTRIBUTE_NORMAL, NULL));
+        if (handle == INVALID_HANDLE_VALUE)
+            throw winged_error(L"Error saving file");
+        OutStream out(handle);
+        writeContents(out, contents, compress, &written);
+        out.flush();
+        if (!CHECKERR(FlushFileBuffers(handle)))
+            throw winged_error(L"Error writing to file");
+    } catch (...) {
+        DeleteFile(tempFile.c_str());
+        throw;
+    }
+    if (!CHECKERR(MoveFileEx(tempFile.c_str(), wfile.c_str(),
+            MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))) {
+        DeleteFile(tempFile.c_str());
+        throw winged_error(L"Error saving file");
+    }
+    if (saved) {
+        written.compressed = compress;
+        written.incremental = true;
+        written.base = state;
+        *saved = std::move(written);
+    }
+}
+
+void writeFile(const std::string &file, const EditorState &state, const ViewState &view,
+        const Library &library, bool compress) {
+    writeFull(widen(file), state, view, library, compress, nullptr);
 }
 
-static std::string readString(HANDLE handle) {
-    auto len = readVal<uint16_t>(handle);
-    std::unique_ptr<char[]> buf(new char[len + 1]);
-    read(handle, buf.get(), len);
-    buf[len] = 0;
-    return buf.get();
+static bool writeAt(HANDLE handle, uint64_t offset, const void *data, size_t size) {
+    LARGE_INTEGER distance;
+    distance.QuadPart = LONGLONG(offset);
+    DWORD written;
+    return SetFilePointerEx(handle, distance, NULL, FILE_BEGIN)
+        && WriteFile(handle, data, DWORD(size), &written, NULL) && written == size;
 }
 
-std::tuple<EditorState, ViewState, Library> readFile(const std::string &file,
-        const std::string &libraryPath) {
-    auto wfile = widen(file);
-    CHandle handle(CreateFile(wfile.c_str(), GENERIC_READ, 0, NULL, OPEN_EXISTING,
+// Returns false if the file must be written in full instead
+static bool appendDelta(const std::wstring &wfile, const EditorState &state,
+        const ViewState &view, const Library &library, SavedFile *saved) {
+    std::vector<char> segment;
+    put(&segment, view);
+    put(&segment, uint32_t(library.idPaths.size()));
+    for (const auto &pair : library.idPaths) {
+        auto relative = relativePath(wfile, library, pair.second);
+        put(&segment, uint16_t(relative.size()));
+        segment.insert(segment.end(), relative.begin(), relative.end());
+        put(&segment, pair.first);
+    }
+    // proportional to the size of the change, since the states share structure
+    putStateDelta(&segment, saved->base, state);
+
+    auto offset = (saved->fileSize + 3) & ~uint64_t(3);
+    if ((offset - saved->baseSize + segment.size()) * 100 > saved->baseSize * MAX_DELTA_PERCENT
+            || offset + segment.size() > UINT32_MAX)
+        return false;
+
+    CHandle handle(CreateFile(wfile.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING,
         FILE_ATTRIBUTE_NORMAL, NULL));
     if (handle == INVALID_HANDLE_VALUE)
-        throw winged_error(L"Error opening file");
-    if (readVal<uint32_t>(handle) != 'WING')
-        throw winged_error(L"Unrecognized file format");
-    auto version = readVal<uint32_t>(handle);
-    if (version != 2)
-        throw winged_error(L"Unrecognized file version");
-    EditorState state;
+        return false;
+    // the file might have been replaced since it was saved
+    LARGE_INTEGER size;
+    LARGE_INTEGER entryPos;
+    entryPos.QuadPart = saved->deltaEntry;
+    ChunkEntry entry;
+    DWORD bytesRead;
+    if (!GetFileSizeEx(handle, &size) || uint64_t(size.QuadPart) != saved->fileSize
+            || !SetFilePointerEx(handle, entryPos, NULL, FILE_BEGIN)
+            || !ReadFile(handle, &entry, sizeof(entry), &bytesRead, NULL)
+            || bytesRead != sizeof(entry) || entry.id != CHUNK_DELTA
+            || uint64_t(entry.offset) + entry.size != saved->fileSize)
+        return false;
 
-    auto numPaints = readVal<uint32_t>(handle);
-    auto numFaces = readVal<uint32_t>(handle);
-    auto numVerts = readVal<uint32_t>(handle);
-    auto numEdges = readVal<uint32_t>(handle);
-    std::vector<immer::box<Paint>> paints;
-    std::vector<face_pair> faces;
-    std::vector<vert_pair> verts;
-    std::vector<edge_pair> edges;
-    paints.reserve(numPaints);
-    faces.reserve(numFaces);
-    verts.reserve(numVerts);
-    edges.reserve(numEdges);
-    for (uint32_t p = 0; p < numPaints; p++) {
-        paints.push_back(readVal<Paint>(handle));
+    // the changes are only used once the entry points to them, so a failed write is harmless
+    segment.insert(segment.begin(), size_t(offset - saved->fileSize), 0); // padding
+    if (!writeAt(handle, saved->fileSize, segment.data(), segment.size())
+            || !CHECKERR(FlushFileBuffers(handle)))
+        throw winged_error(L"Error writing to file");
+    entry.offset = uint32_t(offset);
+    entry.size = uint32_t(saved->fileSize + segment.size() - offset);
+    if (!writeAt(handle, saved->deltaEntry, &entry, sizeof(entry))
+            || !CHECKERR(FlushFileBuffers(handle)))
+        throw winged_error(L"Error writing to file");
+    saved->fileSize += segment.size();
+    return true;
+}
+
+void saveFile(const std::string &file, const EditorState &state, const ViewState &view,
+        const Library &library, bool compress, bool incremental, SavedFile *saved) {
+    auto wfile = widen(file);
+    if (incremental && saved->incremental && saved->compressed == compress && saved->fileSize
+            && appendDelta(wfile, state, view, library, saved))
+        return;
+    writeFull(wfile, state, view, library, compress, incremental ? saved : nullptr);
+    if (!incremental) {
+        *saved = {};
+        saved->compressed = compress;
     }
+}
+
+static std::string readString(InStream &in) {
+    auto len = in.get<uint16_t>();
+    return std::string(in.view(len), len);
+}
+
+static void readSelection(InStream &in, std::vector<uint32_t> *indices) {
+    in.readArray(indices, in.get<uint32_t>());
+}
+
+// version 2: sequential, with -1 terminated face loops
+static void readContentsV2(InStream &in, FileContents *contents) {
+    auto numPaints = in.get<uint32_t>();
+    auto numFaces = in.get<uint32_t>();
+    auto numVerts = in.get<uint32_t>();
+    auto numEdges = in.get<uint32_t>();
+    in.readArray(&contents->paints, numPaints);
+    in.readArray(&contents->facePaints, numFaces);
+    in.readArray(&contents->positions, numVerts);
+    contents->loopStarts.reserve(numFaces + 1);
+    contents->loopVerts.reserve(std::min(size_t(numEdges), in.remaining() / 4));
     for (uint32_t f = 0; f < numFaces; f++) {
-        face_pair pair = {genId(), {}};
-        pair.second.paint = paints[readVal<uint32_t>(handle)];
-        faces.push_back(pair);
+        contents->loopStarts.push_back(uint32_t(contents->loopVerts.size()));
+        uint32_t v;
+        while ((v = in.get<uint32_t>()) != uint32_t(-1))
+            contents->loopVerts.push_back(v);
     }
-    for (uint32_t v = 0; v < numVerts; v++) {
-        vert_pair pair = {genId(), {}};
-        pair.second.pos = readVal<glm::vec3>(handle);
-        verts.push_back(pair);
+    contents->loopStarts.push_back(uint32_t(contents->loopVerts.size()));
+
+    readSelection(in, &contents->selFaces);
+    readSelection(in, &contents->selVerts);
+    readSelection(in, &contents->selEdges);
+    in.read(contents->saveData, SAVE_DATA_SIZE);
+    contents->view = in.get<ViewState>();
+    while (1) {
+        auto relative = readString(in);
+        if (relative.empty())
+            break;
+        auto id = in.get<id_t>();
+        contents->files.push_back({relative, id});
     }
-    std::unordered_map<tuple<vert_id, vert_id>, uint32_t> vertPairEdges;
-    vertPairEdges.reserve(numEdges);
-    for (uint32_t f = 0; f < numFaces; f++) {
-        auto faceEdgeStart = edges.size();
-        uint32_t v;
-        while ((v = readVal<uint32_t>(handle)) != uint32_t(-1)) {
-            edge_pair edge = {genId(), {}};
-            edge.second.face = faces[f].first;
-            edge.second.vert = verts[v].first;
-            verts[v].second.edge = edge.first;
-            if (edges.size() == faceEdgeStart) { // first edge
-                faces[f].second.edge = edge.first;
-            } else {
-                edge.second.prev = edges.back().first;
-                edges.back().second.next = edge.first;
+}
+
+static void readContentsV3(InStream &in, FileContents *contents, bool *compressed) {
+    contents->fileSize = in.remaining() + 8;
+    auto numChunks = in.get<uint32_t>();
+    std::vector<ChunkEntry> table;
+    in.readArray(&table, numChunks);
+    std::vector<std::vector<char>> decompressed(table.size());
+    parallelFor(table.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            if (table[i].id & CHUNK_COMPRESSED)
+                decompressed[i] = decompressChunk(table[i].id & ~CHUNK_COMPRESSED,
+                    in.at(table[i].offset, table[i].size), table[i].size);
+        }
+    });
+    for (size_t c = 0; c < table.size(); c++) {
+        const auto &entry = table[c];
+        const char *data;
+        size_t size;
+        if (entry.id & CHUNK_COMPRESSED) {
+            *compressed = true;
+            data = decompressed[c].data();
+            size = decompressed[c].size();
+        } else {
+            data = in.at(entry.offset, entry.size);
+            size = entry.size;
+        }
+        InStream chunk(data, size);
+        if (entry.id != CHUNK_DELTA) {
+            auto chunkEnd = (uint64_t(entry.offset) + entry.size + 3) & ~uint64_t(3);
+            contents->baseSize = std::max(contents->baseSize, chunkEnd);
+        }
+        switch (entry.id & ~CHUNK_COMPRESSED) {
+            case CHUNK_PAINTS:
+                chunk.readArray(&contents->paints, chunk.get<uint32_t>());
+                break;
+            case CHUNK_FACES: {
+                auto numFaces = chunk.get<uint32_t>();
+                chunk.readArray(&contents->facePaints, numFaces);
+                chunk.readArray(&contents->loopStarts, size_t(numFaces) + 1);
+                break;
             }
-            edges.push_back(edge);
-        };
-        edges[faceEdgeStart].second.prev = edges.back().first;
-        edges.back().second.next = edges[faceEdgeStart].first;
-
-        for (size_t i = faceEdgeStart; i < edges.size(); i++) {
-            auto edge = &edges[i];
-            const auto &next = (i == edges.size() - 1) ? edges[faceEdgeStart] : edges[i + 1];
-            if (auto twinI = tryGet(vertPairEdges, {edge->second.vert, next.second.vert})) {
-                edge->second.twin = edges[*twinI].first;
-                edges[*twinI].second.twin = edge->first;
+            case CHUNK_VERTS:
+                chunk.readArray(&contents->positions, chunk.get<uint32_t>());
+                break;
+            case CHUNK_LOOPS:
+                chunk.readArray(&contents->loopVerts, chunk.get<uint32_t>());
+                break;
+            case CHUNK_SELECT:
+                readSelection(chunk, &contents->selFaces);
+                readSelection(chunk, &contents->selVerts);
+                readSelection(chunk, &contents->selEdges);
+                break;
+            case CHUNK_EDITOR:
+                chunk.read(contents->saveData, std::min(SAVE_DATA_SIZE, chunk.remaining()));
+                break;
+            case CHUNK_VIEW:
+                chunk.read(&contents->view, std::min(sizeof(ViewState), chunk.remaining()));
+                break;
+            case CHUNK_LIBRARY: {
+                auto numFiles = chunk.get<uint32_t>();
+                for (uint32_t i = 0; i < numFiles; i++) {
+                    auto relative = readString(chunk);
+                    auto id = chunk.get<id_t>();
+                    contents->files.push_back({relative, id});
+                }
+                break;
+            }
+            case CHUNK_IDS:
+                contents->hasIds = true;
+                chunk.readArray(&contents->faceIds, chunk.get<uint32_t>());
+                chunk.readArray(&contents->vertIds, chunk.get<uint32_t>());
+                chunk.readArray(&contents->edgeIds, chunk.get<uint32_t>());
+                break;
+            case CHUNK_DELTA:
+                contents->hasDelta = true;
+                contents->delta.assign(data, data + size);
+                contents->deltaEntry = uint32_t(12 + c * sizeof(ChunkEntry));
+                break;
+        }
+    }
+    if (contents->loopStarts.empty())
+        contents->loopStarts.push_back(0);
+}
+
+const uint32_t NO_EDGE = uint32_t(-1);
+// below this, threads cost more than they save
+const size_t MIN_PARALLEL_BATCH = 4096;
+
+// Sort key for twin matching: the pair of vertices of an edge, in either direction
+struct EdgeKey {
+    uint64_t verts;
+    uint32_t edge;
+
+    bool operator<(const EdgeKey &other) const {
+        return verts < other.verts || (verts == other.verts && edge < other.edge);
+    }
+};
+
+static void checkLoops(const FileContents &contents) {
+    const auto &loopStarts = contents.loopStarts;
+    auto numFaces = contents.facePaints.size();
+    if (loopStarts.size() != numFaces + 1 || loopStarts[0] != 0
+            || loopStarts[numFaces] != contents.loopVerts.size())
+        throw winged_error(L"Error reading file");
+    for (size_t f = 0; f < numFaces; f++) {
+        if (loopStarts[f + 1] <= loopStarts[f] || contents.facePaints[f] >= contents.paints.size())
+            throw winged_error(L"Error reading file");
+    }
+    for (auto v : contents.loopVerts)
+        if (v >= contents.positions.size())
+            throw winged_error(L"Error reading file");
+}
+
+// Index of the next edge in each face loop
+static std::vector<uint32_t> loopNext(const FileContents &contents) {
+    const auto &loopStarts = contents.loopStarts;
+    std::vector<uint32_t> next(contents.loopVerts.size());
+    parallelFor(contents.facePaints.size(), MIN_PARALLEL_BATCH / 4, [&](size_t begin, size_t end) {
+        for (size_t f = begin; f < end; f++) {
+            for (auto i = loopStarts[f]; i < loopStarts[f + 1] - 1; i++)
+                next[i] = i + 1;
+            next[loopStarts[f + 1] - 1] = loopStarts[f];
+        }
+    });
+    return next;
+}
+
+// Twins have the same pair of vertices in opposite directions, so they are adjacent after sorting.
+// Edges without exactly one opposite edge are left unmatched, for the caller to report.
+static std::vector<uint32_t> matchTwins(const FileContents &contents,
+        const std::vector<uint32_t> &next) {
+    const auto &loopVerts = contents.loopVerts;
+    auto numEdges = loopVerts.size();
+    std::vector<EdgeKey> keys(numEdges);
+    parallelFor(numEdges, MIN_PARALLEL_BATCH, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            uint64_t a = loopVerts[i], b = loopVerts[next[i]];
+            keys[i] = {a < b ? (a << 32 | b) : (b << 32 | a), uint32_t(i)};
+        }
+    });
+
+    // sort blocks in parallel, then merge pairs of blocks until one remains
+    size_t numBlocks = std::max(size_t(1), std::min(size_t(numWorkers()),
+        numEdges / MIN_PARALLEL_BATCH));
+    std::vector<size_t> bounds;
+    for (size_t i = 0; i <= numBlocks; i++)
+        bounds.push_back(numEdges * i / numBlocks);
+    parallelFor(numBlocks, 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+            std::sort(keys.begin() + ptrdiff_t(bounds[i]), keys.begin() + ptrdiff_t(bounds[i + 1]));
+    });
+    for (size_t width = 1; width < numBlocks; width *= 2) {
+        parallelFor((numBlocks + width * 2 - 1) / (width * 2), 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                auto first = i * width * 2, mid = first + width;
+                if (mid >= numBlocks)
+                    continue;
+                auto last = std::min(mid + width, numBlocks);
+                std::inplace_merge(keys.begin() + ptrdiff_t(bounds[first]),
+                    keys.begin() + ptrdiff_t(bounds[mid]), keys.begin() + ptrdiff_t(bounds[last]));
+            }
+        });
+    }
+
+    std::vector<uint32_t> twins(numEdges, NO_EDGE);
+    parallelFor(numEdges, MIN_PARALLEL_BATCH, [&](size_t begin, size_t end) {
+        // each range handles the groups which start inside it
+        auto i = begin;
+        while (i > 0 && i < end && keys[i].verts == keys[i - 1].verts)
+            i++;
+        while (i < end) {
+            auto groupEnd = i + 1;
+            while (groupEnd < numEdges && keys[groupEnd].verts == keys[i].verts)
+                groupEnd++;
+            if (groupEnd - i == 2) {
+                auto e1 = keys[i].edge, e2 = keys[i + 1].edge;
+                if (loopVerts[e1] != loopVerts[e2]) {
+                    twins[e1] = e2;
+                    twins[e2] = e1;
+                }
+            }
+            i = groupEnd;
+        }
+    });
+    return twins;
+}
+
+// Boundaries of .wing models are closed with hole faces, so every edge must have a twin
+static void checkTwins(const std::vector<uint32_t> &twins) {
+    if (std::find(twins.begin(), twins.end(), NO_EDGE) != twins.end())
+        throw winged_error(L"File has an edge which is shared by more than two faces, or by faces "
+            "facing opposite directions");
+}
+
+template<typename T>
+static immer::set<T> selElements(const std::vector<uint32_t> &indices,
+        const std::vector<id_t> &ids) {
+    auto set = immer::set<T>{}.transient();
+    for (auto index : indices) {
+        if (index >= ids.size())
+            throw winged_error(L"Error reading file");
+        set.insert(ids[index]);
+    }
+    return set.persistent();
+}
+
+// Rebuild the half-edge structure, with the saved IDs or new IDs if there are none. Topology is
+// built on indices in parallel, then each map is filled by its own thread. Loops must be checked.
+static EditorState buildState(const FileContents &contents, const std::vector<uint32_t> &next,
+        const std::vector<uint32_t> &twins) {
+    const auto &loopStarts = contents.loopStarts;
+    const auto &loopVerts = contents.loopVerts;
+    auto numFaces = contents.facePaints.size();
+    auto numVerts = contents.positions.size();
+    auto numEdges = loopVerts.size();
+
+    std::vector<id_t> newFaceIds, newVertIds, newEdgeIds;
+    if (contents.hasIds) {
+        if (contents.faceIds.size() != numFaces || contents.vertIds.size() != numVerts
+                || contents.edgeIds.size() != numEdges)
+            throw winged_error(L"Error reading file");
+    } else {
+        newFaceIds = genIds(numFaces);
+        newVertIds = genIds(numVerts);
+        newEdgeIds = genIds(numEdges);
+    }
+    const auto &faceIds = contents.hasIds ? contents.faceIds : newFaceIds;
+    const auto &vertIds = contents.hasIds ? contents.vertIds : newVertIds;
+    const auto &edgeIds = contents.hasIds ? contents.edgeIds : newEdgeIds;
+    std::vector<uint32_t> vertEdges(numVerts, NO_EDGE);
+    for (size_t i = 0; i < numEdges; i++)
+        vertEdges[loopVerts[i]] = uint32_t(i);
+    std::vector<immer::box<Paint>> paints(contents.paints.begin(), contents.paints.end());
+
+    EditorState state;
+    parallelFor(3, 1, [&](size_t begin, size_t end) {
+        for (size_t map = begin; map < end; map++) {
+            if (map == 0) {
+                auto faces = state.surf.faces.transient();
+                for (size_t f = 0; f < numFaces; f++) {
+                    Face face;
+                    face.edge = edgeIds[loopStarts[f]];
+                    face.paint = paints[contents.facePaints[f]];
+                    faces.set(faceIds[f], face);
+                }
+                state.surf.faces = faces.persistent();
+            } else if (map == 1) {
+                auto verts = state.surf.verts.transient();
+                for (size_t v = 0; v < numVerts; v++) {
+                    Vertex vert;
+                    if (vertEdges[v] != NO_EDGE)
+                        vert.edge = edgeIds[vertEdges[v]];
+                    vert.pos = contents.positions[v];
+                    verts.set(vertIds[v], vert);
+                }
+                state.surf.verts = verts.persistent();
             } else {
-                vertPairEdges[{next.second.vert, edge->second.vert}] = uint32_t(i);
+                auto edges = state.surf.edges.transient();
+                for (size_t f = 0; f < numFaces; f++) {
+                    for (auto i = loopStarts[f]; i < loopStarts[f + 1]; i++) {
+                        HEdge edge;
+                        if (twins[i] != NO_EDGE)
+                            edge.twin = edgeIds[twins[i]];
+                        edge.next = edgeIds[next[i]];
+                        edge.prev = edgeIds[i == loopStarts[f] ? loopStarts[f + 1] - 1 : i - 1];
+                        edge.vert = vertIds[loopVerts[i]];
+                        edge.face = faceIds[f];
+                        edges.set(edgeIds[i], edge);
+                    }
+                }
+                state.surf.edges = edges.persistent();
+            }
+        }
+    });
+    state.selFaces = selElements<face_id>(contents.selFaces, faceIds);
+    state.selVerts = selElements<vert_id>(contents.selVerts, vertIds);
+    state.selEdges = selElements<edge_id>(contents.selEdges, edgeIds);
+    memcpy(&state.SAVE_DATA, contents.saveData, SAVE_DATA_SIZE);
+    return state;
+}
+
+// Faces triangulated as fans (so concave faces may be wrong) with their edges, for showing the
+// model while the half-edge structure is built
+static RenderMesh previewMesh(const FileContents &contents, size_t faceBegin, size_t faceEnd) {
+    const auto &loopStarts = contents.loopStarts;
+    RenderMesh mesh;
+    auto numVerts = loopStarts[faceEnd] - loopStarts[faceBegin];
+    mesh.vertices.reserve(numVerts);
+    mesh.normals.reserve(numVerts);
+    mesh.texCoords.reserve(numVerts);
+    std::vector<index_t> edgeIndices;
+    edgeIndices.reserve(numVerts * 2);
+    std::unordered_map<id_t, std::vector<index_t>> matIndices;
+    for (size_t f = faceBegin; f < faceEnd; f++) {
+        auto start = loopStarts[f], end = loopStarts[f + 1];
+        auto loopPos = [&](uint32_t i) { return contents.positions[contents.loopVerts[i]]; };
+        glm::vec3 normal = {};
+        for (auto i = start; i < end; i++)
+            normal += accumPolyNormal(loopPos(i), loopPos(i + 1 < end ? i + 1 : start));
+        normal = glm::normalize(normal);
+        const auto &paint = contents.paints[contents.facePaints[f]];
+        glm::mat4x2 texMat = faceTexMat(paint, normal);
+        if (paint.material == id_t{})
+            texMat = glm::mat2x2(0.25f) * texMat; // as in generateRenderMesh
+        auto &indices = matIndices[paint.material];
+        auto first = index_t(mesh.vertices.size());
+        for (auto i = start; i < end; i++) {
+            auto v = loopPos(i);
+            auto index = index_t(mesh.vertices.size());
+            mesh.vertices.push_back(v);
+            mesh.normals.push_back(normal);
+            mesh.texCoords.push_back(texMat * glm::vec4(v, 1));
+            edgeIndices.push_back(index);
+            edgeIndices.push_back(i + 1 < end ? index_t(index + 1) : first);
+            if (i >= start + 2) {
+                indices.push_back(first);
+                indices.push_back(index_t(index - 1));
+                indices.push_back(index);
             }
         }
     }
-    for (const auto &pair : faces)
-        state.surf.faces = std::move(state.surf.faces).insert(pair);
-    for (const auto &pair : verts)
-        state.surf.verts = std::move(state.surf.verts).insert(pair);
-    for (const auto &pair : edges)
-        state.surf.edges = std::move(state.surf.edges).insert(pair);
-    state.selFaces = readSet<face_id>(handle, faces);
-    state.selVerts = readSet<vert_id>(handle, verts);
-    state.selEdges = readSet<edge_id>(handle, edges);
+    mesh.ranges[ELEM_REG_EDGE] = {0, edgeIndices.size()};
+    mesh.indices = std::move(edgeIndices);
+    for (const auto &pair : matIndices) {
+        mesh.faceMeshes.push_back({pair.first, {mesh.indices.size(), pair.second.size()},
+            RenderFaceMesh::REG});
+        mesh.indices.insert(mesh.indices.end(), pair.second.begin(), pair.second.end());
+    }
+    return mesh;
+}
+
+static void sendPreview(const FileContents &contents, const PreviewFn &preview) {
+    const auto &loopStarts = contents.loopStarts;
+    auto numFaces = contents.facePaints.size();
+    size_t batchStart = 0;
+    for (size_t f = 0; f < numFaces; f++) {
+        if (loopStarts[f + 1] - loopStarts[f] > PREVIEW_BATCH_VERTS) {
+            // too many vertices to index, left out of the preview
+            if (f > batchStart)
+                preview(previewMesh(contents, batchStart, f));
+            batchStart = f + 1;
+        } else if (loopStarts[f + 1] - loopStarts[batchStart] > PREVIEW_BATCH_VERTS) {
+            preview(previewMesh(contents, batchStart, f));
+            batchStart = f;
+        }
+    }
+    if (numFaces > batchStart)
+        preview(previewMesh(contents, batchStart, numFaces));
+}
 
-    read(handle, &state.SAVE_DATA, sizeof(EditorState) - offsetof(EditorState, SAVE_DATA));
-    auto view = readVal<ViewState>(handle);
+std::tuple<EditorState, ViewState, Library> readFile(const std::string &file,
+        const std::string &libraryPath, SavedFile *saved, const PreviewFn &preview) {
+    auto wfile = widen(file);
+    CHandle handle(CreateFile(wfile.c_str(), GENERIC_READ, 0, NULL, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, NULL));
+    if (handle == INVALID_HANDLE_VALUE)
+        throw winged_error(L"Error opening file");
+    InStream in(handle);
+    if (in.remaining() < 4 || in.get<uint32_t>() != FILE_MAGIC)
+        throw winged_error(L"Unrecognized file format");
+    auto version = in.get<uint32_t>();
+    FileContents contents;
+    bool isCompressed = false;
+    if (version == 2)
+        readContentsV2(in, &contents);
+    else if (version == 3)
+        readContentsV3(in, &contents, &isCompressed);
+    else
+        throw winged_error(L"Unrecognized file version");
+    checkLoops(contents);
+    if (preview)
+        sendPreview(contents, preview); // the base state, for incremental files
+    auto next = loopNext(contents);
+    auto twins = matchTwins(contents, next);
+    checkTwins(twins);
+    EditorState base = buildState(contents, next, twins);
+    EditorState state = base;
+    ViewState view = contents.view;
+    if (contents.hasDelta && !contents.delta.empty()) {
+        // replaces the view and library
+        InStream delta(contents.delta.data(), contents.delta.size());
+        view = delta.get<ViewState>();
+        contents.files.clear();
+        auto numFiles = delta.get<uint32_t>();
+        for (uint32_t i = 0; i < numFiles; i++) {
+            auto relative = readString(delta);
+            auto id = delta.get<id_t>();
+            contents.files.push_back({relative, id});
+        }
+        auto size = delta.remaining();
+        auto ptr = delta.view(size);
+        state = takeStateDelta(base, &ptr, ptr + size);
+    }
+    if (saved) {
+        *saved = {};
+        saved->compressed = isCompressed;
+        if (contents.hasIds && contents.hasDelta) {
+            saved->incremental = true;
+            saved->base = std::move(base);
+            saved->deltaEntry = contents.deltaEntry;
+            saved->baseSize = contents.baseSize;
+            saved->fileSize = contents.fileSize;
+        }
+    }
 
     Library library;
     library.rootPath = libraryPath;
@@ -287,30 +1062,119 @@ std::tuple<EditorState, ViewState, Library> readFile(const std::string &file,
         lstrcpy(folder, wfile.c_str());
         PathRemoveFileSpec(folder);
     }
-    while (1) {
+    for (const auto &pair : contents.files) {
         wchar_t combined[MAX_PATH] = L"";
-        auto relative = readString(handle);
-        if (relative.empty())
-            break;
         if (libraryPath[0] == 0)
-            PathCombine(combined, folder, widen(relative).c_str());
+            PathCombine(combined, folder, widen(pair.first).c_str());
         else
-            PathCombine(combined, widen(libraryPath).c_str(), widen(relative).c_str());
-        auto id = readVal<id_t>(handle);
+            PathCombine(combined, widen(libraryPath).c_str(), widen(pair.first).c_str());
         if (combined[0])
-            library.addFile(id, narrow(combined));
+            library.addFile(pair.second, narrow(combined));
     }
 
     return {state, view, library};
 }
 
 
-struct ObjFaceVert {
-    int v, vt;
+// Faces or vertices formatted by one task
+const size_t OBJ_BLOCK_SIZE = 2048;
+
+// Hash of float values which treats 0 and -0 as equal, like ==
+struct ObjVecHash {
+    static size_t mix(size_t hash, float value) {
+        value += 0.0f; // -0 to 0
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        return (hash ^ bits) * 0x01000193;
+    }
+    size_t operator()(glm::vec2 v) const { return mix(mix(0x811C9DC5, v.x), v.y); }
+    size_t operator()(glm::vec3 v) const { return mix(mix(mix(0x811C9DC5, v.x), v.y), v.z); }
 };
 
+struct ObjFaceBlock {
+    size_t material;
+    const Face *faces;
+    size_t numFaces;
+
+    // per face, plus end
+    std::vector<size_t> loopStart, triStart;
+    std::vector<glm::vec3> normals; // per face
+    std::vector<int> loopVerts; // OBJ indices
+    std::vector<glm::vec2> texCoords; // per loop
+    std::vector<index_t> tris; // relative to the face's first loop
+    // OBJ indices, new ones are written by this block
+    std::vector<int> normalIs, texCoordIs;
+    std::vector<bool> newNormals, newTexCoords;
+    std::string text;
+};
+
+static void appendObjFloat(std::string *text, float value, bool roundTrip) {
+    char buf[FLOAT_TEXT_SIZE + 1];
+    buf[0] = ' ';
+    text->append(buf, roundTrip ? formatShortest(buf + 1, value) : formatFixed(buf + 1, value));
+}
+
+static void prepareObjFaces(ObjFaceBlock *block, const Surface &surf,
+        const std::unordered_map<vert_id, int> &vertIndices, FaceTesselator *tess) {
+    for (size_t f = 0; f < block->numFaces; f++) {
+        const auto &face = block->faces[f];
+        auto normal = faceNormal(surf, face);
+        glm::mat4x2 texMat = faceTexMat(face.paint, normal);
+        block->normals.push_back(normal);
+        block->loopStart.push_back(block->loopVerts.size());
+        for (auto edge : FaceEdges(surf, face)) {
+            auto pos = edge.second.vert.in(surf).pos;
+            block->loopVerts.push_back(vertIndices.at(edge.second.vert));
+            block->texCoords.push_back(texMat * glm::vec4(pos, 1));
+        }
+        block->triStart.push_back(block->tris.size());
+        tess->tesselate(block->tris, surf, face, normal);
+    }
+    block->loopStart.push_back(block->loopVerts.size());
+    block->triStart.push_back(block->tris.size());
+}
+
+static void formatObjFaces(ObjFaceBlock *block, const std::string &header, bool roundTrip) {
+    auto &text = block->text;
+    text.reserve(block->tris.size() * 24 + block->numFaces * 32);
+    text += header;
+    char buf[FLOAT_TEXT_SIZE];
+    for (size_t f = 0; f < block->numFaces; f++) {
+        if (block->newNormals[f]) {
+            text += "\nvn";
+            for (int c = 0; c < 3; c++)
+                appendObjFloat(&text, block->normals[f][c], roundTrip);
+        }
+        for (size_t l = block->loopStart[f]; l < block->loopStart[f + 1]; l++) {
+            if (block->newTexCoords[l]) {
+                text += "\nvt";
+                appendObjFloat(&text, block->texCoords[l].x, roundTrip);
+                appendObjFloat(&text, block->texCoords[l].y, roundTrip);
+            }
+        }
+        auto vn = formatInt(buf, block->normalIs[f]);
+        auto vnLen = size_t(vn - buf);
+        for (size_t i = block->triStart[f]; i < block->triStart[f + 1]; ) {
+            text += "\nf";
+            for (size_t j = 0; j < 3; j++, i++) {
+                auto loop = block->loopStart[f] + block->tris[i];
+                text += ' ';
+                text.append(buf + vnLen, formatInt(buf + vnLen, block->loopVerts[loop]));
+                text += '/';
+                text.append(buf + vnLen, formatInt(buf + vnLen, block->texCoordIs[loop]));
+                text += '/';
+                text.append(buf, vnLen);
+            }
+        }
+    }
+}
+
+// Vertices are written first, then faces grouped by material. Formatting is split into blocks which
+// run in parallel, a window at a time to limit memory use, and are written in order. Only assigning
+// indices to unique normals and texture coordinates is serial, so the output is the same as
+// formatting it all in sequence. Progress is reported after each window, in vertices and faces.
 void writeObj(const std::string &file, const Surface &surf, const Library &library,
-        const std::string &mtlName, bool writeMtl) {
+        const std::string &mtlName, bool writeMtl, bool roundTrip, const ProgressFn &progress) {
     auto wfile = widen(file);
     std::unordered_map<std::string, id_t> matNames;
 
@@ -319,17 +1183,45 @@ void writeObj(const std::string &file, const Surface &surf, const Library &libra
             FILE_ATTRIBUTE_NORMAL, NULL));
         if (handle == INVALID_HANDLE_VALUE)
             throw winged_error(L"Error saving OBJ file");
-        char buf[256];
+        OutStream out(handle, 1 << 20);
+        size_t window = numWorkers() * 4;
+        size_t totalWork = surf.verts.size() + surf.faces.size(), workDone = 0;
 
         if (!mtlName.empty())
-            write(handle, buf, sprintf(buf, "mtllib %s\n\n", mtlName.c_str()));
+            out.print("mtllib %s\n\n", mtlName.c_str());
 
         std::unordered_map<vert_id, int> vertIndices;
-        int v = 1;
+        vertIndices.reserve(surf.verts.size());
+        std::vector<glm::vec3> positions;
+        positions.reserve(surf.verts.size());
         for (const auto &vert : surf.verts) {
-            auto pos = vert.second.pos;
-            write(handle, buf, sprintf(buf, "v %f %f %f\n", pos.x, pos.y, pos.z));
-            vertIndices[vert.first] = v++;
+            positions.push_back(vert.second.pos);
+            vertIndices[vert.first] = int(positions.size());
+        }
+        size_t numVertBlocks = (positions.size() + OBJ_BLOCK_SIZE - 1) / OBJ_BLOCK_SIZE;
+        std::vector<std::string> vertTexts(window);
+        for (size_t w = 0; w < numVertBlocks; w += window) {
+            size_t count = std::min(window, numVertBlocks - w);
+            parallelFor(count, 1, [&](size_t begin, size_t end) {
+                for (size_t b = begin; b < end; b++) {
+                    auto &text = vertTexts[b];
+                    size_t first = (w + b) * OBJ_BLOCK_SIZE;
+                    size_t last = std::min(positions.size(), first + OBJ_BLOCK_SIZE);
+                    text.clear();
+                    text.reserve((last - first) * 36);
+                    for (size_t v = first; v < last; v++) {
+                        text += 'v';
+                        for (int c = 0; c < 3; c++)
+                            appendObjFloat(&text, positions[v][c], roundTrip);
+                        text += '\n';
+                    }
+                }
+            });
+            for (size_t b = 0; b < count; b++)
+                out.write(vertTexts[b].data(), vertTexts[b].size());
+            workDone = std::min(positions.size(), (w + count) * OBJ_BLOCK_SIZE);
+            if (progress)
+                progress(workDone, totalWork);
         }
 
         std::unordered_map<id_t, std::vector<Face>> matFaces;
@@ -338,10 +1230,8 @@ void writeObj(const std::string &file, const Surface &surf, const Library &libra
                 matFaces[pair.second.paint->material].push_back(pair.second);
         }
 
-        std::unordered_map<glm::vec3, int> normalIndices;
-        std::unordered_map<glm::vec2, int> texCoordIndices;
-        std::vector<ObjFaceVert> faceVerts;
-        std::vector<index_t> faceIndices;
+        std::vector<std::string> headers;
+        std::vector<ObjFaceBlock> blocks;
         for (const auto &pair : matFaces) {
             std::string texFile;
             if (auto path = tryGet(library.idPaths, pair.first)) {
@@ -355,46 +1245,57 @@ void writeObj(const std::string &file, const Surface &surf, const Library &libra
             while (matName.empty() || matNames.count(matName))
                 matName = texFile + std::to_string(num++);
             matNames[matName] = pair.first;
-            write(handle, buf, sprintf(buf, "\nusemtl %s", matName.c_str()));
+            headers.push_back("\nusemtl " + matName);
 
-            for (const auto &face : pair.second) {
-                auto normal = faceNormal(surf, face);
-                int vn;
-                if (auto vnPtr = tryGet(normalIndices, normal)) {
-                    vn = *vnPtr;
-                } else {
-                    vn = int(normalIndices.size()) + 1;
-                    normalIndices[normal] = vn;
-                    write(handle, buf, sprintf(buf, "\nvn %f %f %f", normal.x, normal.y, normal.z));
-                }
+            for (size_t f = 0; f < pair.second.size(); f += OBJ_BLOCK_SIZE) {
+                ObjFaceBlock block;
+                block.material = headers.size() - 1;
+                block.faces = pair.second.data() + f;
+                block.numFaces = std::min(OBJ_BLOCK_SIZE, pair.second.size() - f);
+                blocks.push_back(std::move(block));
+            }
+        }
 
-                glm::mat4x2 texMat = faceTexMat(face.paint, normal);
-                faceVerts.clear();
-                for (auto edge : FaceEdges(surf, face)) {
-                    auto texCoord = texMat * glm::vec4(edge.second.vert.in(surf).pos, 1);
-                    int vt;
-                    if (auto vtPtr = tryGet(texCoordIndices, texCoord)) {
-                        vt = *vtPtr;
-                    } else {
-                        vt = int(texCoordIndices.size()) + 1;
-                        texCoordIndices[texCoord] = vt;
-                        write(handle, buf, sprintf(buf, "\nvt %f %f", texCoord.x, texCoord.y));
-                    }
-                    faceVerts.push_back({vertIndices[edge.second.vert], vt});
+        std::unordered_map<glm::vec3, int, ObjVecHash> normalIndices;
+        std::unordered_map<glm::vec2, int, ObjVecHash> texCoordIndices;
+        for (size_t w = 0; w < blocks.size(); w += window) {
+            size_t count = std::min(window, blocks.size() - w);
+            parallelFor(count, 1, [&](size_t begin, size_t end) {
+                FaceTesselator tess;
+                for (size_t b = begin; b < end; b++)
+                    prepareObjFaces(&blocks[w + b], surf, vertIndices, &tess);
+            });
+            for (size_t b = w; b < w + count; b++) {
+                auto &block = blocks[b];
+                for (size_t f = 0; f < block.numFaces; f++) {
+                    auto inserted = normalIndices.insert(
+                        {block.normals[f], int(normalIndices.size()) + 1});
+                    block.normalIs.push_back(inserted.first->second);
+                    block.newNormals.push_back(inserted.second);
                 }
-
-                faceIndices.clear();
-                tesselateFace(faceIndices, surf, face, normal);
-                for (size_t i = 0; i < faceIndices.size(); ) {
-                    write(handle, "\nf", 2);
-                    for (size_t j = 0; j < 3; j++, i++) {
-                        const auto &ofv = faceVerts[faceIndices[i]];
-                        write(handle, buf, sprintf(buf, " %d/%d/%d", ofv.v, ofv.vt, vn));
-                    }
+                for (auto texCoord : block.texCoords) {
+                    auto inserted = texCoordIndices.insert(
+                        {texCoord, int(texCoordIndices.size()) + 1});
+                    block.texCoordIs.push_back(inserted.first->second);
+                    block.newTexCoords.push_back(inserted.second);
                 }
-                vn++;
             }
+            parallelFor(count, 1, [&](size_t begin, size_t end) {
+                for (size_t b = w + begin; b < w + end; b++) {
+                    bool first = b == 0 || blocks[b - 1].material != blocks[b].material;
+                    formatObjFaces(&blocks[b], first ? headers[blocks[b].material] : "",
+                        roundTrip);
+                }
+            });
+            for (size_t b = w; b < w + count; b++) {
+                out.write(blocks[b].text.data(), blocks[b].text.size());
+                workDone += blocks[b].numFaces;
+                blocks[b] = {blocks[b].material, nullptr, 0}; // free memory
+            }
+            if (progress)
+                progress(workDone, totalWork);
         }
+        out.flush();
     }
 
     if (writeMtl) {
@@ -407,20 +1308,1165 @@ void writeObj(const std::string &file, const Surface &surf, const Library &libra
             FILE_ATTRIBUTE_NORMAL, NULL));
         if (handle == INVALID_HANDLE_VALUE)
             throw winged_error(L"Error saving MTL file");
-        char buf[256];
+        OutStream out(handle);
 
         for (const auto &pair : matNames) {
-            write(handle, buf, sprintf(buf, "newmtl %s\n", pair.first.c_str()));
+            out.print("newmtl %s\n", pair.first.c_str());
             if (auto texPath = tryGet(library.idPaths, pair.second)) {
                 wchar_t relative[MAX_PATH] = L"";
                 auto wpath = widen(*texPath);
                 PathRelativePathTo(relative, folder, FILE_ATTRIBUTE_DIRECTORY, wpath.c_str(), 0);
                 for (wchar_t *c = relative; *c; c++)
                     if (*c == L'\\') *c = L'/';
-                write(handle, buf, sprintf(buf, "map_Kd %S\n", relative));
+                out.print("map_Kd %S\n", relative);
+            }
+        }
+        out.flush();
+    }
+}
+
+// Bytes of OBJ text parsed by one task, at least
+const size_t OBJ_MIN_CHUNK = 1 << 18;
+const uint32_t NO_VERT = uint32_t(-1);
+
+static const double OBJ_POW10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+// A range of whole lines, parsed independently
+struct ObjChunk {
+    const char *begin, *end;
+    uint32_t firstLine = 0, numLines = 0; // zero-based
+    uint32_t firstVert = 0, numVerts = 0;
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t> faceSizes, faceLines;
+    std::vector<int64_t> loopVerts; // zero-based, not checked
+    const wchar_t *error = nullptr; // message format with the line number
+    uint32_t errorLine = 0;
+};
+
+// winged_error doesn't own its message, so this one carries it. Imports run on workers and the
+// error is shown later on the main thread, so a shared buffer could be overwritten by then.
+struct ObjError : winged_error {
+    uint32_t line, count; // line is one-based
+    wchar_t text[256];
+    ObjError(const wchar_t *format, uint32_t line, uint32_t count)
+            : winged_error(text), line(line), count(count) {
+        _swprintf(text, format, line, count);
+    }
+    ObjError(const ObjError &other) : winged_error(text), line(other.line), count(other.count) {
+        memcpy(text, other.text, sizeof(text));
+    }
+    ObjError & operator=(const ObjError &) = delete;
+};
+
+static ObjError objError(const wchar_t *format, uint32_t line, uint32_t count = 0) {
+    return ObjError(format, line + 1, count);
+}
+
+static bool isObjSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static const char * skipObjSpace(const char *p, const char *end) {
+    while (p < end && isObjSpace(*p))
+        p++;
+    return p;
+}
+
+static bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// Returns the end of the number, or nullptr if there isn't one. Not always correctly rounded.
+static const char * parseObjFloat(const char *p, const char *end, float *value) {
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+    uint64_t mantissa = 0;
+    int exp10 = 0, digits = 0;
+    for (; p < end && isDigit(*p); p++, digits++) {
+        if (mantissa < 100000000000000000)
+            mantissa = mantissa * 10 + uint64_t(*p - '0');
+        else
+            exp10++;
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && isDigit(*p); p++, digits++) {
+            if (mantissa < 100000000000000000) {
+                mantissa = mantissa * 10 + uint64_t(*p - '0');
+                exp10--;
+            }
+        }
+    }
+    if (!digits)
+        return nullptr;
+    if (p + 1 < end && (*p == 'e' || *p == 'E')) {
+        auto q = p + 1;
+        bool expNegative = false;
+        if (q < end && (*q == '-' || *q == '+'))
+            expNegative = *q++ == '-';
+        if (q < end && isDigit(*q)) {
+            int exp = 0;
+            for (; q < end && isDigit(*q); q++)
+                if (exp < 1000)
+                    exp = exp * 10 + (*q - '0');
+            exp10 += expNegative ? -exp : exp;
+            p = q;
+        }
+    }
+    auto result = double(mantissa);
+    if (exp10 >= -22 && exp10 <= 22)
+        result = exp10 < 0 ? result / OBJ_POW10[-exp10] : result * OBJ_POW10[exp10];
+    else
+        result *= std::pow(10.0, exp10);
+    *value = float(negative ? -result : result);
+    return p;
+}
+
+static const char * parseObjIndex(const char *p, const char *end, int64_t *value) {
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+    auto start = p;
+    int64_t index = 0;
+    for (; p < end && isDigit(*p); p++)
+        if (index < (int64_t(1) << 40))
+            index = index * 10 + (*p - '0');
+    if (p == start)
+        return nullptr;
+    *value = negative ? -index : index;
+    return p;
+}
+
+static const char * objLineEnd(const char *p, const char *end) {
+    auto lineEnd = static_cast<const char *>(memchr(p, '\n', size_t(end - p)));
+    return lineEnd ? lineEnd : end;
+}
+
+static const char * objNextLine(const char *lineEnd, const char *end) {
+    return lineEnd < end ? lineEnd + 1 : end;
+}
+
+// First pass, so that relative indices and line numbers are known when parsing
+static void countObjLines(ObjChunk *chunk) {
+    for (auto p = chunk->begin; p < chunk->end; chunk->numLines++) {
+        auto lineEnd = objLineEnd(p, chunk->end);
+        auto c = skipObjSpace(p, lineEnd);
+        if (lineEnd - c >= 2 && c[0] == 'v' && isObjSpace(c[1]))
+            chunk->numVerts++;
+        p = objNextLine(lineEnd, chunk->end);
+    }
+}
+
+// Only vertex positions and faces are used. Texture coordinates can't be represented by paints.
+static void parseObjChunk(ObjChunk *chunk) {
+    auto line = chunk->firstLine;
+    for (auto p = chunk->begin; p < chunk->end; line++) {
+        auto lineEnd = objLineEnd(p, chunk->end);
+        auto c = skipObjSpace(p, lineEnd);
+        p = objNextLine(lineEnd, chunk->end);
+        if (lineEnd - c < 2 || !isObjSpace(c[1]))
+            continue;
+        if (c[0] == 'v') {
+            glm::vec3 pos;
+            c += 2;
+            for (int i = 0; i < 3 && c; i++)
+                c = parseObjFloat(skipObjSpace(c, lineEnd), lineEnd, &pos[i]);
+            if (!c) {
+                chunk->error = L"Error reading OBJ file on line %u";
+                chunk->errorLine = line;
+                return;
+            }
+            chunk->positions.push_back(pos);
+        } else if (c[0] == 'f') {
+            uint32_t size = 0;
+            for (c = skipObjSpace(c + 2, lineEnd); c < lineEnd; c = skipObjSpace(c, lineEnd)) {
+                int64_t index;
+                c = parseObjIndex(c, lineEnd, &index);
+                if (!c || index == 0) {
+                    chunk->error = L"Error reading OBJ file on line %u";
+                    chunk->errorLine = line;
+                    return;
+                }
+                // negative is relative to the vertices before this line
+                chunk->loopVerts.push_back(index > 0 ? index - 1
+                    : int64_t(chunk->firstVert) + int64_t(chunk->positions.size()) + index);
+                size++;
+                while (c < lineEnd && !isObjSpace(*c))
+                    c++; // texture coordinate and normal indices
+            }
+            chunk->faceSizes.push_back(size);
+            chunk->faceLines.push_back(line);
+        }
+    }
+}
+
+static void throwObjChunkError(const std::vector<ObjChunk> &chunks) {
+    for (const auto &chunk : chunks)
+        if (chunk.error)
+            throw objError(chunk.error, chunk.errorLine);
+}
+
+static bool hasRepeatedVert(const uint32_t *verts, size_t count) {
+    if (count <= 16) {
+        for (size_t i = 0; i < count; i++)
+            for (size_t j = i + 1; j < count; j++)
+                if (verts[i] == verts[j])
+                    return true;
+        return false;
+    }
+    std::vector<uint32_t> sorted(verts, verts + count);
+    std::sort(sorted.begin(), sorted.end());
+    return std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end();
+}
+
+static size_t faceOfLoop(const FileContents &contents, size_t loop) {
+    const auto &loopStarts = contents.loopStarts;
+    return size_t(std::upper_bound(loopStarts.begin(), loopStarts.end(), loop)
+        - loopStarts.begin()) - 1;
+}
+
+// Lines are parsed in parallel chunks into the same index-based contents as a .wing file, with
+// coincident vertices welded. Boundaries are closed with hole faces, and anything which can't be
+// represented by half-edges is reported. Progress is reported between stages.
+Surface readObj(const std::string &file, const ProgressFn &progress) {
+    const size_t NUM_STAGES = 6;
+    auto stage = [&](size_t done) {
+        if (progress)
+            progress(done, NUM_STAGES);
+    };
+    CHandle handle(CreateFile(widen(file).c_str(), GENERIC_READ, 0, NULL, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, NULL));
+    if (handle == INVALID_HANDLE_VALUE)
+        throw winged_error(L"Error opening file");
+    InStream in(handle);
+    auto size = in.remaining();
+    auto data = in.view(size);
+
+    size_t numChunks = std::max(size_t(1), std::min(size_t(numWorkers()) * 4,
+        size / OBJ_MIN_CHUNK));
+    std::vector<ObjChunk> chunks(numChunks);
+    const char *chunkBegin = data;
+    for (size_t i = 0; i < numChunks; i++) {
+        auto chunkEnd = data + size; // last chunk always reaches the end
+        if (i + 1 < numChunks) {
+            // 64-bit, size * numChunks can overflow size_t
+            chunkEnd = data + size_t(uint64_t(size) * (i + 1) / numChunks);
+            if (chunkEnd < chunkBegin)
+                chunkEnd = chunkBegin;
+            chunkEnd = objNextLine(objLineEnd(chunkEnd, data + size), data + size);
+        }
+        chunks[i].begin = chunkBegin;
+        chunks[i].end = chunkEnd;
+        chunkBegin = chunkEnd;
+    }
+    parallelFor(numChunks, 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+            countObjLines(&chunks[i]);
+    });
+    for (size_t i = 1; i < numChunks; i++) {
+        chunks[i].firstLine = chunks[i - 1].firstLine + chunks[i - 1].numLines;
+        chunks[i].firstVert = chunks[i - 1].firstVert + chunks[i - 1].numVerts;
+    }
+    parallelFor(numChunks, 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+            parseObjChunk(&chunks[i]);
+    });
+    throwObjChunkError(chunks);
+    stage(1);
+
+    // combine chunks
+    std::vector<size_t> faceOffsets(numChunks + 1), loopOffsets(numChunks + 1);
+    for (size_t i = 0; i < numChunks; i++) {
+        faceOffsets[i + 1] = faceOffsets[i] + chunks[i].faceSizes.size();
+        loopOffsets[i + 1] = loopOffsets[i] + chunks[i].loopVerts.size();
+    }
+    size_t numVerts = chunks.back().firstVert + chunks.back().numVerts;
+    size_t numFaces = faceOffsets.back(), numLoops = loopOffsets.back();
+    if (numLoops >= NO_EDGE / 2)
+        throw winged_error(L"OBJ file is too large");
+    FileContents contents;
+    contents.paints = {Paint{}, Paint{Paint::HOLE_MATERIAL}};
+    contents.facePaints.assign(numFaces, 0);
+    contents.loopStarts.resize(numFaces + 1);
+    contents.loopStarts[numFaces] = uint32_t(numLoops);
+    contents.loopVerts.resize(numLoops);
+    contents.positions.resize(numVerts);
+    std::vector<uint32_t> faceLines(numFaces);
+    parallelFor(numChunks, 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            auto &chunk = chunks[i];
+            std::copy(chunk.positions.begin(), chunk.positions.end(),
+                contents.positions.begin() + chunk.firstVert);
+            std::copy(chunk.faceLines.begin(), chunk.faceLines.end(),
+                faceLines.begin() + ptrdiff_t(faceOffsets[i]));
+            auto loop = loopOffsets[i];
+            for (size_t f = 0; f < chunk.faceSizes.size(); f++) {
+                contents.loopStarts[faceOffsets[i] + f] = uint32_t(loop);
+                for (uint32_t l = 0; l < chunk.faceSizes[f]; l++, loop++) {
+                    auto v = chunk.loopVerts[loop - loopOffsets[i]];
+                    if ((v < 0 || v >= int64_t(numVerts)) && !chunk.error) {
+                        chunk.error = L"Face on line %u refers to a vertex which doesn't exist";
+                        chunk.errorLine = chunk.faceLines[f];
+                    }
+                    contents.loopVerts[loop] = uint32_t(v);
+                }
+            }
+            // free memory
+            chunk.positions = {};
+            chunk.loopVerts = {};
+        }
+    });
+    throwObjChunkError(chunks);
+    stage(2);
+
+    // weld, and drop unused vertices
+    std::vector<uint32_t> remap(numVerts, NO_VERT);
+    std::vector<glm::vec3> positions;
+    std::unordered_map<glm::vec3, uint32_t, ObjVecHash> posIndices;
+    posIndices.reserve(numVerts);
+    for (auto &v : contents.loopVerts) {
+        if (remap[v] == NO_VERT) {
+            auto inserted = posIndices.insert({contents.positions[v], uint32_t(positions.size())});
+            if (inserted.second)
+                positions.push_back(contents.positions[v]);
+            remap[v] = inserted.first->second;
+        }
+        v = remap[v];
+    }
+    contents.positions = std::move(positions);
+    numVerts = contents.positions.size();
+    stage(3);
+
+    std::vector<char> badFaces(numFaces);
+    parallelFor(numFaces, MIN_PARALLEL_BATCH / 4, [&](size_t begin, size_t end) {
+        for (size_t f = begin; f < end; f++) {
+            auto start = contents.loopStarts[f], count = contents.loopStarts[f + 1] - start;
+            badFaces[f] = count < 3 || hasRepeatedVert(&contents.loopVerts[start], count);
+        }
+    });
+    auto numBad = uint32_t(std::count(badFaces.begin(), badFaces.end(), 1));
+    if (numBad) {
+        auto first = size_t(std::find(badFaces.begin(), badFaces.end(), 1) - badFaces.begin());
+        throw objError(L"Face on line %u has fewer than 3 vertices, or uses the same vertex twice "
+            "(total: %u)", faceLines[first], numBad);
+    }
+
+    auto next = loopNext(contents);
+    auto twins = matchTwins(contents, next);
+    std::vector<uint32_t> boundary;
+    for (uint32_t i = 0; i < numLoops; i++)
+        if (twins[i] == NO_EDGE)
+            boundary.push_back(i);
+    // unmatched edges which share a pair of vertices are shared by too many faces, or by faces
+    // facing opposite directions
+    std::unordered_map<uint64_t, uint32_t> boundaryPairs;
+    numBad = 0;
+    size_t firstBad = 0;
+    for (auto i : boundary) {
+        uint64_t a = contents.loopVerts[i], b = contents.loopVerts[next[i]];
+        auto count = ++boundaryPairs[a < b ? (a << 32 | b) : (b << 32 | a)];
+        if (count == 2 && !numBad++)
+            firstBad = i;
+    }
+    if (numBad)
+        throw objError(L"Edge of face on line %u is shared by more than two faces, or by faces "
+            "facing opposite ways (total: %u)",
+            faceLines[faceOfLoop(contents, firstBad)], numBad);
+
+    // close each boundary loop with a hole face. Its edges are the twins of the boundary edges in
+    // reverse order, so each follows the hole edge which starts where it ends.
+    std::unordered_map<uint32_t, uint32_t> holeStarts; // vertex -> boundary edge ending there
+    for (auto i : boundary) {
+        if (!holeStarts.insert({contents.loopVerts[next[i]], i}).second)
+            throw objError(L"Vertex on line %u joins surfaces at a single point",
+                faceLines[faceOfLoop(contents, i)]);
+    }
+    for (auto i : boundary) {
+        if (twins[i] != NO_EDGE)
+            continue;
+        auto e = i;
+        do {
+            auto hole = uint32_t(contents.loopVerts.size());
+            contents.loopVerts.push_back(contents.loopVerts[next[e]]);
+            twins.push_back(e);
+            twins[e] = hole;
+            auto nextHole = holeStarts.find(contents.loopVerts[e]);
+            if (nextHole == holeStarts.end())
+                throw objError(L"Vertex on line %u joins surfaces at a single point",
+                    faceLines[faceOfLoop(contents, e)]);
+            e = nextHole->second;
+        } while (twins[e] == NO_EDGE);
+        if (e != i)
+            throw objError(L"Vertex on line %u joins surfaces at a single point",
+                faceLines[faceOfLoop(contents, e)]);
+        contents.facePaints.push_back(1);
+        contents.loopStarts.push_back(uint32_t(contents.loopVerts.size()));
+    }
+    next = loopNext(contents);
+    stage(4);
+
+    // the faces around each vertex must form a single fan
+    auto numEdges = contents.loopVerts.size();
+    std::vector<uint32_t> prev(numEdges), outDegree(numVerts), vertEdges(numVerts);
+    for (uint32_t i = 0; i < numEdges; i++) {
+        prev[next[i]] = i;
+        auto v = contents.loopVerts[i];
+        outDegree[v]++;
+        if (i < numLoops)
+            vertEdges[v] = i; // on a face from the file, for reporting
+    }
+    std::vector<char> badVerts(numVerts);
+    parallelFor(numVerts, MIN_PARALLEL_BATCH, [&](size_t begin, size_t end) {
+        for (size_t v = begin; v < end; v++) {
+            uint32_t count = 0;
+            auto e = vertEdges[v];
+            do {
+                e = twins[prev[e]];
+                count++;
+            } while (e != vertEdges[v] && count <= outDegree[v]);
+            badVerts[v] = count != outDegree[v];
+        }
+    });
+    numBad = uint32_t(std::count(badVerts.begin(), badVerts.end(), 1));
+    if (numBad) {
+        auto first = size_t(std::find(badVerts.begin(), badVerts.end(), 1) - badVerts.begin());
+        throw objError(L"Vertex on line %u joins surfaces at a single point "
+            "(total: %u)", faceLines[faceOfLoop(contents, vertEdges[first])], numBad);
+    }
+    stage(5);
+
+    return buildState(contents, next, twins).surf;
+}
+
+const uint32_t GLB_MAGIC = 0x46546C67, GLB_VERSION = 2; // "glTF"
+const uint32_t GLB_CHUNK_JSON = 0x4E4F534A, GLB_CHUNK_BIN = 0x004E4942; // "JSON", "BIN\0"
+// OpenGL enum values used by glTF
+const int GLTF_ARRAY_BUFFER = 34962, GLTF_ELEMENT_ARRAY_BUFFER = 34963;
+const int GLTF_UNSIGNED_SHORT = 5123, GLTF_UNSIGNED_INT = 5125, GLTF_FLOAT = 5126;
+
+struct GlbVertex {
+    glm::vec3 pos, normal;
+    glm::vec2 texCoord;
+
+    bool operator==(const GlbVertex &other) const {
+        return pos == other.pos && normal == other.normal && texCoord == other.texCoord;
+    }
+};
+static_assert(sizeof(GlbVertex) == 32, "GlbVertex is the interleaved vertex layout");
+
+struct GlbVertexHash {
+    size_t operator()(const GlbVertex &v) const {
+        ObjVecHash hash;
+        return hash(v.pos) ^ (hash(v.normal) * 31) ^ (hash(v.texCoord) * 961);
+    }
+};
+
+// Triangles of all faces with one material
+struct GlbPrimitive {
+    id_t material;
+    const std::vector<Face> *faces;
+    std::vector<GlbVertex> vertices;
+    std::vector<uint32_t> indices;
+    glm::vec3 min, max;
+};
+
+static void buildGlbPrimitive(GlbPrimitive *prim, const Surface &surf, FaceTesselator *tess) {
+    std::unordered_map<GlbVertex, uint32_t, GlbVertexHash> vertIndices;
+    std::vector<uint32_t> loopIndices;
+    std::vector<index_t> tris;
+    for (const auto &face : *prim->faces) {
+        auto normal = faceNormal(surf, face);
+        glm::mat4x2 texMat = faceTexMat(face.paint, normal);
+        loopIndices.clear();
+        for (auto edge : FaceEdges(surf, face)) {
+            GlbVertex vert = {edge.second.vert.in(surf).pos, normal, {}};
+            vert.texCoord = texMat * glm::vec4(vert.pos, 1);
+            vert.texCoord.y = 1 - vert.texCoord.y; // glTF images are top-down
+            auto inserted = vertIndices.insert({vert, uint32_t(prim->vertices.size())});
+            if (inserted.second)
+                prim->vertices.push_back(vert);
+            loopIndices.push_back(inserted.first->second);
+        }
+        tris.clear();
+        tess->tesselate(tris, surf, face, normal);
+        for (auto i : tris)
+            prim->indices.push_back(loopIndices[i]);
+    }
+    // faces come in map order, which is effectively random
+    optimizeVertexCache(prim->indices.data(), prim->indices.size(), prim->vertices.size());
+    auto order = optimizeVertexFetch(prim->indices.data(), prim->indices.size(),
+        prim->vertices.size());
+    std::vector<GlbVertex> ordered;
+    ordered.reserve(order.size());
+    for (auto i : order)
+        ordered.push_back(prim->vertices[i]);
+    prim->vertices = std::move(ordered);
+    prim->min = prim->max = prim->vertices.empty() ? glm::vec3{} : prim->vertices[0].pos;
+    for (const auto &vert : prim->vertices) {
+        prim->min = glm::min(prim->min, vert.pos);
+        prim->max = glm::max(prim->max, vert.pos);
+    }
+}
+
+static void appendJsonString(std::string *json, const std::string &str) {
+    *json += '"';
+    for (char c : str) {
+        if (c == '"' || c == '\\') {
+            *json += '\\';
+            *json += c;
+        } else if (uint8_t(c) < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            *json += buf;
+        } else {
+            *json += c;
+        }
+    }
+    *json += '"';
+}
+
+static void appendJsonVec3(std::string *json, glm::vec3 v) {
+    char buf[FLOAT_TEXT_SIZE];
+    *json += '[';
+    for (int c = 0; c < 3; c++) {
+        if (c)
+            *json += ',';
+        json->append(buf, formatShortest(buf, v[c]));
+    }
+    *json += ']';
+}
+
+// Path as a URI reference. Colons are kept for drive letters in absolute paths, and relative
+// Windows paths can't contain one, so it can't be mistaken for a URI scheme.
+static std::string uriPath(const std::wstring &path) {
+    std::string uri;
+    for (char c : narrow(path)) {
+        if (c == '\\') {
+            uri += '/';
+        } else if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+                || strchr("-._~/:", c)) {
+            uri += c;
+        } else {
+            char buf[4];
+            snprintf(buf, sizeof(buf), "%%%02X", uint8_t(c));
+            uri += buf;
+        }
+    }
+    return uri;
+}
+
+// glTF viewers only have to support PNG and JPEG
+static bool isGltfImage(const std::string &path) {
+    auto ext = PathFindExtensionA(path.c_str());
+    return !lstrcmpiA(ext, ".png") || !lstrcmpiA(ext, ".jpg") || !lstrcmpiA(ext, ".jpeg");
+}
+
+// One mesh with a primitive for each material. Each primitive has its own interleaved vertex
+// buffer view, deduplicated, followed by its index buffer view, 16-bit if possible. Triangles and
+// vertices are ordered for the vertex cache. Progress is reported in faces as primitives are built.
+void writeGlb(const std::string &file, const Surface &surf, const Library &library,
+        const ProgressFn &progress) {
+    auto wfile = widen(file);
+    std::unordered_map<id_t, std::vector<Face>> matFaces;
+    for (const auto &pair : surf.faces) {
+        if (pair.second.paint->material != Paint::HOLE_MATERIAL)
+            matFaces[pair.second.paint->material].push_back(pair.second);
+    }
+    std::vector<GlbPrimitive> prims;
+    for (const auto &pair : matFaces)
+        prims.push_back({pair.first, &pair.second, {}, {}, {}, {}});
+    // a window at a time, so progress is reported between windows
+    size_t window = numWorkers(), totalFaces = 0, facesDone = 0;
+    for (const auto &prim : prims)
+        totalFaces += prim.faces->size();
+    for (size_t w = 0; w < prims.size(); w += window) {
+        size_t count = std::min(window, prims.size() - w);
+        parallelFor(count, 1, [&](size_t begin, size_t end) {
+            FaceTesselator tess;
+            for (size_t i = w + begin; i < w + end; i++)
+                buildGlbPrimitive(&prims[i], surf, &tess);
+        });
+        for (size_t i = w; i < w + count; i++)
+            facesDone += prims[i].faces->size();
+        if (progress)
+            progress(facesDone, totalFaces);
+    }
+    prims.erase(std::remove_if(prims.begin(), prims.end(),
+        [](const GlbPrimitive &prim) { return prim.indices.empty(); }), prims.end());
+
+    wchar_t folder[MAX_PATH];
+    lstrcpy(folder, wfile.c_str());
+    PathRemoveFileSpec(folder);
+    std::string materials, textures, images, meshPrims, bufferViews, accessors;
+    uint64_t binSize = 0; // 64-bit so the size check below can't wrap
+    size_t numTextures = 0;
+    for (size_t i = 0; i < prims.size(); i++) {
+        const auto &prim = prims[i];
+        auto sep = i ? "," : "";
+        std::string name = "default";
+        int texture = -1;
+        auto path = tryGet(library.idPaths, prim.material);
+        if (path)
+            name = PathFindFileNameA(path->c_str());
+        if (path && isGltfImage(*path)) {
+            auto wpath = widen(*path);
+            wchar_t relative[MAX_PATH] = L"";
+            images += numTextures ? ",{\"uri\":\"" : "{\"uri\":\"";
+            if (PathRelativePathTo(relative, folder, FILE_ATTRIBUTE_DIRECTORY, wpath.c_str(), 0)) {
+                images += uriPath(relative[0] == '.' && relative[1] == '\\'
+                    ? relative + 2 : relative);
+            } else { // on another drive
+                images += wpath[0] == '\\' && wpath[1] == '\\' ? "file:" : "file:///";
+                images += uriPath(wpath);
+            }
+            images += "\"}";
+            textures += std::string(numTextures ? "," : "") + "{\"source\":"
+                + std::to_string(numTextures) + "}";
+            texture = int(numTextures++);
+        }
+        materials += sep;
+        materials += "{\"name\":";
+        appendJsonString(&materials, name);
+        materials += ",\"pbrMetallicRoughness\":{\"metallicFactor\":0";
+        if (texture >= 0)
+            materials += ",\"baseColorTexture\":{\"index\":" + std::to_string(texture) + "}";
+        materials += "}}";
+
+        auto view = std::to_string(i * 2), acc = std::to_string(i * 4);
+        auto numVerts = std::to_string(prim.vertices.size());
+        bool shortIndices = prim.vertices.size() <= 0xFFFF; // 0xFFFF itself is reserved
+        auto vertBytes = prim.vertices.size() * sizeof(GlbVertex);
+        auto indexBytes = prim.indices.size() * (shortIndices ? 2 : 4);
+        bufferViews += std::string(sep)
+            + "{\"buffer\":0,\"byteOffset\":" + std::to_string(binSize)
+            + ",\"byteLength\":" + std::to_string(vertBytes)
+            + ",\"byteStride\":32,\"target\":" + std::to_string(GLTF_ARRAY_BUFFER) + "}"
+            + ",{\"buffer\":0,\"byteOffset\":" + std::to_string(binSize + vertBytes)
+            + ",\"byteLength\":" + std::to_string(indexBytes)
+            + ",\"target\":" + std::to_string(GLTF_ELEMENT_ARRAY_BUFFER) + "}";
+        binSize += uint64_t(vertBytes) + (indexBytes + 3) / 4 * 4;
+
+        auto vertAccessor = [&](int offset, const char *type) {
+            return "{\"bufferView\":" + view + ",\"byteOffset\":" + std::to_string(offset)
+                + ",\"componentType\":" + std::to_string(GLTF_FLOAT) + ",\"count\":" + numVerts
+                + ",\"type\":\"" + type + "\"";
+        };
+        accessors += sep + vertAccessor(0, "VEC3") + ",\"min\":";
+        appendJsonVec3(&accessors, prim.min);
+        accessors += ",\"max\":";
+        appendJsonVec3(&accessors, prim.max);
+        accessors += "}," + vertAccessor(12, "VEC3") + "}," + vertAccessor(24, "VEC2") + "}";
+        accessors += ",{\"bufferView\":" + std::to_string(i * 2 + 1) + ",\"componentType\":"
+            + std::to_string(shortIndices ? GLTF_UNSIGNED_SHORT : GLTF_UNSIGNED_INT)
+            + ",\"count\":" + std::to_string(prim.indices.size()) + ",\"type\":\"SCALAR\"}";
+
+        meshPrims += std::string(sep) + "{\"attributes\":{\"POSITION\":" + acc
+            + ",\"NORMAL\":" + std::to_string(i * 4 + 1)
+            + ",\"TEXCOORD_0\":" + std::to_string(i * 4 + 2) + "},\"indices\":"
+            + std::to_string(i * 4 + 3) + ",\"material\":" + std::to_string(i) + "}";
+    }
+
+    std::string json = "{\"asset\":{\"version\":\"2.0\",\"generator\":\"WingEd\"},\"scene\":0";
+    if (prims.empty()) {
+        json += ",\"scenes\":[{}]}"; // meshes and buffers can't be empty
+    } else {
+        json += ",\"scenes\":[{\"nodes\":[0]}],\"nodes\":[{\"mesh\":0}]";
+        json += ",\"meshes\":[{\"primitives\":[" + meshPrims + "]}]";
+        json += ",\"materials\":[" + materials + "]";
+        if (numTextures)
+            json += ",\"textures\":[" + textures + "],\"images\":[" + images + "]";
+        json += ",\"buffers\":[{\"byteLength\":" + std::to_string(binSize) + "}]";
+        json += ",\"bufferViews\":[" + bufferViews + "]";
+        json += ",\"accessors\":[" + accessors + "]}";
+    }
+    json.resize((json.size() + 3) / 4 * 4, ' ');
+
+    CHandle handle(CreateFile(wfile.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL, NULL));
+    if (handle == INVALID_HANDLE_VALUE)
+        throw winged_error(L"Error saving GLB file");
+    OutStream out(handle, 1 << 20);
+    uint64_t totalSize = 12 + 8 + uint64_t(json.size()) + (prims.empty() ? 0 : 8 + binSize);
+    if (totalSize > UINT32_MAX)
+        throw winged_error(L"Model is too large for GLB");
+    out.put(GLB_MAGIC);
+    out.put(GLB_VERSION);
+    out.put(uint32_t(totalSize));
+    out.put(uint32_t(json.size()));
+    out.put(GLB_CHUNK_JSON);
+    out.write(json.data(), json.size());
+    if (!prims.empty()) {
+        out.put(uint32_t(binSize));
+        out.put(GLB_CHUNK_BIN);
+        for (const auto &prim : prims) {
+            out.write(prim.vertices.data(), prim.vertices.size() * sizeof(GlbVertex));
+            size_t indexBytes;
+            if (prim.vertices.size() <= 0xFFFF) {
+                std::vector<uint16_t> shortIndices;
+                shortIndices.reserve(prim.indices.size());
+                for (auto index : prim.indices)
+                    shortIndices.push_back(uint16_t(index));
+                indexBytes = shortIndices.size() * 2;
+                out.write(shortIndices.data(), indexBytes);
+            } else {
+                indexBytes = prim.indices.size() * 4;
+                out.write(prim.indices.data(), indexBytes);
             }
+            const uint32_t zero = 0;
+            out.write(&zero, (4 - indexBytes % 4) % 4);
         }
     }
+    out.flush();
 }
 
 } // namespace
+
+#ifdef ENTRY_BENCH_SAVE
+#include <cstdio>
+#include <glm/gtc/constants.hpp>
+#include "ops.h"
+using namespace winged;
+
+// Save and load time against element count, using a grid of separate octagons. Append is an
+// incremental save after moving one vertex. obj rt writes round-trip numbers.
+int main() {
+    seedIds(1);
+    wchar_t dir[MAX_PATH];
+    GetTempPath(_countof(dir), dir);
+    auto wingPath = narrow(std::wstring(dir) + L"winged_bench.wing");
+    auto objPath = narrow(std::wstring(dir) + L"winged_bench.obj");
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+
+    wprintf(L"%10s %10s %10s %12s %12s %12s %12s %12s\n", L"faces", L"verts", L"edges",
+        L"wing (ms)", L"obj (ms)", L"obj rt (ms)", L"load (ms)", L"append (ms)");
+    for (int count = 1000; count <= 100000; count *= 10) {
+        EditorState state;
+        for (int i = 0; i < count; i++) {
+            std::vector<glm::vec3> points;
+            for (int p = 0; p < 8; p++) {
+                auto angle = float(p) * glm::two_pi<float>() / 8;
+                points.push_back({float(i % 256) * 3 + glm::cos(angle),
+                    float(i / 256) * 3 + glm::sin(angle), 0});
+            }
+            state.surf = get<0>(makePolygonPlane(std::move(state.surf), points));
+        }
+
+        LARGE_INTEGER t0, t1, t2, t3, tObj;
+        QueryPerformanceCounter(&t0);
+        writeFile(wingPath, state, {}, {});
+        QueryPerformanceCounter(&t1);
+        writeObj(objPath, state.surf, {}, "", false);
+        QueryPerformanceCounter(&tObj);
+        writeObj(objPath, state.surf, {}, "", false, true);
+        QueryPerformanceCounter(&t2);
+        readFile(wingPath, "");
+        QueryPerformanceCounter(&t3);
+
+        SavedFile saved;
+        saveFile(wingPath, state, {}, {}, false, true, &saved);
+        auto vert = *state.surf.verts.begin();
+        vert.second.pos.z += 1;
+        state.surf.verts = std::move(state.surf.verts).set(vert.first, vert.second);
+        LARGE_INTEGER t4, t5;
+        QueryPerformanceCounter(&t4);
+        saveFile(wingPath, state, {}, {}, false, true, &saved);
+        QueryPerformanceCounter(&t5);
+
+        auto ms = [&](LARGE_INTEGER a, LARGE_INTEGER b) {
+            return double(b.QuadPart - a.QuadPart) * 1000 / double(freq.QuadPart);
+        };
+        wprintf(L"%10d %10d %10d %12.1f %12.1f %12.1f %12.1f %12.1f\n",
+            int(state.surf.faces.size()), int(state.surf.verts.size()),
+            int(state.surf.edges.size()), ms(t0, t1), ms(t1, tObj), ms(tObj, t2), ms(t2, t3),
+            ms(t4, t5));
+    }
+    DeleteFileA(wingPath.c_str());
+    DeleteFileA(objPath.c_str());
+}
+#endif // ENTRY_BENCH_SAVE
+
+#ifdef ENTRY_BENCH_COMPRESS
+#include <cstdio>
+#include <glm/gtc/constants.hpp>
+#include "ops.h"
+using namespace winged;
+
+static uint64_t fileSize(const std::string &path) {
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+    if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &attr))
+        return 0;
+    return (uint64_t(attr.nFileSizeHigh) << 32) | attr.nFileSizeLow;
+}
+
+// Size and load time of compressed vs uncompressed files, for octagon grids with arbitrary
+// positions and with positions snapped to a 1/8 grid
+int main() {
+    seedIds(1);
+    wchar_t dir[MAX_PATH];
+    GetTempPath(_countof(dir), dir);
+    auto rawPath = narrow(std::wstring(dir) + L"winged_bench_raw.wing");
+    auto lzPath = narrow(std::wstring(dir) + L"winged_bench_lz.wing");
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    auto ms = [&](LARGE_INTEGER a, LARGE_INTEGER b) {
+        return double(b.QuadPart - a.QuadPart) * 1000 / double(freq.QuadPart);
+    };
+
+    wprintf(L"%10s %8s %12s %12s %8s %12s %12s %12s\n", L"faces", L"snapped", L"raw (KB)",
+        L"lz (KB)", L"ratio", L"save lz (ms)", L"load raw", L"load lz");
+    for (int count = 10000; count <= 100000; count *= 10) {
+        for (int snapped = 0; snapped < 2; snapped++) {
+            EditorState state;
+            for (int i = 0; i < count; i++) {
+                std::vector<glm::vec3> points;
+                for (int p = 0; p < 8; p++) {
+                    auto angle = float(p) * glm::two_pi<float>() / 8;
+                    glm::vec3 point = {float(i % 256) * 3 + glm::cos(angle),
+                        float(i / 256) * 3 + glm::sin(angle), 0};
+                    if (snapped)
+                        point = glm::round(point * 8.0f) / 8.0f;
+                    points.push_back(point);
+                }
+                state.surf = get<0>(makePolygonPlane(std::move(state.surf), points));
+            }
+
+            LARGE_INTEGER t0, t1, t2, t3;
+            writeFile(rawPath, state, {}, {}, false);
+            QueryPerformanceCounter(&t0);
+            writeFile(lzPath, state, {}, {}, true);
+            QueryPerformanceCounter(&t1);
+            readFile(rawPath, "");
+            QueryPerformanceCounter(&t2);
+            readFile(lzPath, "");
+            QueryPerformanceCounter(&t3);
+            auto rawSize = fileSize(rawPath), lzSize = fileSize(lzPath);
+            wprintf(L"%10d %8s %12.1f %12.1f %8.2f %12.1f %12.1f %12.1f\n",
+                count, snapped ? L"yes" : L"no", double(rawSize) / 1024, double(lzSize) / 1024,
+                double(rawSize) / double(lzSize), ms(t0, t1), ms(t1, t2), ms(t2, t3));
+        }
+    }
+    DeleteFileA(rawPath.c_str());
+    DeleteFileA(lzPath.c_str());
+}
+#endif // ENTRY_BENCH_COMPRESS
+
+#ifdef ENTRY_TEST_NONMANIFOLD
+#include <cstdio>
+using namespace winged;
+
+static int g_failures = 0;
+
+static void expectError(const wchar_t *what, const wchar_t *expected,
+        const std::function<void()> &fn) {
+    const wchar_t *message = nullptr;
+    try {
+        fn();
+    } catch (winged_error const &err) {
+        message = err.message ? err.message : L"";
+    }
+    if (!message || wcsncmp(message, expected, wcslen(expected)) != 0) {
+        wprintf(L"FAIL: %s: %s\n", what, message ? message : L"no error");
+        g_failures++;
+    }
+}
+
+// Three triangles sharing the edge between the first two vertices, which can't be represented
+// with half-edges. Both OBJ import and .wing loading should reject it with a specific message.
+int main() {
+    const glm::vec3 positions[] = {{0, 0, 0}, {1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}};
+    const uint32_t loops[][3] = {{0, 1, 2}, {1, 0, 3}, {0, 1, 4}};
+
+    wchar_t dir[MAX_PATH];
+    GetTempPath(_countof(dir), dir);
+    auto objPath = std::wstring(dir) + L"winged_nonmanifold.obj";
+    std::string obj;
+    for (auto pos : positions)
+        obj += "v " + std::to_string(pos.x) + " " + std::to_string(pos.y) + " "
+            + std::to_string(pos.z) + "\n";
+    for (auto loop : loops)
+        obj += "f " + std::to_string(loop[0] + 1) + " " + std::to_string(loop[1] + 1) + " "
+            + std::to_string(loop[2] + 1) + "\n";
+    {
+        CHandle handle(CreateFile(objPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+            FILE_ATTRIBUTE_NORMAL, NULL));
+        OutStream out(handle);
+        out.write(obj.data(), obj.size());
+        out.flush();
+    }
+    expectError(L"OBJ import", L"Edge of face on line", [&]() { readObj(narrow(objPath)); });
+    DeleteFile(objPath.c_str());
+
+    FileContents contents;
+    contents.paints.push_back(Paint{});
+    contents.positions.assign(std::begin(positions), std::end(positions));
+    for (auto loop : loops) {
+        contents.loopStarts.push_back(uint32_t(contents.loopVerts.size()));
+        contents.facePaints.push_back(0);
+        contents.loopVerts.insert(contents.loopVerts.end(), loop, loop + 3);
+    }
+    contents.loopStarts.push_back(uint32_t(contents.loopVerts.size()));
+    expectError(L".wing load", L"File has an edge which is shared", [&]() {
+        checkLoops(contents);
+        checkTwins(matchTwins(contents, loopNext(contents)));
+    });
+
+    wprintf(g_failures ? L"%d checks failed\n" : L"All checks passed\n", g_failures);
+    return g_failures ? 1 : 0;
+}
+#endif // ENTRY_TEST_NONMANIFOLD
+
+#ifdef ENTRY_TEST_GLB
+#include <cstdio>
+#include <cstdlib>
+#include <glm/geometric.hpp>
+#include <glm/gtc/constants.hpp>
+#include "ops.h"
+using namespace winged;
+
+// Just enough JSON to read back the exported file
+struct Json {
+    enum {NUL, NUM, STR, ARR, OBJ} type = NUL;
+    double num = 0;
+    std::string str;
+    std::vector<std::string> keys;
+    std::vector<Json> items;
+
+    const Json & operator[](const char *key) const;
+    const Json & operator[](size_t i) const { return items.at(i); }
+    size_t size() const { return items.size(); }
+    size_t uint() const { return size_t(num); }
+};
+const Json NULL_JSON {};
+
+const Json & Json::operator[](const char *key) const {
+    for (size_t i = 0; i < keys.size(); i++)
+        if (keys[i] == key)
+            return items[i];
+    return NULL_JSON;
+}
+
+static Json parseJson(const char *&p) {
+    while (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')
+        p++;
+    Json value;
+    if (*p == '{' || *p == '[') {
+        bool isObj = *p++ == '{';
+        value.type = isObj ? Json::OBJ : Json::ARR;
+        while (true) {
+            while (*p == ' ')
+                p++;
+            if (*p == '}' || *p == ']') {
+                p++;
+                break;
+            }
+            if (*p == ',')
+                p++;
+            if (isObj) {
+                value.keys.push_back(parseJson(p).str);
+                while (*p == ' ' || *p == ':')
+                    p++;
+            }
+            value.items.push_back(parseJson(p));
+        }
+    } else if (*p == '"') {
+        value.type = Json::STR;
+        for (p++; *p != '"'; p++) {
+            if (*p == '\\')
+                p++;
+            value.str += *p;
+        }
+        p++;
+    } else if (*p == '-' || (*p >= '0' && *p <= '9')) {
+        value.type = Json::NUM;
+        char *end;
+        value.num = strtod(p, &end);
+        p = end;
+    } else {
+        while (*p >= 'a' && *p <= 'z')
+            p++; // true/false/null
+    }
+    return value;
+}
+
+static int g_failures = 0;
+
+static void check(bool cond, const wchar_t *message) {
+    if (!cond) {
+        wprintf(L"FAIL: %s\n", message);
+        g_failures++;
+    }
+}
+
+static float triangleArea(glm::vec3 a, glm::vec3 b, glm::vec3 c) {
+    return glm::length(glm::cross(b - a, c - a)) / 2;
+}
+
+static void checkGlb(const std::string &glbPath, size_t numFaces, double surfArea) {
+    CHandle handle(CreateFileA(glbPath.c_str(), GENERIC_READ, 0, NULL, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, NULL));
+    InStream in(handle);
+    auto fileSize = in.remaining();
+    check(in.get<uint32_t>() == GLB_MAGIC, L"magic");
+    check(in.get<uint32_t>() == GLB_VERSION, L"version");
+    check(in.get<uint32_t>() == fileSize, L"file length");
+    auto jsonSize = in.get<uint32_t>();
+    check(jsonSize % 4 == 0 && in.get<uint32_t>() == GLB_CHUNK_JSON, L"JSON chunk header");
+    std::string jsonText(in.view(jsonSize), jsonSize);
+    const char *jsonPtr = jsonText.c_str();
+    auto json = parseJson(jsonPtr);
+    auto binSize = in.get<uint32_t>();
+    check(in.get<uint32_t>() == GLB_CHUNK_BIN, L"BIN chunk header");
+    check(binSize == in.remaining() && binSize == json["buffers"][0]["byteLength"].uint(),
+        L"BIN chunk length");
+    const char *bin = in.view(binSize);
+
+    check(json["asset"]["version"].str == "2.0", L"asset version");
+    check(json["images"].size() == 1 && json["images"][0]["uri"].str == "brick%20tex.png",
+        L"texture URI");
+    const auto &prims = json["meshes"][0]["primitives"];
+    check(prims.size() == 3, L"one primitive per material");
+    size_t numTextured = 0;
+    for (size_t m = 0; m < json["materials"].size(); m++) {
+        const auto &pbr = json["materials"][m]["pbrMetallicRoughness"];
+        if (pbr["baseColorTexture"].type != Json::NUL)
+            numTextured++;
+    }
+    check(numTextured == 1, L"BMP texture left out");
+    double glbArea = 0;
+    size_t numTris = 0;
+    bool sawShort = false, sawInt = false;
+    for (size_t p = 0; p < prims.size(); p++) {
+        const auto &attrs = prims[p]["attributes"];
+        const auto &posAcc = json["accessors"][attrs["POSITION"].uint()];
+        const auto &normAcc = json["accessors"][attrs["NORMAL"].uint()];
+        const auto &uvAcc = json["accessors"][attrs["TEXCOORD_0"].uint()];
+        const auto &idxAcc = json["accessors"][prims[p]["indices"].uint()];
+        const auto &vertView = json["bufferViews"][posAcc["bufferView"].uint()];
+        const auto &idxView = json["bufferViews"][idxAcc["bufferView"].uint()];
+        auto numVerts = posAcc["count"].uint(), numIndices = idxAcc["count"].uint();
+        check(vertView["byteStride"].uint() == sizeof(GlbVertex)
+            && vertView["byteLength"].uint() == numVerts * sizeof(GlbVertex)
+            && vertView["byteOffset"].uint() + vertView["byteLength"].uint() <= binSize,
+            L"vertex buffer view");
+        check(normAcc["bufferView"].uint() == posAcc["bufferView"].uint()
+            && normAcc["byteOffset"].uint() == 12, L"interleaved normals");
+        check(uvAcc["bufferView"].uint() == posAcc["bufferView"].uint()
+            && uvAcc["byteOffset"].uint() == 24 && uvAcc["type"].str == "VEC2",
+            L"interleaved texture coordinates");
+        const auto &material = json["materials"][prims[p]["material"].uint()];
+        bool textured = material["pbrMetallicRoughness"]["baseColorTexture"].type != Json::NUL;
+        bool isShort = idxAcc["componentType"].uint() == GLTF_UNSIGNED_SHORT;
+        (isShort ? sawShort : sawInt) = true;
+        check(isShort == (numVerts <= 0xFFFF), L"index size");
+        check(numIndices % 3 == 0 && idxView["byteOffset"].uint() % 4 == 0
+            && idxView["byteOffset"].uint() + numIndices * (isShort ? 2 : 4) <= binSize,
+            L"index buffer view");
+
+        std::vector<GlbVertex> verts(numVerts);
+        memcpy(verts.data(), bin + vertView["byteOffset"].uint(), numVerts * sizeof(GlbVertex));
+        glm::vec3 min = verts[0].pos, max = verts[0].pos;
+        for (const auto &vert : verts) {
+            min = glm::min(min, vert.pos);
+            max = glm::max(max, vert.pos);
+            check(glm::abs(glm::length(vert.normal) - 1) < 1e-4f, L"unit normals");
+            // textured faces map x and y to u and v, and v is flipped for top-down images
+            if (textured) {
+                check(glm::abs(vert.texCoord.x - vert.pos.x) < 1e-4f
+                    && glm::abs(vert.texCoord.y - (1 - vert.pos.y)) < 1e-4f,
+                    L"texture coordinates");
+            }
+        }
+        for (int c = 0; c < 3; c++) {
+            check(float(posAcc["min"][size_t(c)].num) == min[c]
+                && float(posAcc["max"][size_t(c)].num) == max[c], L"position bounds");
+        }
+
+        auto idxData = bin + idxView["byteOffset"].uint();
+        auto index = [&](size_t i) {
+            if (isShort) {
+                uint16_t val;
+                memcpy(&val, idxData + i * 2, 2);
+                return uint32_t(val);
+            }
+            uint32_t val;
+            memcpy(&val, idxData + i * 4, 4);
+            return val;
+        };
+        for (size_t i = 0; i + 2 < numIndices; i += 3) {
+            auto a = index(i), b = index(i + 1), c = index(i + 2);
+            if (a >= numVerts || b >= numVerts || c >= numVerts) {
+                check(false, L"index in range");
+                break;
+            }
+            glbArea += triangleArea(verts[a].pos, verts[b].pos, verts[c].pos);
+            // counter-clockwise when seen from the front
+            auto cross = glm::cross(verts[b].pos - verts[a].pos, verts[c].pos - verts[a].pos);
+            check(glm::dot(cross, verts[a].normal) > 0, L"triangle winding");
+            numTris++;
+        }
+    }
+    check(sawShort && sawInt, L"both index sizes");
+    check(numTris == numFaces * 6, L"triangle count");
+    check(std::abs(glbArea - surfArea) <= surfArea * 1e-4, L"surface area");
+}
+
+// Export a model with small textured primitives (16-bit indices) and a large untextured one
+// (32-bit indices), then read the file back and check its structure and geometry against the model.
+// One texture is a BMP, which glTF doesn't support.
+int main() {
+    seedIds(1);
+    wchar_t dir[MAX_PATH];
+    GetTempPath(_countof(dir), dir);
+    auto glbPath = narrow(std::wstring(dir) + L"winged_test.glb");
+    auto texPath = narrow(std::wstring(dir) + L"brick tex.png");
+    auto bmpPath = narrow(std::wstring(dir) + L"brick.bmp");
+
+    EditorState state;
+    for (int i = 0; i < 12000; i++) {
+        std::vector<glm::vec3> points;
+        for (int p = 0; p < 8; p++) {
+            auto angle = float(p) * glm::two_pi<float>() / 8;
+            points.push_back({float(i % 128) * 3 + glm::cos(angle),
+                float(i / 128) * 3 + glm::sin(angle), float(i % 7)});
+        }
+        state.surf = get<0>(makePolygonPlane(std::move(state.surf), points));
+    }
+    Library library;
+    auto texId = genId();
+    library.addFile(texId, texPath);
+    auto bmpId = genId();
+    library.addFile(bmpId, bmpPath);
+    auto texFaces = immer::set<face_id>{}.transient();
+    auto bmpFaces = immer::set<face_id>{}.transient();
+    for (const auto &pair : state.surf.faces) {
+        if (texFaces.size() < 100)
+            texFaces.insert(pair.first);
+        else if (bmpFaces.size() < 50)
+            bmpFaces.insert(pair.first);
+    }
+    Paint texPaint{texId};
+    texPaint.texAxes[0] = glm::vec2(1, 0);
+    texPaint.texAxes[1] = glm::vec2(0, 1);
+    state.surf = assignPaint(state.surf, texFaces.persistent(), texPaint);
+    state.surf = assignPaint(state.surf, bmpFaces.persistent(), Paint{bmpId});
+
+    double surfArea = 0;
+    size_t numFaces = 0;
+    for (const auto &pair : state.surf.faces) {
+        std::vector<glm::vec3> loop;
+        for (auto edge : FaceEdges(state.surf, pair.second))
+            loop.push_back(edge.second.vert.in(state.surf).pos);
+        for (size_t i = 2; i < loop.size(); i++)
+            surfArea += triangleArea(loop[0], loop[i - 1], loop[i]); // octagons are convex
+        numFaces++;
+    }
+
+    writeGlb(glbPath, state.surf, library);
+    checkGlb(glbPath, numFaces, surfArea);
+    DeleteFileA(glbPath.c_str());
+    wprintf(g_failures ? L"%d checks failed\n" : L"All checks passed\n", g_failures);
+    return g_failures ? 1 : 0;
+}
+#endif // ENTRY_TEST_GLB
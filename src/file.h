@@ -5,17 +5,53 @@
 
 #include "editor.h"
 #include "library.h"
+#include "rendermesh.h"
 
 #include <string>
+#include <functional>
 
 namespace winged {
 
+// A .wing file as it was last fully written (or read), so later saves can append only the changes
+struct SavedFile {
+    bool compressed = false;
+    bool incremental = false; // has element IDs, so changes can be appended
+    EditorState base; // state of the full write, which appended changes are relative to
+    uint32_t deltaEntry = 0; // offset of the delta chunk in the chunk table
+    uint64_t baseSize = 0, fileSize = 0; // fileSize is 0 if unknown
+};
+
+// compress makes smaller files which are slower to save
 void writeFile(const std::string &file, const EditorState &state, const ViewState &view,
-    const Library &library);
+    const Library &library, bool compress = false);
+// With incremental, append the changes since the last full write, unless the file on disk doesn't
+// match saved or the changes have grown too large. Otherwise the whole file is written.
+// saved is updated to describe the file.
+void saveFile(const std::string &file, const EditorState &state, const ViewState &view,
+    const Library &library, bool compress, bool incremental, SavedFile *saved);
+// Receives the faces of a file in batches as soon as they are read, before the slower work of
+// building the half-edge structure. Called on the reading thread, and may throw to stop reading.
+using PreviewFn = std::function<void(RenderMesh batch)>;
+// Receives the amount of work done out of total, in arbitrary units. Called on the calling thread
+// between steps, and may throw to stop.
+using ProgressFn = std::function<void(size_t done, size_t total)>;
+
+// saved (optional) receives the format of the file and, if incremental, its state before the
+// appended changes. preview (optional) is called before returning, see PreviewFn.
 std::tuple<EditorState, ViewState, Library> readFile(const std::string &file,
-    const std::string &libraryPath);
+    const std::string &libraryPath, SavedFile *saved = nullptr, const PreviewFn &preview = {});
 
+// Numbers are written the same as printf("%f"), or with roundTrip, in the shortest form that reads
+// back as exactly the same value
 void writeObj(const std::string &file, const Surface &surf, const Library &library,
-    const std::string &mtlName, bool writeMtl);
+    const std::string &mtlName, bool writeMtl, bool roundTrip = false,
+    const ProgressFn &progress = {});
+// Binary glTF, with textures referenced by relative path, or by file: URI on another drive.
+// Textures other than PNG and JPEG are left out, since glTF doesn't support them.
+void writeGlb(const std::string &file, const Surface &surf, const Library &library,
+    const ProgressFn &progress = {});
+// Faces get the default paint. Throws a description of the first problem if the model can't be
+// represented with half-edges (non-manifold edges or vertices, or degenerate faces).
+Surface readObj(const std::string &file, const ProgressFn &progress = {});
 
 } // namespace
@@ -0,0 +1,156 @@
+#include "history.h"
+#include "snapshot.h"
+#include "winchroma.h"
+
+namespace winged {
+
+static uint64_t seek(HANDLE handle, int64_t offset, DWORD method) {
+    LARGE_INTEGER distance, pos;
+    distance.QuadPart = offset;
+    if (!CHECKERR(SetFilePointerEx(handle, distance, &pos, method)))
+        throw winged_error(L"Error accessing undo history");
+    return uint64_t(pos.QuadPart);
+}
+
+UndoHistory::UndoHistory() : budget(DEFAULT_UNDO_BUDGET) {
+    wchar_t buf[32];
+    if (GetEnvironmentVariable(L"WINGED_UNDO_BUDGET_MB", buf, _countof(buf))) {
+        auto megabytes = _wtoi(buf);
+        if (megabytes > 0)
+            budget = size_t(megabytes) << 20;
+    }
+}
+
+UndoHistory::~UndoHistory() {
+    if (spillFile)
+        CloseHandle(spillFile);
+}
+
+void UndoHistory::push(EditorState state, const EditorState &current) {
+    accounting.setReference(current);
+    accounting.retain(state);
+    undoStates.push_back(std::move(state));
+    for (const auto &redoState : redoStates)
+        accounting.release(redoState);
+    redoStates.clear();
+    trim();
+}
+
+bool UndoHistory::canUndo() const {
+    return !undoStates.empty() || !spillOffsets.empty();
+}
+
+bool UndoHistory::canRedo() const {
+    return !redoStates.empty();
+}
+
+EditorState UndoHistory::undo(EditorState current) {
+    if (undoStates.empty()) {
+        undoStates.push_back(unspill());
+        accounting.retain(undoStates.back());
+        // the next spilled state is relative to the one just read
+        accounting.release(spillBase);
+        if (spillOffsets.empty()) {
+            spillBase = {};
+        } else {
+            spillBase = undoStates.back();
+            accounting.retain(spillBase);
+        }
+    }
+    EditorState state = std::move(undoStates.back());
+    undoStates.pop_back();
+    accounting.retain(current); // before releasing, so shared nodes aren't recounted
+    accounting.release(state);
+    redoStates.push_back(std::move(current));
+    accounting.setReference(state);
+    trim();
+    return state;
+}
+
+EditorState UndoHistory::redo(EditorState current) {
+    EditorState state = std::move(redoStates.back());
+    redoStates.pop_back();
+    accounting.retain(current);
+    accounting.release(state);
+    undoStates.push_back(std::move(current));
+    accounting.setReference(state);
+    trim();
+    return state;
+}
+
+void UndoHistory::clear() {
+    undoStates.clear();
+    redoStates.clear();
+    accounting.clear();
+    spillBase = {};
+    if (!spillOffsets.empty()) {
+        spillOffsets.clear();
+        seek(spillFile, 0, FILE_BEGIN);
+        SetEndOfFile(spillFile);
+    }
+}
+
+void UndoHistory::trim() {
+    // always keep the most recent state in memory, spilled states are relative to the next one
+    while (accounting.uniqueBytes() > budget && undoStates.size() > 1) {
+        auto before = accounting.uniqueBytes();
+        try {
+            spill(undoStates[0], undoStates[1]);
+        } catch (winged_error const&) {
+#ifdef CHROMA_DEBUG
+            LOG("Undo spill failed, keeping history in memory");
+#endif
+            return; // keep the history in memory instead
+        }
+        // retain the new base before releasing, so shared nodes aren't recounted
+        accounting.retain(undoStates[1]);
+        if (spillOffsets.size() > 1)
+            accounting.release(spillBase); // same as the state being spilled
+        spillBase = undoStates[1];
+        accounting.release(undoStates.front());
+        undoStates.pop_front();
+        if (accounting.uniqueBytes() >= before)
+            return; // the rest of the history is shared with newer states
+    }
+}
+
+void UndoHistory::spill(const EditorState &state, const EditorState &next) {
+    if (!spillFile) {
+        wchar_t dir[MAX_PATH], path[MAX_PATH];
+        if (!GetTempPath(_countof(dir), dir) || !GetTempFileName(dir, L"wed", 0, path))
+            throw winged_error(L"Error creating undo history file");
+        HANDLE handle = CreateFile(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+            FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+        if (handle == INVALID_HANDLE_VALUE)
+            throw winged_error(L"Error creating undo history file");
+        spillFile = handle;
+    }
+    std::vector<char> buf;
+    putStateDelta(&buf, next, state);
+    auto offset = seek(spillFile, 0, FILE_END);
+    if (!CHECKERR(WriteFile(spillFile, buf.data(), DWORD(buf.size()), NULL, NULL))) {
+        seek(spillFile, int64_t(offset), FILE_BEGIN);
+        SetEndOfFile(spillFile);
+        throw winged_error(L"Error writing undo history");
+    }
+    spillOffsets.push_back(offset);
+}
+
+EditorState UndoHistory::unspill() {
+    auto offset = spillOffsets.back();
+    auto end = seek(spillFile, 0, FILE_END);
+    std::vector<char> buf(size_t(end - offset));
+    seek(spillFile, int64_t(offset), FILE_BEGIN);
+    DWORD bytesRead;
+    if (!CHECKERR(ReadFile(spillFile, buf.data(), DWORD(buf.size()), &bytesRead, NULL))
+            || bytesRead != buf.size())
+        throw winged_error(L"Error reading undo history");
+    const char *ptr = buf.data();
+    EditorState state = takeStateDelta(spillBase, &ptr, buf.data() + buf.size());
+    seek(spillFile, int64_t(offset), FILE_BEGIN);
+    SetEndOfFile(spillFile);
+    spillOffsets.pop_back();
+    return state;
+}
+
+} // namespace
@@ -0,0 +1,54 @@
+// Undo/redo history. Tracks how much memory is kept alive by previous states (not counting what they
+// share with the current state), and moves the oldest states to a temporary file when this exceeds
+// a budget. Spilled states are stored as changes from the next newer state.
+
+#pragma once
+#include "common.h"
+
+#include <deque>
+#include <vector>
+#include "editor.h"
+#include "memusage.h"
+
+namespace winged {
+
+const size_t DEFAULT_UNDO_BUDGET = 256 << 20;
+
+class UndoHistory {
+public:
+    size_t budget; // bytes, can be set with WINGED_UNDO_BUDGET_MB environment variable
+
+    UndoHistory();
+    ~UndoHistory();
+    UndoHistory(const UndoHistory &) = delete;
+    UndoHistory & operator=(const UndoHistory &) = delete;
+
+    // current is the state after the push, which isn't counted against the budget. Clears redo.
+    void push(EditorState state, const EditorState &current);
+    bool canUndo() const;
+    bool canRedo() const;
+    // returns the state to restore
+    EditorState undo(EditorState current);
+    EditorState redo(EditorState current);
+    void clear();
+
+    // not including spilled states, or nodes shared with the current state
+    size_t memoryUsage() const { return accounting.uniqueBytes(); }
+    size_t numSpilled() const { return spillOffsets.size(); }
+    size_t numStates() const { return undoStates.size() + redoStates.size(); } // in memory
+    const NodeAccounting & nodeAccounting() const { return accounting; }
+
+private:
+    std::deque<EditorState> undoStates; // oldest first
+    std::vector<EditorState> redoStates;
+    std::vector<uint64_t> spillOffsets; // oldest first, matches order in file
+    EditorState spillBase; // the newest spilled state is stored relative to this
+    void_p spillFile = nullptr;
+    NodeAccounting accounting;
+
+    void trim();
+    void spill(const EditorState &state, const EditorState &next);
+    EditorState unspill();
+};
+
+} // namespace
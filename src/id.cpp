@@ -1,14 +1,85 @@
 #include "id.h"
+#include <cstring>
 #include <rpc.h>
 
 namespace winged {
 
-id_t genId() {
+enum IdState : LONG {
+    IDS_UNINITIALIZED, IDS_INITIALIZING, IDS_READY
+};
+
+static volatile LONG g_idState = IDS_UNINITIALIZED;
+static uint64_t g_idPrefix;
+static volatile LONG64 g_idCounter = 0;
+
+static uint64_t splitMix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+static void initIds(const uint64_t *seed) {
+    if (InterlockedCompareExchange(&g_idState, IDS_INITIALIZING, IDS_UNINITIALIZED)
+            == IDS_UNINITIALIZED) {
+        if (seed) {
+            g_idPrefix = splitMix64(*seed);
+        } else {
+            GUID random;
+            UuidCreate(&random);
+            memcpy(&g_idPrefix, &random, sizeof(g_idPrefix));
+        }
+        InterlockedExchange(&g_idState, IDS_READY);
+    } else {
+        while (g_idState != IDS_READY)
+            YieldProcessor();
+    }
+}
+
+static id_t makeId(uint64_t count) {
     id_t id;
-    UuidCreate(&id);
+    memcpy(&id, &g_idPrefix, 8);
+    memcpy(reinterpret_cast<char *>(&id) + 8, &count, 8);
     return id;
 }
 
+id_t genId() {
+    if (g_idState != IDS_READY)
+        initIds(nullptr);
+    return makeId(uint64_t(InterlockedIncrement64(&g_idCounter)));
+}
+
+std::vector<id_t> genIds(size_t count) {
+    if (g_idState != IDS_READY)
+        initIds(nullptr);
+    // counter starts at 1, so no ID is all zeros
+    auto first = uint64_t(InterlockedExchangeAdd64(&g_idCounter, LONG64(count))) + 1;
+    std::vector<id_t> ids(count);
+    for (size_t i = 0; i < count; i++)
+        ids[i] = makeId(first + i);
+    return ids;
+}
+
+void seedIds(uint64_t seed) {
+    initIds(&seed);
+}
+
+uint64_t idPrefix() {
+    if (g_idState != IDS_READY)
+        initIds(nullptr);
+    return g_idPrefix;
+}
+
+uint64_t idCounter() {
+    return uint64_t(g_idCounter);
+}
+
+void setIdSequence(uint64_t prefix, uint64_t counter) {
+    g_idPrefix = prefix;
+    g_idCounter = LONG64(counter);
+    InterlockedExchange(&g_idState, IDS_READY);
+}
+
 static void printId(const id_t &id) {
     wprintf(L"{%08lX-%04hX-%04hX-%02hhX%02hhX-",
         id.Data1, id.Data2, id.Data3, id.Data4[0], id.Data4[1]);
@@ -25,8 +96,20 @@ static void printId(const id_t &id) {
 using namespace winged;
 
 int main() {
+    seedIds(1);
     auto id = genId();
     wprintf(L"Generated ID: ");
     printId(id);
+    auto ids = genIds(2);
+    wprintf(L"Next IDs: ");
+    printId(ids[0]);
+    printId(ids[1]);
+    LARGE_INTEGER freq, start, end;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+    ids = genIds(1000000);
+    QueryPerformanceCounter(&end);
+    wprintf(L"1M IDs: %.2f ms\n",
+        double(end.QuadPart - start.QuadPart) * 1000 / double(freq.QuadPart));
 }
 #endif // ENTRY_TEST_ID
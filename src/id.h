@@ -1,13 +1,14 @@
 // Defines a unique identifier datatype id_t, to be used as a lookup key. This avoids the use of
 // pointers to refer to objects, so all data can be DAGs, suitable for persistent data structures
 // (like the ones in immer).
-// id_t uses Windows GUIDs, so each ID will never be reused and broken references will always be
-// detectable.
+// id_t uses the Windows GUID type. Each ID combines a random per-session prefix with a counter, so
+// IDs are never reused and broken references will always be detectable.
 
 #pragma once
 #include "common.h"
 
 #include <memory>
+#include <vector>
 #include <stdint.h>
 #include <guiddef.h>
 
@@ -15,6 +16,17 @@ namespace winged {
 
 using id_t = GUID;
 id_t genId();
+// Generate many IDs at once, which is cheaper than calling genId() repeatedly
+std::vector<id_t> genIds(size_t count);
+// Use a fixed prefix derived from the seed, so a session generates the same sequence of IDs each
+// time (for tests and benchmarks). Must be called before any IDs are generated.
+void seedIds(uint64_t seed);
+// The prefix, and the number of IDs generated so far. A recorded session can be replayed with the
+// same IDs by restoring these.
+uint64_t idPrefix();
+uint64_t idCounter();
+// Continue the sequence of another session. Only for single-threaded tools.
+void setIdSequence(uint64_t prefix, uint64_t counter);
 
 } // namespace
 
@@ -0,0 +1,59 @@
+#include "job.h"
+
+namespace winged {
+
+BackgroundJob::~BackgroundJob() {
+    cancel();
+    wait();
+}
+
+void BackgroundJob::begin(HWND wnd, const wchar_t *name, JobFn fn) {
+    notifyWnd = wnd;
+    number++;
+    jobName = name;
+    token.reset();
+    percent = 0;
+    progressPosted = false;
+    jobResult = {};
+    jobError = nullptr;
+    succeeded = false;
+    group.reset(new TaskGroup(&token)); // skipped if canceled before it starts
+    group->run([this, fn]() {
+        try {
+            jobResult = fn([this](size_t done, size_t total) { progress(done, total); });
+            succeeded = !token.canceled();
+        } catch (...) {
+            jobError = std::current_exception();
+        }
+    });
+    group->postWhenDone(notifyWnd, WM_JOB_COMPLETE, 0, number);
+}
+
+void BackgroundJob::progress(size_t done, size_t total) {
+    if (token.canceled())
+        throw winged_error();
+    auto newPercent = LONG(total ? double(done) * 100 / double(total) : 0);
+    // otherwise the previous message hasn't been handled yet, and will show this percent too
+    if (InterlockedExchange(&percent, newPercent) != newPercent
+            && !InterlockedExchange(&progressPosted, true))
+        PostMessage(notifyWnd, WM_JOB_PROGRESS, 0, number);
+}
+
+int BackgroundJob::takeProgress() {
+    InterlockedExchange(&progressPosted, false);
+    return int(percent);
+}
+
+void BackgroundJob::cancel() {
+    token.cancel();
+}
+
+bool BackgroundJob::wait() {
+    if (group) {
+        group->wait(); // the task catches its own errors
+        group.reset();
+    }
+    return succeeded;
+}
+
+} // namespace
@@ -0,0 +1,69 @@
+// Runs long operations (exports, imports) on the thread pool so the window stays responsive.
+// Progress is shown in the status bar, and the operation can be canceled.
+
+#pragma once
+#include "common.h"
+
+#include <exception>
+#include <functional>
+#include <memory>
+#include "winchroma.h"
+#include "editor.h"
+#include "file.h"
+#include "parallel.h"
+
+namespace winged {
+
+// Posted to the notify window when the percent done changes. lParam is the number of the job.
+const UINT WM_JOB_PROGRESS = WM_APP + 3;
+// Posted to the notify window when the job finishes. lParam is the number of the job.
+const UINT WM_JOB_COMPLETE = WM_APP + 4;
+
+struct JobResult {
+    bool hasState = false; // state replaces the current state as a single undo step
+    EditorState state;
+};
+
+class BackgroundJob {
+public:
+    // Called on a worker. progress throws if the job is canceled.
+    using JobFn = std::function<JobResult(const ProgressFn &progress)>;
+
+    BackgroundJob() = default;
+    ~BackgroundJob();
+    BackgroundJob(const BackgroundJob &) = delete;
+    BackgroundJob & operator=(const BackgroundJob &) = delete;
+
+    bool busy() const { return group != nullptr; }
+    LPARAM jobNum() const { return number; }
+    // Shown in the status bar, must be a constant string
+    const wchar_t * name() const { return jobName; }
+    // Must not be busy
+    void begin(HWND notifyWnd, const wchar_t *name, JobFn fn);
+    // Percent done, and allow another progress message to be posted
+    int takeProgress();
+    // Stop at the next progress report, the result will be a failure
+    void cancel();
+    bool canceled() const { return token.canceled(); }
+    // Block until the job finishes. Returns false if it failed or was canceled.
+    bool wait();
+    // Valid after wait()
+    JobResult & result() { return jobResult; }
+    std::exception_ptr error() const { return jobError; }
+
+private:
+    std::unique_ptr<TaskGroup> group;
+    HWND notifyWnd = NULL;
+    LPARAM number = 0;
+    const wchar_t *jobName = L"";
+    CancelToken token;
+    volatile LONG percent = 0;
+    volatile LONG progressPosted = false;
+    JobResult jobResult;
+    std::exception_ptr jobError;
+    bool succeeded = false;
+
+    void progress(size_t done, size_t total);
+};
+
+} // namespace
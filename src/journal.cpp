@@ -0,0 +1,307 @@
+#include "journal.h"
+#include "snapshot.h"
+
+namespace winged {
+
+// File layout: header, then records of [type, size, checksum, payload]. A record which is
+// incomplete or fails the checksum (from a crash during writing) ends the journal.
+const uint32_t JOURNAL_MAGIC = 'WJNL', JOURNAL_VERSION = 1;
+const uint32_t RECORD_BASE = 'BASE', RECORD_DELTA = 'DELT';
+const wchar_t JOURNAL_PATTERN[] = L"WingEd-*.journal";
+
+static uint32_t checksum(const char *data, size_t size) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= uint8_t(data[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+template<typename C>
+static void putString(std::vector<char> *buf, const std::basic_string<C> &str) {
+    put(buf, uint16_t(str.size()));
+    auto bytes = reinterpret_cast<const char *>(str.data());
+    buf->insert(buf->end(), bytes, bytes + str.size() * sizeof(C));
+}
+
+template<typename C>
+static std::basic_string<C> takeString(const char **ptr, const char *end) {
+    auto len = take<uint16_t>(ptr, end);
+    if (size_t(end - *ptr) < len * sizeof(C))
+        throw winged_error(L"State data is corrupt");
+    std::basic_string<C> str(len, 0);
+    memcpy(&str[0], *ptr, len * sizeof(C));
+    *ptr += len * sizeof(C);
+    return str;
+}
+
+static void appendRecord(std::vector<char> *out, uint32_t type, const std::vector<char> &payload) {
+    put(out, type);
+    put(out, uint32_t(payload.size()));
+    put(out, checksum(payload.data(), payload.size()));
+    out->insert(out->end(), payload.begin(), payload.end());
+}
+
+Journal::~Journal() {
+    stop(false);
+}
+
+void Journal::reset(const wchar_t *filePath, const EditorState &state, const ViewState &view,
+        const Library &library) {
+    Entry entry;
+    entry.type = Entry::RESET;
+    entry.filePath = filePath;
+    entry.state = state;
+    entry.view = view;
+    entry.rootPath = library.rootPath;
+    entry.files = library.idPaths;
+    sentFiles = library.idPaths.size();
+    push(std::move(entry));
+}
+
+void Journal::record(const EditorState &state, const Library &library) {
+    Entry entry;
+    entry.type = Entry::RECORD;
+    entry.state = state;
+    // files are only added during a session (clearing the library resets the journal)
+    if (library.idPaths.size() != sentFiles) {
+        entry.files = library.idPaths;
+        sentFiles = library.idPaths.size();
+    }
+    push(std::move(entry));
+}
+
+void Journal::close() {
+    stop(true);
+}
+
+void Journal::push(Entry entry) {
+    if (!thread) {
+        InitializeCriticalSection(&lock);
+        wakeEvent = CreateEvent(NULL, false, false, NULL);
+        thread = CreateThread(NULL, 0, threadProc, this, 0, NULL);
+        if (!thread) {
+            CloseHandle(wakeEvent);
+            DeleteCriticalSection(&lock);
+            return; // journal is unavailable
+        }
+    }
+    EnterCriticalSection(&lock);
+    queue.push_back(std::move(entry));
+    LeaveCriticalSection(&lock);
+    SetEvent(wakeEvent);
+}
+
+void Journal::stop(bool deleteFile) {
+    if (!thread)
+        return;
+    EnterCriticalSection(&lock);
+    deleteOnStop = deleteFile;
+    LeaveCriticalSection(&lock);
+    Entry entry;
+    entry.type = Entry::STOP;
+    push(std::move(entry));
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+    CloseHandle(wakeEvent);
+    DeleteCriticalSection(&lock);
+    thread = NULL;
+}
+
+DWORD WINAPI Journal::threadProc(LPVOID param) {
+    static_cast<Journal *>(param)->run();
+    return 0;
+}
+
+void Journal::run() {
+    while (1) {
+        WaitForSingleObject(wakeEvent, INFINITE);
+        std::vector<Entry> batch;
+        EnterCriticalSection(&lock);
+        batch.swap(queue);
+        bool deleteFile = deleteOnStop;
+        LeaveCriticalSection(&lock);
+
+        bool stopping = !batch.empty() && batch.back().type == Entry::STOP;
+        try {
+            process(batch);
+        } catch (winged_error const&) {
+            // stop journaling until the next reset, what was written so far is still valid
+            CloseHandle(file);
+            file = INVALID_HANDLE_VALUE;
+        } catch (std::exception const&) {
+            CloseHandle(file);
+            file = INVALID_HANDLE_VALUE;
+        }
+        if (stopping) {
+            if (file != INVALID_HANDLE_VALUE)
+                CloseHandle(file);
+            file = INVALID_HANDLE_VALUE;
+            if (deleteFile && !path.empty())
+                DeleteFile(path.c_str());
+            return;
+        }
+    }
+}
+
+void Journal::process(std::vector<Entry> &batch) {
+    std::vector<char> out;
+    for (size_t i = 0; i < batch.size(); i++) {
+        auto &entry = batch[i];
+        if (entry.type == Entry::RESET) {
+            out.clear(); // previous changes are already in the saved file
+            if (file == INVALID_HANDLE_VALUE) {
+                wchar_t dir[MAX_PATH];
+                if (!GetTempPath(_countof(dir), dir))
+                    throw winged_error(L"Error creating journal");
+                path = std::wstring(dir) + L"WingEd-"
+                    + std::to_wstring(GetCurrentProcessId()) + L".journal";
+                // no sharing, so other instances know this journal is in use
+                file = CreateFile(path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                    FILE_ATTRIBUTE_NORMAL, NULL);
+                if (file == INVALID_HANDLE_VALUE)
+                    throw winged_error(L"Error creating journal");
+            } else {
+                SetFilePointer(file, 0, NULL, FILE_BEGIN);
+                SetEndOfFile(file);
+            }
+            put(&out, JOURNAL_MAGIC);
+            put(&out, JOURNAL_VERSION);
+
+            std::vector<char> payload;
+            putString(&payload, entry.filePath);
+            put(&payload, entry.view);
+            putString(&payload, entry.rootPath);
+            writtenFiles.clear();
+            put(&payload, uint32_t(entry.files.size()));
+            for (const auto &pair : entry.files) {
+                put(&payload, pair.first);
+                putString(&payload, pair.second);
+                writtenFiles.insert(pair.first);
+            }
+            putState(&payload, entry.state);
+            appendRecord(&out, RECORD_BASE, payload);
+            lastState = entry.state;
+        } else if (entry.type == Entry::RECORD && file != INVALID_HANDLE_VALUE) {
+            // consecutive records only need the final state, and the files of all of them
+            if (i + 1 < batch.size() && batch[i + 1].type == Entry::RECORD) {
+                batch[i + 1].files.insert(entry.files.begin(), entry.files.end());
+                continue;
+            }
+            std::vector<char> payload;
+            std::vector<const std::pair<const id_t, std::string> *> newFiles;
+            for (const auto &pair : entry.files)
+                if (!writtenFiles.count(pair.first))
+                    newFiles.push_back(&pair);
+            put(&payload, uint32_t(newFiles.size()));
+            for (const auto &pair : newFiles) {
+                put(&payload, pair->first);
+                putString(&payload, pair->second);
+                writtenFiles.insert(pair->first);
+            }
+            putStateDelta(&payload, lastState, entry.state);
+            appendRecord(&out, RECORD_DELTA, payload);
+            lastState = entry.state;
+        }
+    }
+    if (!out.empty() && file != INVALID_HANDLE_VALUE) {
+        if (!WriteFile(file, out.data(), DWORD(out.size()), NULL, NULL))
+            throw winged_error(L"Error writing journal");
+        // one flush per batch, edits made in the meantime are queued for the next one
+        FlushFileBuffers(file);
+    }
+}
+
+std::wstring findOrphanJournal() {
+    wchar_t dir[MAX_PATH];
+    if (!GetTempPath(_countof(dir), dir))
+        return {};
+    WIN32_FIND_DATA findData;
+    HANDLE search = FindFirstFile((std::wstring(dir) + JOURNAL_PATTERN).c_str(), &findData);
+    if (search == INVALID_HANDLE_VALUE)
+        return {};
+    std::wstring found;
+    do {
+        std::wstring candidate = std::wstring(dir) + findData.cFileName;
+        // journals of running sessions can't be opened
+        HANDLE handle = CreateFile(candidate.c_str(), GENERIC_READ, 0, NULL, OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL, NULL);
+        if (handle != INVALID_HANDLE_VALUE) {
+            CloseHandle(handle);
+            found = candidate;
+            break;
+        }
+    } while (FindNextFile(search, &findData));
+    FindClose(search);
+    return found;
+}
+
+RecoveredSession recoverJournal(const std::wstring &journalPath) {
+    HANDLE handle = CreateFile(journalPath.c_str(), GENERIC_READ, 0, NULL, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE)
+        throw winged_error(L"Error opening journal");
+    LARGE_INTEGER size;
+    std::vector<char> data;
+    DWORD bytesRead = 0;
+    bool ok = GetFileSizeEx(handle, &size) && size.QuadPart < 0x7FFFFFFF;
+    if (ok) {
+        data.resize(size_t(size.QuadPart));
+        ok = ReadFile(handle, data.data(), DWORD(data.size()), &bytesRead, NULL)
+            && bytesRead == data.size();
+    }
+    CloseHandle(handle);
+    if (!ok)
+        throw winged_error(L"Error reading journal");
+
+    const char *ptr = data.data(), *end = data.data() + data.size();
+    if (data.size() < 8 || take<uint32_t>(&ptr, end) != JOURNAL_MAGIC
+            || take<uint32_t>(&ptr, end) != JOURNAL_VERSION)
+        throw winged_error(L"Unrecognized journal format");
+
+    RecoveredSession session;
+    bool haveBase = false;
+    while (end - ptr >= 12) {
+        auto type = take<uint32_t>(&ptr, end);
+        auto recordSize = take<uint32_t>(&ptr, end);
+        auto recordSum = take<uint32_t>(&ptr, end);
+        if (recordSize > size_t(end - ptr) || checksum(ptr, recordSize) != recordSum)
+            break; // incomplete
+        const char *rec = ptr, *recEnd = ptr + recordSize;
+        ptr = recEnd;
+        try {
+            if (type == RECORD_BASE) {
+                RecoveredSession base;
+                base.filePath = takeString<wchar_t>(&rec, recEnd);
+                base.view = take<ViewState>(&rec, recEnd);
+                base.library.rootPath = takeString<char>(&rec, recEnd);
+                auto numFiles = take<uint32_t>(&rec, recEnd);
+                for (uint32_t i = 0; i < numFiles; i++) {
+                    auto id = take<id_t>(&rec, recEnd);
+                    base.library.addFile(id, takeString<char>(&rec, recEnd));
+                }
+                base.state = takeState(&rec, recEnd);
+                session = std::move(base);
+                haveBase = true;
+            } else if (type == RECORD_DELTA && haveBase) {
+                Library library = session.library;
+                auto numFiles = take<uint32_t>(&rec, recEnd);
+                for (uint32_t i = 0; i < numFiles; i++) {
+                    auto id = take<id_t>(&rec, recEnd);
+                    library.addFile(id, takeString<char>(&rec, recEnd));
+                }
+                session.state = takeStateDelta(session.state, &rec, recEnd);
+                session.library = std::move(library);
+            }
+        } catch (winged_error const&) {
+            break;
+        }
+    }
+    if (!haveBase)
+        throw winged_error(L"Journal is empty or damaged");
+    return session;
+}
+
+} // namespace
@@ -0,0 +1,75 @@
+// Append-only journal of edits made since the file was last saved, so the session can be recovered
+// after a crash. The journal starts with a snapshot of the saved state, followed by the changes
+// after each edit. All writing happens on a background thread.
+
+#pragma once
+#include "common.h"
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include "winchroma.h"
+#include "editor.h"
+#include "library.h"
+
+namespace winged {
+
+struct RecoveredSession {
+    std::wstring filePath;
+    EditorState state;
+    ViewState view;
+    Library library;
+};
+
+class Journal {
+public:
+    Journal() = default;
+    ~Journal();
+    Journal(const Journal &) = delete;
+    Journal & operator=(const Journal &) = delete;
+
+    // Start over from a state which matches the file on disk (after opening or saving)
+    void reset(const wchar_t *filePath, const EditorState &state, const ViewState &view,
+        const Library &library);
+    // Record the current state after an edit. Doesn't block, changes are found on the worker. The
+    // library is only copied if files were added since the last record.
+    void record(const EditorState &state, const Library &library);
+    // Finish writing and delete the journal, when the session ends normally
+    void close();
+
+private:
+    struct Entry {
+        enum Type { RESET, RECORD, STOP } type;
+        std::wstring filePath;
+        EditorState state;
+        ViewState view;
+        std::string rootPath;
+        std::unordered_map<id_t, std::string> files;
+    };
+
+    HANDLE thread = NULL, wakeEvent = NULL;
+    CRITICAL_SECTION lock;
+    std::vector<Entry> queue;
+    bool deleteOnStop = false;
+    size_t sentFiles = 0; // size of the library when it was last queued
+
+    // only accessed by worker thread
+    HANDLE file = INVALID_HANDLE_VALUE;
+    std::wstring path;
+    EditorState lastState;
+    std::unordered_set<id_t> writtenFiles;
+
+    void push(Entry entry);
+    void stop(bool deleteFile);
+    void run();
+    void process(std::vector<Entry> &batch);
+    static DWORD WINAPI threadProc(LPVOID param);
+};
+
+// Journal left behind by a session which didn't exit normally, or empty if there is none
+std::wstring findOrphanJournal();
+// Rebuild the session from the journal, up to the last complete entry
+RecoveredSession recoverJournal(const std::wstring &journalPath);
+
+} // namespace
@@ -0,0 +1,213 @@
+#include "latency.h"
+#include <algorithm>
+#include "winchroma.h"
+#include "trace.h"
+
+namespace winged {
+
+const wchar_t * const LATENCY_STAGE_NAMES[LAT_STAGE_COUNT] = {
+    L"Handled", L"Mesh", L"Drawn", L"Presented"};
+
+LatencyTracker::LatencyTracker(int64_t ticksPerSecond) {
+    if (!ticksPerSecond) {
+        LARGE_INTEGER freq;
+        QueryPerformanceFrequency(&freq);
+        ticksPerSecond = freq.QuadPart;
+    }
+    ticksPerMs = double(ticksPerSecond) / 1000;
+}
+
+void LatencyTracker::input(int64_t time) {
+    if (!inProgress) {
+        inProgress = true;
+        inputTime = time;
+        std::fill(std::begin(stageTimes), std::end(stageTimes), 0);
+    }
+}
+
+void LatencyTracker::stage(LatencyStage stage, int64_t time) {
+    if (!inProgress)
+        return;
+    stageTimes[stage] = time;
+    if (stage != LAT_PRESENTED)
+        return;
+
+    inProgress = false;
+    std::array<float, LAT_STAGE_COUNT> sample;
+    int64_t prev = inputTime;
+    for (int i = 0; i < LAT_STAGE_COUNT; i++) {
+        if (stageTimes[i])
+            prev = stageTimes[i];
+        sample[size_t(i)] = float(double(prev - inputTime) / ticksPerMs);
+    }
+    if (samples.size() < LATENCY_WINDOW)
+        samples.push_back(sample);
+    else
+        samples[nextSample] = sample;
+    nextSample = (nextSample + 1) % LATENCY_WINDOW;
+
+    if (g_traceOn) {
+        TraceCounter counters[] = {
+            {"handledUs", int64_t(sample[LAT_HANDLED] * 1000)},
+            {"meshUs", int64_t(sample[LAT_MESH] * 1000)},
+            {"drawnUs", int64_t(sample[LAT_DRAWN] * 1000)}};
+        recordTrace("inputLatency", inputTime, time, counters, 3);
+    }
+}
+
+void LatencyTracker::cancel() {
+    inProgress = false;
+}
+
+LatencyStats LatencyTracker::stats() const {
+    LatencyStats stats;
+    stats.count = samples.size();
+    if (samples.empty())
+        return stats;
+    std::vector<float> values(samples.size());
+    // nearest rank, allowing for rounding in p * count
+    auto percentile = [&](double p) {
+        auto rank = size_t(p * double(values.size()) + 0.999999);
+        return values[std::max(rank, size_t(1)) - 1];
+    };
+    for (size_t s = 0; s < LAT_STAGE_COUNT; s++) {
+        for (size_t i = 0; i < samples.size(); i++)
+            values[i] = samples[i][s];
+        std::sort(values.begin(), values.end());
+        stats.p50[s] = percentile(0.50);
+        stats.p95[s] = percentile(0.95);
+        stats.p99[s] = percentile(0.99);
+    }
+    return stats;
+}
+
+} // namespace
+
+#ifdef ENTRY_TEST_LATENCY
+#include <cstdio>
+using namespace winged;
+
+// Synthetic message pump: mouse moves are posted to a window which advances a fake clock by a known
+// amount in each stage, so the measured latency is exact
+
+static LatencyTracker *g_tracker;
+static int64_t g_clock = 1;
+static int64_t g_handleCost;
+static bool g_visibleResult = true;
+static int g_failures = 0;
+
+const int SYNTHETIC_X = 10000; // real mouse moves are ignored
+const int64_t MESH_COST = 3, DRAW_COST = 4, PRESENT_COST = 1;
+
+static LRESULT CALLBACK testWindowProc(HWND wnd, UINT msg, WPARAM wParam, LPARAM lParam) {
+    switch (msg) {
+        case WM_MOUSEMOVE:
+            if (GET_X_LPARAM(lParam) != SYNTHETIC_X)
+                return 0;
+            g_tracker->input(g_clock);
+            g_clock += g_handleCost;
+            g_tracker->stage(LAT_HANDLED, g_clock);
+            if (g_visibleResult)
+                InvalidateRect(wnd, NULL, false);
+            if (!GetUpdateRect(wnd, NULL, false))
+                g_tracker->cancel();
+            return 0;
+        case WM_PAINT: {
+            PAINTSTRUCT ps;
+            BeginPaint(wnd, &ps);
+            g_clock += MESH_COST;
+            g_tracker->stage(LAT_MESH, g_clock);
+            g_clock += DRAW_COST;
+            g_tracker->stage(LAT_DRAWN, g_clock);
+            g_clock += PRESENT_COST;
+            g_tracker->stage(LAT_PRESENTED, g_clock);
+            EndPaint(wnd, &ps);
+            return 0;
+        }
+    }
+    return DefWindowProc(wnd, msg, wParam, lParam);
+}
+
+static void postMove(HWND wnd) {
+    PostMessage(wnd, WM_MOUSEMOVE, 0, MAKELPARAM(SYNTHETIC_X, 0));
+}
+
+static void pump() {
+    MSG msg;
+    while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE))
+        DispatchMessage(&msg);
+}
+
+static void check(bool cond, const char *what) {
+    if (!cond) {
+        wprintf(L"FAILED: %S\n", what);
+        g_failures++;
+    }
+}
+
+int main() {
+    WNDCLASS wndClass = {};
+    wndClass.lpfnWndProc = testWindowProc;
+    wndClass.hInstance = GetModuleHandle(NULL);
+    wndClass.lpszClassName = L"WingEd Latency Test";
+    RegisterClass(&wndClass);
+    auto wnd = CreateWindowEx(WS_EX_TOOLWINDOW | WS_EX_NOACTIVATE, wndClass.lpszClassName, L"",
+        WS_POPUP | WS_VISIBLE, 0, 0, 16, 16, NULL, NULL, wndClass.hInstance, NULL);
+    pump(); // initial paint
+
+    // each input handled and presented before the next
+    LatencyTracker tracker(1000); // 1 tick = 1 ms
+    g_tracker = &tracker;
+    for (int i = 0; i < 100; i++) {
+        g_handleCost = i % 10;
+        postMove(wnd);
+        pump();
+    }
+    auto stats = tracker.stats();
+    check(stats.count == 100, "one sample per input");
+    // totals are 8 to 17 ms, ten of each
+    check(stats.p50[LAT_PRESENTED] == 12, "p50");
+    check(stats.p95[LAT_PRESENTED] == 17, "p95");
+    check(stats.p99[LAT_PRESENTED] == 17, "p99");
+    check(stats.p50[LAT_HANDLED] == 4, "p50 handled");
+    check(stats.p50[LAT_DRAWN] == 11, "p50 drawn");
+
+    // several inputs before one frame are measured from the first
+    LatencyTracker coalesced(1000);
+    g_tracker = &coalesced;
+    g_handleCost = 5;
+    for (int i = 0; i < 3; i++)
+        postMove(wnd);
+    pump();
+    stats = coalesced.stats();
+    check(stats.count == 1, "coalesced inputs make one sample");
+    check(stats.p50[LAT_PRESENTED] == 15 + MESH_COST + DRAW_COST + PRESENT_COST,
+        "coalesced latency from first input");
+
+    // inputs without a visible result aren't samples, and don't delay the next one
+    g_visibleResult = false;
+    postMove(wnd);
+    pump();
+    g_visibleResult = true;
+    postMove(wnd);
+    pump();
+    stats = coalesced.stats();
+    check(stats.count == 2, "input without a frame is canceled");
+    check(stats.p50[LAT_PRESENTED] == 5 + MESH_COST + DRAW_COST + PRESENT_COST,
+        "input after a canceled one");
+
+    // only the most recent samples are kept
+    g_handleCost = 0;
+    for (size_t i = 0; i < LATENCY_WINDOW + 10; i++) {
+        postMove(wnd);
+        pump();
+    }
+    stats = coalesced.stats();
+    check(stats.count == LATENCY_WINDOW, "window size");
+    check(stats.p99[LAT_PRESENTED] == MESH_COST + DRAW_COST + PRESENT_COST, "old samples dropped");
+
+    DestroyWindow(wnd);
+    wprintf(g_failures ? L"%d checks failed\n" : L"All checks passed\n", g_failures);
+    return g_failures ? 1 : 0;
+}
+#endif // ENTRY_TEST_LATENCY
@@ -0,0 +1,54 @@
+// Measures the time from mouse input to presenting the frame which shows its result, split into
+// stages, and keeps percentiles over the most recent inputs
+
+#pragma once
+#include "common.h"
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace winged {
+
+enum LatencyStage {
+    LAT_HANDLED,    // input handled (hover picking or tool adjustment)
+    LAT_MESH,       // render mesh up to date
+    LAT_DRAWN,      // drawing commands issued
+    LAT_PRESENTED,  // SwapBuffers returned
+    LAT_STAGE_COUNT
+};
+extern const wchar_t * const LATENCY_STAGE_NAMES[LAT_STAGE_COUNT];
+
+const size_t LATENCY_WINDOW = 512; // samples kept
+
+struct LatencyStats {
+    size_t count = 0;
+    // milliseconds from input to the end of each stage
+    float p50[LAT_STAGE_COUNT] = {}, p95[LAT_STAGE_COUNT] = {}, p99[LAT_STAGE_COUNT] = {};
+};
+
+class LatencyTracker {
+public:
+    // Times are in ticks, 0 to use QueryPerformanceCounter ticks
+    explicit LatencyTracker(int64_t ticksPerSecond = 0);
+
+    // Start a sample, unless one is in progress (inputs handled before the next frame are measured
+    // from the earliest)
+    void input(int64_t time);
+    // Stages which aren't marked take the time of the previous stage. LAT_PRESENTED completes the
+    // sample.
+    void stage(LatencyStage stage, int64_t time);
+    // The input had no visible result
+    void cancel();
+    LatencyStats stats() const;
+
+private:
+    double ticksPerMs;
+    bool inProgress = false;
+    int64_t inputTime = 0;
+    int64_t stageTimes[LAT_STAGE_COUNT];
+    std::vector<std::array<float, LAT_STAGE_COUNT>> samples; // ring buffer
+    size_t nextSample = 0;
+};
+
+} // namespace
@@ -0,0 +1,82 @@
+#include "loader.h"
+#include "ops.h"
+#include "strutil.h"
+
+namespace winged {
+
+BackgroundLoad::BackgroundLoad() {
+    InitializeCriticalSection(&lock);
+}
+
+BackgroundLoad::~BackgroundLoad() {
+    cancel();
+    wait();
+    DeleteCriticalSection(&lock);
+}
+
+void BackgroundLoad::begin(HWND wnd, std::wstring path, std::string library) {
+    notifyWnd = wnd;
+    number++;
+    libraryPath = std::move(library);
+    preview.clear();
+    canceled = false;
+    loaded = {};
+    loaded.path = std::move(path);
+    succeeded = false;
+    thread = CreateThread(NULL, 0, threadProc, this, 0, NULL);
+    if (!thread) {
+        loaded.error = std::make_exception_ptr(winged_error(L"Error opening file"));
+        PostMessage(notifyWnd, WM_LOAD_COMPLETE, false, number);
+    }
+}
+
+void BackgroundLoad::takePreview(std::vector<RenderMesh> *batches) {
+    EnterCriticalSection(&lock);
+    for (auto &batch : preview)
+        batches->push_back(std::move(batch));
+    preview.clear();
+    LeaveCriticalSection(&lock);
+}
+
+void BackgroundLoad::cancel() {
+    InterlockedExchange(&canceled, true);
+}
+
+bool BackgroundLoad::wait() {
+    if (thread) {
+        WaitForSingleObject(thread, INFINITE);
+        CloseHandle(thread);
+        thread = NULL;
+    }
+    return succeeded;
+}
+
+DWORD WINAPI BackgroundLoad::threadProc(LPVOID param) {
+    auto self = static_cast<BackgroundLoad *>(param);
+    auto &loaded = self->loaded;
+    auto preview = [self](RenderMesh batch) {
+        if (self->canceled)
+            throw winged_error();
+        EnterCriticalSection(&self->lock);
+        bool wasEmpty = self->preview.empty();
+        self->preview.push_back(std::move(batch));
+        LeaveCriticalSection(&self->lock);
+        // otherwise the previous message hasn't been handled yet, and will take this batch too
+        if (wasEmpty)
+            PostMessage(self->notifyWnd, WM_LOAD_PROGRESS, 0, 0);
+    };
+    try {
+        auto res = readFile(narrow(loaded.path), self->libraryPath, &loaded.saved, preview);
+        if (self->canceled)
+            throw winged_error();
+        validateSurface(get<EditorState>(res).surf);
+        tie(loaded.state, loaded.view, loaded.library) = std::move(res);
+        self->succeeded = !self->canceled;
+    } catch (...) {
+        loaded.error = std::current_exception();
+    }
+    PostMessage(self->notifyWnd, WM_LOAD_COMPLETE, self->succeeded, self->number);
+    return 0;
+}
+
+} // namespace
@@ -0,0 +1,67 @@
+// Opens files on a background thread. Faces are shown as soon as they are read, while the rest of
+// the state is built and validated.
+
+#pragma once
+#include "common.h"
+
+#include <exception>
+#include <string>
+#include <vector>
+#include "winchroma.h"
+#include "editor.h"
+#include "library.h"
+#include "file.h"
+#include "rendermesh.h"
+
+namespace winged {
+
+// Posted to the notify window when there are new preview batches
+const UINT WM_LOAD_PROGRESS = WM_APP + 1;
+// Posted to the notify window when loading finishes. wParam is nonzero on success, lParam is the
+// number of the load (to ignore messages from a load which was canceled).
+const UINT WM_LOAD_COMPLETE = WM_APP + 2;
+
+struct LoadResult {
+    std::wstring path;
+    EditorState state;
+    ViewState view;
+    Library library;
+    SavedFile saved;
+    std::exception_ptr error;
+};
+
+class BackgroundLoad {
+public:
+    BackgroundLoad();
+    ~BackgroundLoad();
+    BackgroundLoad(const BackgroundLoad &) = delete;
+    BackgroundLoad & operator=(const BackgroundLoad &) = delete;
+
+    bool busy() const { return thread != NULL; }
+    LPARAM loadNum() const { return number; }
+    // Must not be busy
+    void begin(HWND notifyWnd, std::wstring path, std::string libraryPath);
+    // Move preview batches received since the last call to the end of batches
+    void takePreview(std::vector<RenderMesh> *batches);
+    // Stop as soon as possible, the result will be a failure
+    void cancel();
+    // Block until loading finishes. Returns false if it failed or was canceled.
+    bool wait();
+    // Valid after wait()
+    LoadResult & result() { return loaded; }
+
+private:
+    HANDLE thread = NULL;
+    HWND notifyWnd = NULL;
+    LPARAM number = 0;
+    std::string libraryPath;
+    CRITICAL_SECTION lock;
+    std::vector<RenderMesh> preview; // guarded by lock
+    volatile LONG canceled = false;
+    LoadResult loaded;
+    bool succeeded = false;
+
+    static DWORD WINAPI threadProc(LPVOID param);
+};
+
+} // namespace
@@ -1,11 +1,14 @@
 #include "main.h"
+#include <algorithm>
 #include <glm/gtc/matrix_transform.hpp>
 #include "ops.h"
 #include "file.h"
+#include "id.h"
 #include "image.h"
 #include "mathutil.h"
 #include "resource.h"
 #include "strutil.h"
+#include "trace.h"
 #include <immer/set_transient.hpp>
 #include <shlwapi.h>
 
@@ -26,8 +29,14 @@ enum ToolbarImage {
     NUM_TOOLBAR_IMAGES
 };
 enum StatusPart {
-    STATUS_GRID, STATUS_SELECT, STATUS_DIMEN, STATUS_HELP, NUM_STATUS_PARTS
+    STATUS_GRID, STATUS_SELECT, STATUS_DIMEN, STATUS_SAVE, STATUS_JOB, STATUS_HELP,
+    NUM_STATUS_PARTS
 };
+enum TimerID {
+    TIMER_AUTOSAVE = 1
+};
+
+const UINT DEFAULT_AUTOSAVE_SECONDS = 60;
 
 // main.h
 MainWindow g_mainWindow;
@@ -59,74 +68,6 @@ static void resetToolState() {
     g_drawVerts.clear();
 }
 
-static std::vector<edge_id> sortEdgeLoop(const Surface &surf, immer::set<edge_id> edges) {
-    std::vector<edge_id> loop;
-    auto edgesTrans = edges.transient();
-    loop.reserve(edges.size());
-    loop.push_back(*edges.begin());
-    edgesTrans.erase(loop[0]);
-    while (loop.size() != edges.size()) {
-        auto nextVert = loop.back().in(surf).next.in(surf).vert;
-        edge_id foundEdge = {};
-        for (const auto &e : edgesTrans) {
-            const auto &edge = e.in(surf);
-            if (edge.vert == nextVert && edge.twin != loop.back()) {
-                foundEdge = e;
-                break;
-            } else if (edge.twin.in(surf).vert == nextVert && e != loop.back()) {
-                foundEdge = edge.twin;
-                break;
-            }
-        }
-        if (foundEdge == edge_id{})
-            throw winged_error(L"Edges must form a loop");
-        loop.push_back(foundEdge);
-        edgesTrans.erase(foundEdge);
-    }
-    if (loop.back().in(surf).next.in(surf).vert != loop[0].in(surf).vert)
-        throw winged_error(L"Edges must form a loop");
-    return loop;
-}
-
-static EditorState erase(EditorState state) {
-    EditorState newState = state;
-    if (state.selMode == SEL_ELEMENTS) {
-        // edges first, then vertices
-        bool anyDeleted = false;
-        for (const auto &e : state.selEdges) {
-            if (e.find(newState.surf)) { // could have been deleted previously
-                newState.surf = mergeFaces(std::move(newState.surf), e);
-                anyDeleted = true;
-            }
-        }
-        for (const auto &v : state.selVerts) {
-            if (auto vert = v.find(newState.surf)) {
-                // make sure vert has only two edges
-                const auto &edge = vert->edge.in(newState.surf);
-                const auto &twin = edge.twin.in(newState.surf);
-                const auto &twinNext = twin.next.in(newState.surf);
-                if (twinNext.twin.in(newState.surf).next == vert->edge) {
-                    newState.surf = joinVerts(std::move(newState.surf), edge.prev, vert->edge);
-                    anyDeleted = true;
-                }
-            }
-        }
-        if (!anyDeleted)
-            throw winged_error();
-    } else if (state.selMode == SEL_SOLIDS) {
-        for (const auto &v : state.selVerts)
-            newState.surf.verts = std::move(newState.surf.verts).erase(v);
-        for (const auto &f : state.selFaces)
-            newState.surf.faces = std::move(newState.surf.faces).erase(f);
-        for (const auto &e : state.selEdges)
-            newState.surf.edges = std::move(newState.surf.edges).erase(e)
-                .erase(e.in(state.surf).twin);
-    } else {
-        throw winged_error();
-    }
-    return newState;
-}
-
 #ifdef CHROMA_DEBUG
 static const HEdge expectSingleSelEdge() {
     if (g_state.selEdges.size() == 1)
@@ -168,27 +109,62 @@ INT_PTR CALLBACK matrixDlgProc(HWND dlg, UINT msg, WPARAM wParam, LPARAM lParam)
 }
 
 void MainWindow::pushUndo() {
-    undoStack.push(g_state);
-    redoStack = {};
+    history.push(g_state, g_state);
     unsavedCount++;
 }
 
 void MainWindow::pushUndo(EditorState newState) {
+    TraceScope trace("pushUndo");
+    trace.counter("edges", int64_t(newState.surf.edges.size()));
     validateSurface(newState.surf);
-    pushUndo();
-    g_state = cleanSelection(newState);
+    newState = cleanSelection(newState);
+    history.push(g_state, newState);
+    unsavedCount++;
+    g_state = std::move(newState);
+    recordJournal();
 }
 
 void MainWindow::undo() {
-    if (!undoStack.empty()) {
-        redoStack.push(g_state);
-        g_state = undoStack.top();
-        undoStack.pop();
+    if (history.canUndo()) {
+        g_state = history.undo(std::move(g_state));
         unsavedCount--;
+        recordJournal();
+    }
+    resetToolState();
+}
+
+void MainWindow::redo() {
+    if (history.canRedo()) {
+        g_state = history.redo(std::move(g_state));
+        unsavedCount++;
+        recordJournal();
     }
     resetToolState();
 }
 
+bool MainWindow::perform(Action action) {
+    action.drawVerts = g_drawVerts;
+    auto ids = idCounter();
+    auto before = g_state;
+    auto result = applyAction(g_state, action);
+    g_drawVerts = std::move(result.drawVerts);
+    switch (result.kind) {
+        case ActionResult::REPLACE: g_state = std::move(result.state); break;
+        case ActionResult::PUSH: pushUndo(std::move(result.state)); break;
+        case ActionResult::PUSH_CURRENT: pushUndo(); break;
+        case ActionResult::UNDO: undo(); break;
+        case ActionResult::REDO: redo(); break;
+    }
+    commandLog.record(action, result.kind, ids, before, g_state);
+    if (result.flash)
+        flashSel();
+    return result.finishTool;
+}
+
+void MainWindow::recordJournal() {
+    journal.record(g_state, g_library);
+}
+
 void MainWindow::updateStatus() {
     wchar_t buf[256];
 
@@ -373,30 +349,170 @@ void MainWindow::closeExtraViewports() {
 }
 
 void MainWindow::resetModel() {
-    undoStack = {};
-    redoStack = {};
+    finishAutosave();
+    savedFile = {};
+    history.clear();
     unsavedCount = 0;
     objFilePath[0] = 0;
     resetToolState();
+    commandLog.stop(); // replay starts from the recorded state, so a new model needs a new log
 
     closeExtraViewports();
     mainViewport.clearTextureCache();
     mainViewport.updateProjMat();
+    resetJournal();
+}
+
+void MainWindow::resetJournal() {
+    journal.reset(filePath, g_state, mainViewport.view, g_library);
+}
+
+void MainWindow::recoverSession() {
+    auto journalPath = findOrphanJournal();
+    if (journalPath.empty())
+        return;
+    if (MessageBox(wnd, L"WingEd did not close properly. Recover unsaved changes?",
+            APP_NAME, MB_YESNO | MB_ICONWARNING) != IDYES) {
+        DeleteFile(journalPath.c_str());
+        return;
+    }
+    std::wstring error;
+    try {
+        auto session = recoverJournal(journalPath);
+        validateSurface(session.state.surf);
+        g_state = std::move(session.state);
+        mainViewport.view = session.view;
+        g_library = std::move(session.library);
+        lstrcpyn(filePath, session.filePath.c_str(), _countof(filePath));
+        unsavedCount = 1; // recovered changes aren't saved
+        DeleteFile(journalPath.c_str());
+        return;
+    } catch (winged_error const &err) {
+        error = err.message ? err.message : L"Error recovering session";
+    } catch (std::exception const &) {
+        error = L"Unexpected error recovering session";
+    }
+    // keep the only copy of the changes, under a name which isn't offered for recovery again
+    auto keptPath = journalPath + L".failed";
+    if (!MoveFileEx(journalPath.c_str(), keptPath.c_str(), MOVEFILE_REPLACE_EXISTING))
+        keptPath = journalPath;
+    error += L"\n\nThe journal was kept at:\n" + keptPath;
+    MessageBox(wnd, error.c_str(), APP_NAME, MB_ICONERROR);
 }
 
+// The current file is closed immediately, and the new file is shown as it's read. Editing starts
+// (or an error is shown) once loading finishes.
 void MainWindow::open(const wchar_t *path) {
-    auto res = readFile(narrow(path), g_library.rootPath);
-    validateSurface(get<EditorState>(res).surf);
-    tie(g_state, mainViewport.view, g_library) = std::move(res);
-    memcpy(filePath, path, sizeof(filePath));
+    cancelBackground();
+    auto libraryPath = g_library.rootPath;
+    g_state = {};
+    g_library.clear();
+    filePath[0] = 0;
     resetModel();
+    previewBatches.clear();
+    g_renderMesh.clear();
+    loadStart = traceTime();
+    loader.begin(wnd, path, libraryPath);
+    SendMessage(statusWnd, SB_SETTEXT, STATUS_SAVE, LPARAM(L"Loading..."));
+}
+
+void MainWindow::onLoadProgress() {
+    if (!loader.busy())
+        return;
+    loader.takePreview(&previewBatches);
+    mergeRenderMeshes(&g_renderMesh, previewBatches);
+    refreshAll();
+}
+
+void MainWindow::onLoadComplete(LPARAM loadNum) {
+    if (!loader.busy() || loadNum != loader.loadNum())
+        return; // canceled
+    bool success = loader.wait();
+    if (g_traceOn)
+        recordTrace("loadFile", loadStart, traceTime(), nullptr, 0);
+    previewBatches.clear();
+    SendMessage(statusWnd, SB_SETTEXT, STATUS_SAVE, LPARAM(L""));
+    auto &loaded = loader.result();
+    if (success) {
+        g_state = std::move(loaded.state);
+        mainViewport.view = loaded.view;
+        g_library = std::move(loaded.library);
+        lstrcpyn(filePath, loaded.path.c_str(), _countof(filePath));
+        resetModel();
+        savedFile = std::move(loaded.saved);
+        compressFile = savedFile.compressed;
+        incrementalSave = savedFile.incremental;
+    } else if (loaded.error) {
+        try {
+            std::rethrow_exception(loaded.error);
+        } catch (winged_error const &err) {
+            showError(err);
+        } catch (std::exception const &e) {
+            showStdException(e);
+        }
+    }
+    updateStatus();
+    refreshAll();
+}
+
+// Editing is disabled until the job finishes, so its result can't conflict with other changes
+void MainWindow::startJob(const wchar_t *name, BackgroundJob::JobFn fn) {
+    job.begin(wnd, name, std::move(fn));
+    onJobProgress(job.jobNum());
+}
+
+void MainWindow::onJobProgress(LPARAM jobNum) {
+    if (!job.busy() || jobNum != job.jobNum())
+        return;
+    wchar_t buf[64];
+    if (job.canceled())
+        _swprintf(buf, L"%s... canceling", job.name());
+    else
+        _swprintf(buf, L"%s... %d%% (Esc to cancel)", job.name(), job.takeProgress());
+    SendMessage(statusWnd, SB_SETTEXT, STATUS_JOB, LPARAM(buf));
+}
+
+void MainWindow::onJobComplete(LPARAM jobNum) {
+    if (!job.busy() || jobNum != job.jobNum())
+        return; // canceled
+    bool success = job.wait();
+    SendMessage(statusWnd, SB_SETTEXT, STATUS_JOB, LPARAM(L""));
+    try {
+        if (success && job.result().hasState) {
+            Action action;
+            action.type = ACT_SET_STATE;
+            action.state = std::move(job.result().state);
+            perform(std::move(action));
+        }
+        else if (job.error() && !job.canceled())
+            std::rethrow_exception(job.error());
+    } catch (winged_error const &err) {
+        showError(err);
+    } catch (std::exception const &e) {
+        showStdException(e);
+    }
+    updateStatus();
+    refreshAll();
+}
+
+// Results of a canceled job are discarded
+void MainWindow::cancelBackground() {
+    loader.cancel();
+    job.cancel();
+    loader.wait();
+    job.wait();
+    SendMessage(statusWnd, SB_SETTEXT, STATUS_JOB, LPARAM(L""));
 }
 
 bool MainWindow::saveAs() {
     auto filters = L"WingEd File (.wing)\0*.wing\0All Files\0*.*\0\0";
     if (GetSaveFileName(tempPtr(makeOpenFileName(filePath, wnd, filters, L"wing")))) {
-        writeFile(narrow(filePath), g_state, mainViewport.view, g_library);
+        finishAutosave();
+        savedFile = {}; // different file
+        saveFile(narrow(filePath), g_state, mainViewport.view, g_library, compressFile,
+            incrementalSave, &savedFile);
         unsavedCount = 0;
+        resetJournal();
         return true;
     }
     return false;
@@ -406,12 +522,119 @@ bool MainWindow::save() {
     if (!filePath[0]) {
         return saveAs();
     } else {
-        writeFile(narrow(filePath), g_state, mainViewport.view, g_library);
+        finishAutosave();
+        saveFile(narrow(filePath), g_state, mainViewport.view, g_library, compressFile,
+            incrementalSave, &savedFile);
         unsavedCount = 0;
+        resetJournal();
         return true;
     }
 }
 
+void MainWindow::startAutosave() {
+    // skip while dragging, since the state is still changing
+    if (!filePath[0] || !unsavedCount || autosave.busy() || GetCapture())
+        return;
+    autosaveCount = unsavedCount;
+    autosavePending = true;
+    autosave.begin(wnd, {filePath, g_state, mainViewport.view, g_library,
+        compressFile, incrementalSave, savedFile});
+    SendMessage(statusWnd, SB_SETTEXT, STATUS_SAVE, LPARAM(L"Saving..."));
+}
+
+void MainWindow::finishAutosave() {
+    // the result is otherwise ignored, since the file is about to be replaced or is no longer open
+    if (autosave.wait() && autosavePending)
+        savedFile = autosave.snapshot().file;
+    autosavePending = false;
+    SendMessage(statusWnd, SB_SETTEXT, STATUS_SAVE, LPARAM(L""));
+}
+
+void MainWindow::onSaveComplete(bool success) {
+    success = autosave.wait() && success;
+    if (!autosavePending)
+        return;
+    autosavePending = false;
+    if (success) {
+        unsavedCount -= autosaveCount; // edits made during the save are still unsaved
+        const auto &saved = autosave.snapshot();
+        savedFile = saved.file;
+        journal.reset(saved.path.c_str(), saved.state, saved.view, saved.library);
+        if (unsavedCount)
+            recordJournal();
+        updateStatus();
+        SendMessage(statusWnd, SB_SETTEXT, STATUS_SAVE, LPARAM(L"Autosaved"));
+    } else {
+        SendMessage(statusWnd, SB_SETTEXT, STATUS_SAVE, LPARAM(L"Autosave failed"));
+    }
+}
+
+static void appendMemoryLine(std::wstring *text, const wchar_t *label, size_t bytes,
+        const wchar_t *detail) {
+    wchar_t line[256];
+    _swprintf(line, L"%s\t%.1f KB\t%s\n", label, double(bytes) / 1024, detail);
+    *text += line;
+}
+
+static std::wstring nodeDetail(const NodeMemory &mem) {
+    wchar_t detail[64];
+    _swprintf(detail, L"%u nodes, %.0f%% shared with undo", unsigned(mem.nodes),
+        mem.bytes ? double(mem.sharedBytes) * 100 / double(mem.bytes) : 0.0);
+    return detail;
+}
+
+void MainWindow::showMemoryReport() {
+    std::wstring text = L"Current model\n";
+    auto state = history.nodeAccounting().measure(g_state);
+    appendMemoryLine(&text, L"Vertices", state.verts.bytes, nodeDetail(state.verts).c_str());
+    appendMemoryLine(&text, L"Faces", state.faces.bytes, nodeDetail(state.faces).c_str());
+    appendMemoryLine(&text, L"Edges", state.edges.bytes, nodeDetail(state.edges).c_str());
+    appendMemoryLine(&text, L"Selection", state.selection.bytes,
+        nodeDetail(state.selection).c_str());
+
+    text += L"\nOther\n";
+    wchar_t detail[64];
+    _swprintf(detail, L"%u states, %u spilled to disk", unsigned(history.numStates()),
+        unsigned(history.numSpilled()));
+    appendMemoryLine(&text, L"Undo", history.memoryUsage(), detail);
+    size_t meshBytes = renderMeshBytes(g_renderMesh);
+    for (const auto &batch : previewBatches)
+        meshBytes += renderMeshBytes(batch);
+    _swprintf(detail, L"%u vertices", unsigned(g_renderMesh.vertices.size()));
+    appendMemoryLine(&text, L"Render mesh", meshBytes, detail);
+    _swprintf(detail, L"%u files", unsigned(g_library.idPaths.size()));
+    appendMemoryLine(&text, L"Library", libraryBytes(g_library), detail);
+
+    // each viewport has its own GL context, so textures are loaded separately for each
+    text += L"\nTextures (GPU)\n";
+    size_t peakImage = mainViewport.peakImageMemory();
+    _swprintf(detail, L"%u textures", unsigned(mainViewport.numTextures()));
+    appendMemoryLine(&text, L"Main", mainViewport.textureMemory(), detail);
+    int viewportNum = 2;
+    for (const auto &viewport : extraViewports) {
+        wchar_t label[32];
+        _swprintf(label, L"Viewport %d", viewportNum++);
+        _swprintf(detail, L"%u textures", unsigned(viewport->numTextures()));
+        appendMemoryLine(&text, label, viewport->textureMemory(), detail);
+        peakImage = std::max(peakImage, viewport->peakImageMemory());
+    }
+    appendMemoryLine(&text, L"Largest image", peakImage, L"decoded, freed after upload");
+    MessageBox(wnd, text.c_str(), L"Memory Report", MB_OK);
+}
+
+void MainWindow::toggleCommandLog() {
+    if (commandLog.recording()) {
+        commandLog.stop();
+        return;
+    }
+    wchar_t logFile[MAX_PATH] = L"";
+    auto filters = L"Command Log (.wlog)\0*.wlog\0All Files\0*.*\0\0";
+    auto saveFile = makeOpenFileName(logFile, wnd, filters, L"wlog");
+    saveFile.lpstrTitle = L"Record Command Log";
+    if (GetSaveFileName(&saveFile))
+        commandLog.start(logFile, filePath, g_state);
+}
+
 bool MainWindow::promptSaveChanges() {
     if (unsavedCount) {
         auto name = (filePath[0] == 0) ? L"Untitled" : PathFindFileName(filePath);
@@ -465,15 +688,33 @@ BOOL MainWindow::onCreate(HWND, LPCREATESTRUCT) {
     x += 70; parts[STATUS_GRID] = x;
     x += 150; parts[STATUS_SELECT] = x;
     x += 150; parts[STATUS_DIMEN] = x;
+    x += 100; parts[STATUS_SAVE] = x;
+    x += 230; parts[STATUS_JOB] = x;
     parts[NUM_STATUS_PARTS - 1] = -1;
     SendMessage(statusWnd, SB_SETPARTS, NUM_STATUS_PARTS, LPARAM(parts));
+
+    recoverSession();
+    resetJournal();
     updateStatus();
 
+    UINT autosaveSeconds = DEFAULT_AUTOSAVE_SECONDS;
+    wchar_t buf[32];
+    if (GetEnvironmentVariable(L"WINGED_AUTOSAVE_SECONDS", buf, _countof(buf))) {
+        auto seconds = _wtoi(buf);
+        if (seconds >= 0)
+            autosaveSeconds = UINT(seconds);
+    }
+    if (autosaveSeconds)
+        SetTimer(wnd, TIMER_AUTOSAVE, autosaveSeconds * 1000, NULL);
+
     return true;
 }
 
 void MainWindow::onClose(HWND) {
     if (promptSaveChanges()) {
+        cancelBackground();
+        finishAutosave();
+        journal.close();
         closeExtraViewports();
         mainViewport.destroy();
         FORWARD_WM_CLOSE(wnd, DefWindowProc);
@@ -484,6 +725,11 @@ void MainWindow::onNCDestroy(HWND) {
     PostQuitMessage(0);
 }
 
+void MainWindow::onTimer(HWND, UINT id) {
+    if (id == TIMER_AUTOSAVE)
+        startAutosave();
+}
+
 void MainWindow::onActivate(HWND, UINT state, HWND, BOOL minimized) {
     if (state && !minimized)
         activeViewport = &mainViewport;
@@ -504,10 +750,13 @@ void MainWindow::onCommand(HWND, int id, HWND ctl, UINT code) {
         return;
 
     try {
+        if (busy() && id != IDM_NEW && id != IDM_OPEN && id != IDM_CLEAR_SELECT)
+            throw winged_error();
         switch (id) {
             /* File */
             case IDM_NEW:
                 if (promptSaveChanges()) {
+                    cancelBackground();
                     g_state = {};
                     mainViewport.view = {};
                     g_library.clear();
@@ -530,6 +779,12 @@ void MainWindow::onCommand(HWND, int id, HWND ctl, UINT code) {
             case IDM_SAVE:
                 save();
                 break;
+            case IDM_COMPRESS_FILE:
+                compressFile ^= true; // applies from the next save
+                break;
+            case IDM_INCREMENTAL_SAVE:
+                incrementalSave ^= true;
+                break;
             case IDM_EXPORT_OBJ: {
                 if (!objFilePath[0] && filePath[0]) {
                     lstrcpy(objFilePath, filePath);
@@ -543,7 +798,81 @@ void MainWindow::onCommand(HWND, int id, HWND ctl, UINT code) {
                 saveFile.lpstrTitle = L"Export OBJ";
                 if (GetSaveFileName(&saveFile)) {
                     lstrcpy(PathFindExtension(mtlFile), L".mtl");
-                    writeObj(narrow(objFilePath), g_state.surf, g_library, narrow(mtlFile), true);
+                    // the job has its own copies, which share structure with the current state
+                    auto path = narrow(objFilePath), mtlName = narrow(mtlFile);
+                    auto surf = g_state.surf;
+                    auto library = g_library;
+                    startJob(L"Exporting OBJ", [=](const ProgressFn &progress) {
+                        try {
+                            writeObj(path, surf, library, mtlName, true, false, progress);
+                        } catch (...) {
+                            DeleteFileA(path.c_str()); // incomplete
+                            throw;
+                        }
+                        return JobResult{};
+                    });
+                }
+                break;
+            }
+            case IDM_EXPORT_GLB: {
+                wchar_t glbFile[MAX_PATH] = L"";
+                if (filePath[0]) {
+                    lstrcpy(glbFile, filePath);
+                    lstrcpy(PathFindExtension(glbFile), L".glb");
+                }
+                auto filters = L"Binary glTF (.glb)\0*.glb\0All Files\0*.*\0\0";
+                auto saveFile = makeOpenFileName(glbFile, wnd, filters, L"glb");
+                saveFile.lpstrTitle = L"Export GLB";
+                if (GetSaveFileName(&saveFile)) {
+                    auto path = narrow(glbFile);
+                    auto surf = g_state.surf;
+                    auto library = g_library;
+                    startJob(L"Exporting GLB", [=](const ProgressFn &progress) {
+                        try {
+                            writeGlb(path, surf, library, progress);
+                        } catch (...) {
+                            DeleteFileA(path.c_str()); // incomplete
+                            throw;
+                        }
+                        return JobResult{};
+                    });
+                }
+                break;
+            }
+            case IDM_MEMORY_REPORT:
+                showMemoryReport();
+                break;
+            case IDM_RECORD_LOG:
+                toggleCommandLog();
+                break;
+            case IDM_SAVE_TRACE: {
+                wchar_t traceFile[MAX_PATH] = L"trace.json";
+                auto filters = L"Chrome Trace (.json)\0*.json\0All Files\0*.*\0\0";
+                auto saveFile = makeOpenFileName(traceFile, wnd, filters, L"json");
+                saveFile.lpstrTitle = L"Save Trace";
+                if (GetSaveFileName(&saveFile))
+                    writeTrace(narrow(traceFile));
+                break;
+            }
+            case IDM_IMPORT_OBJ: {
+                wchar_t importFile[MAX_PATH] = L"";
+                auto filters = L"OBJ file (.obj)\0*.obj\0All Files\0*.*\0\0";
+                if (GetOpenFileName(tempPtr(makeOpenFileName(importFile, wnd, filters, L"obj")))) {
+                    auto path = narrow(importFile);
+                    auto state = g_state;
+                    startJob(L"Importing OBJ", [=](const ProgressFn &progress) {
+                        auto imported = readObj(path, progress);
+                        JobResult result;
+                        result.hasState = true;
+                        result.state = clearSelection(state);
+                        result.state.surf = addSurface(state.surf, imported);
+                        auto selFaces = result.state.selFaces.transient();
+                        for (const auto &pair : imported.faces)
+                            if (pair.second.paint->material != Paint::HOLE_MATERIAL)
+                                selFaces.insert(pair.first);
+                        result.state.selFaces = selFaces.persistent();
+                        return result;
+                    });
                 }
                 break;
             }
@@ -562,9 +891,10 @@ void MainWindow::onCommand(HWND, int id, HWND ctl, UINT code) {
                         g_library.addFile(texId, texFileStr);
                     }
 
-                    EditorState newState = g_state;
-                    newState.surf = assignPaint(g_state.surf, g_state.selFaces, Paint{texId});
-                    pushUndo(std::move(newState));
+                    Action action;
+                    action.type = ACT_ASSIGN_PAINT;
+                    action.material = texId;
+                    perform(action);
                 }
                 break;
             }
@@ -594,19 +924,29 @@ void MainWindow::onCommand(HWND, int id, HWND ctl, UINT code) {
                 break;
             /* Select */
             case IDM_CLEAR_SELECT:
-                g_state = clearSelection(std::move(g_state));
+                if (busy()) { // Esc cancels loading or the running job instead
+                    loader.cancel();
+                    job.cancel();
+                    onJobProgress(job.jobNum());
+                    break;
+                }
+                perform(Action{ACT_COMMAND, id});
                 resetToolState();
                 break;
             case IDM_SEL_ELEMENTS:
+                perform(Action{ACT_COMMAND, id});
                 setSelMode(SEL_ELEMENTS);
                 break;
             case IDM_SEL_SOLIDS:
-                if (g_state.selMode != SEL_SOLIDS) {
-                    g_state = clearSelection(std::move(g_state));
+                if (g_state.selMode != SEL_SOLIDS)
                     g_hover.type = PICK_NONE;
-                }
+                perform(Action{ACT_COMMAND, id});
                 setSelMode(SEL_SOLIDS);
                 break;
+            case IDM_SELECT_LOOP: case IDM_SELECT_RING: case IDM_SELECT_BOUNDARY:
+            case IDM_GROW_SELECT: case IDM_SHRINK_SELECT:
+                perform(Action{ACT_COMMAND, id});
+                break;
 #ifdef CHROMA_DEBUG
             case IDM_EDGE_TWIN:
                 g_state.selEdges = immer::set<edge_id>{}.insert(expectSingleSelEdge().twin);
@@ -629,123 +969,37 @@ void MainWindow::onCommand(HWND, int id, HWND ctl, UINT code) {
                 break;
             }
             /* Edit */
-            case IDM_UNDO:
-                undo();
-                break;
-            case IDM_REDO:
-                if (!redoStack.empty()) {
-                    undoStack.push(g_state);
-                    g_state = redoStack.top();
-                    redoStack.pop();
-                    unsavedCount++;
-                }
-                resetToolState();
-                break;
-            case IDM_TOGGLE_GRID:
-                g_state.gridOn ^= true;
-                break;
-            case IDM_GRID_DOUBLE:
-                g_state.gridSize *= 2;
-                break;
-            case IDM_GRID_HALF:
-                g_state.gridSize /= 2;
+            case IDM_UNDO: case IDM_REDO:
+            case IDM_TOGGLE_GRID: case IDM_GRID_DOUBLE: case IDM_GRID_HALF:
+                perform(Action{ACT_COMMAND, id});
                 break;
             case IDM_DRAW_BKSP:
                 if (!g_drawVerts.empty())
                     g_drawVerts.pop_back();
                 break;
             /* undoable operations... */
-            case IDM_ERASE:
-                pushUndo(erase(g_state));
-                break;
-            /* element */
-            case IDM_EXTRUDE: {
-                EditorState newState = g_state;
-                newState.selVerts = {};
-                newState.selEdges = {};
-                for (const auto &f : g_state.selFaces) {
-                    immer::set_transient<edge_id> extEdges;
-                    for (const auto &e : g_state.selEdges) {
-                        const auto &edge = e.in(newState.surf);
-                        if (edge.face == f)
-                            extEdges.insert(e);
-                        else if (edge.twin.in(newState.surf).face == f)
-                            extEdges.insert(edge.twin);
-                    }
-                    newState.surf = extrudeFace(newState.surf, f, extEdges.persistent());
-                    for (const auto &e : extEdges) {
-                        auto primary = primaryEdge(e.pair(newState.surf));
-                        newState.selEdges = std::move(newState.selEdges).insert(primary);
-                    }
-                }
-                pushUndo(std::move(newState));
-                flashSel();
-                break;
-            }
-            case IDM_SPLIT_LOOP: {
-                auto loop = sortEdgeLoop(g_state.surf, g_state.selEdges);
-                EditorState newState = g_state;
-                newState.surf = splitEdgeLoop(g_state.surf, loop);
-                newState.selVerts = {};
-                newState.selEdges = {};
-                for (const auto &e : loop) {
-                    edge_id primary = primaryEdge(e.pair(newState.surf));
-                    newState.selEdges = std::move(newState.selEdges).insert(primary);
-                }
-                pushUndo(std::move(newState));
-                flashSel();
-                break;
-            }
-            /* solid */
-            case IDM_DUPLICATE: {
-                EditorState newState = g_state;
-                newState.surf = duplicate(g_state.surf,
-                    g_state.selEdges, g_state.selVerts, g_state.selFaces);
-                pushUndo(std::move(newState));
-                break;
-            }
-            case IDM_FLIP_NORMALS: {
-                EditorState newState = g_state;
-                if (g_state.selMode == SEL_SOLIDS && hasSelection(g_state))
-                    newState.surf = flipNormals(g_state.surf, g_state.selEdges, g_state.selVerts);
-                else
-                    newState.surf = flipAllNormals(g_state.surf);
-                pushUndo(std::move(newState));
-                break;
-            }
-            case IDM_SNAP: {
-                EditorState newState = g_state;
-                newState.surf = snapVertices(g_state.surf,
-                    selAttachedVerts(g_state), g_state.gridSize);
-                pushUndo(std::move(newState));
+            case IDM_ERASE: case IDM_EXTRUDE: case IDM_SPLIT_LOOP:
+            case IDM_DUPLICATE: case IDM_FLIP_NORMALS: case IDM_SNAP: case IDM_MARK_HOLE:
+                perform(Action{ACT_COMMAND, id});
                 break;
-            }
             case IDM_TRANSFORM_MATRIX:
                 if (DialogBoxParam(GetModuleHandle(NULL), L"IDD_MATRIX", wnd, matrixDlgProc,
                         LPARAM(&userMatrix)) == IDOK) {
-                    auto verts = selAttachedVerts(g_state);
-                    auto center = vertsCenter(g_state.surf, verts);
-                    EditorState newState = g_state;
-                    newState.surf = transformVertices(g_state.surf, verts, glm::translate(
-                        glm::translate(glm::mat4(1), center) * glm::mat4(userMatrix), -center));
-                    pushUndo(std::move(newState));
+                    Action action;
+                    action.type = ACT_TRANSFORM;
+                    action.mat = userMatrix;
+                    perform(action);
                 }
                 break;
             case IDM_PAINT_MATRIX:
                 if (DialogBoxParam(GetModuleHandle(NULL), L"IDD_MATRIX", wnd, matrixDlgProc,
                         LPARAM(&userPaintMatrix)) == IDOK) {
-                    EditorState newState = g_state;
-                    auto mat = glm::inverse(userPaintMatrix);
-                    newState.surf = transformPaint(g_state.surf, g_state.selFaces, mat);
-                    pushUndo(std::move(newState));
+                    Action action;
+                    action.type = ACT_TRANSFORM_PAINT;
+                    action.mat = userPaintMatrix;
+                    perform(action);
                 }
                 break;
-            case IDM_MARK_HOLE:
-                EditorState newState = g_state;
-                auto paint = Paint{Paint::HOLE_MATERIAL};
-                newState.surf = assignPaint(g_state.surf, g_state.selFaces, paint);
-                pushUndo(std::move(newState));
-                break;
         }
     } catch (winged_error const& err) {
         showError(err);
@@ -762,10 +1016,21 @@ void MainWindow::onInitMenu(HWND, HMENU menu) {
     auto hasSel = hasSelection(g_state);
     auto selElem = (g_state.selMode == SEL_ELEMENTS);
     auto selSolid = (g_state.selMode == SEL_SOLIDS);
-    EnableMenuItem(menu, IDM_CLEAR_SELECT, (hasSel || numDrawPoints() > 0) ?
+    EnableMenuItem(menu, IDM_CLEAR_SELECT, (hasSel || numDrawPoints() > 0 || busy()) ?
+        MF_ENABLED : MF_GRAYED);
+    EnableMenuItem(menu, IDM_SELECT_LOOP, (!g_state.selEdges.empty() && selElem) ?
+        MF_ENABLED : MF_GRAYED);
+    EnableMenuItem(menu, IDM_SELECT_RING, (!g_state.selEdges.empty() && selElem) ?
+        MF_ENABLED : MF_GRAYED);
+    EnableMenuItem(menu, IDM_SELECT_BOUNDARY, (!g_state.selFaces.empty() && selElem) ?
         MF_ENABLED : MF_GRAYED);
-    EnableMenuItem(menu, IDM_UNDO, undoStack.empty() ? MF_GRAYED : MF_ENABLED);
-    EnableMenuItem(menu, IDM_REDO, redoStack.empty() ? MF_GRAYED : MF_ENABLED);
+    EnableMenuItem(menu, IDM_GROW_SELECT, (hasSel && selElem) ? MF_ENABLED : MF_GRAYED);
+    EnableMenuItem(menu, IDM_SHRINK_SELECT, (hasSel && selElem) ? MF_ENABLED : MF_GRAYED);
+    EnableMenuItem(menu, IDM_UNDO, history.canUndo() ? MF_ENABLED : MF_GRAYED);
+    EnableMenuItem(menu, IDM_REDO, history.canRedo() ? MF_ENABLED : MF_GRAYED);
+    CheckMenuItem(menu, IDM_COMPRESS_FILE, compressFile ? MF_CHECKED : MF_UNCHECKED);
+    CheckMenuItem(menu, IDM_INCREMENTAL_SAVE, incrementalSave ? MF_CHECKED : MF_UNCHECKED);
+    CheckMenuItem(menu, IDM_RECORD_LOG, commandLog.recording() ? MF_CHECKED : MF_UNCHECKED);
     CheckMenuItem(menu, IDM_TOGGLE_GRID, g_state.gridOn ? MF_CHECKED : MF_UNCHECKED);
     EnableMenuItem(menu, IDM_ERASE, hasSel ? MF_ENABLED : MF_GRAYED);
     EnableMenuItem(menu, IDM_EXTRUDE, (!g_state.selFaces.empty() && selElem) ?
@@ -816,6 +1081,12 @@ LRESULT MainWindow::handleMessage(UINT msg, WPARAM wParam, LPARAM lParam) {
         HANDLE_MSG(wnd, WM_CREATE, onCreate);
         HANDLE_MSG(wnd, WM_CLOSE, onClose);
         HANDLE_MSG(wnd, WM_NCDESTROY, onNCDestroy);
+        HANDLE_MSG(wnd, WM_TIMER, onTimer);
+        case WM_SAVE_COMPLETE: onSaveComplete(bool(wParam)); return 0;
+        case WM_LOAD_PROGRESS: onLoadProgress(); return 0;
+        case WM_LOAD_COMPLETE: onLoadComplete(lParam); return 0;
+        case WM_JOB_PROGRESS: onJobProgress(lParam); return 0;
+        case WM_JOB_COMPLETE: onJobComplete(lParam); return 0;
         HANDLE_MSG(wnd, WM_ACTIVATE, onActivate);
         HANDLE_MSG(wnd, WM_SIZE, onSize);
         HANDLE_MSG(wnd, WM_COMMAND, onCommand);
@@ -833,6 +1104,7 @@ LRESULT MainWindow::handleMessage(UINT msg, WPARAM wParam, LPARAM lParam) {
 using namespace winged;
 
 int APIENTRY wWinMain(HINSTANCE instance, HINSTANCE, LPWSTR, int showCmd) {
+    initTrace();
     if (!initViewport())
         return 0;
     initImage();
@@ -5,12 +5,18 @@
 #include "common.h"
 
 #include <vector>
-#include <stack>
 #include <memory>
 #include <unordered_set>
 #include "winchroma.h"
 #include "editor.h"
 #include "library.h"
+#include "actions.h"
+#include "cmdlog.h"
+#include "history.h"
+#include "journal.h"
+#include "autosave.h"
+#include "loader.h"
+#include "job.h"
 #include "viewport.h"
 #include "rendermesh.h"
 
@@ -36,10 +42,6 @@ const ToolFlags TOOL_FLAGS[] = {
     /*join*/    TOOLF_ELEMENTS | TOOLF_HOVFACE,
 };
 
-const PickType
-    PICK_WORKPLANE = 0x8,
-    PICK_DRAWVERT = 0x10;
-
 class MainWindow : public chroma::WindowImpl {
     const wchar_t * className() const override { return APP_NAME; }
 
@@ -49,6 +51,11 @@ public:
     void pushUndo();
     void pushUndo(EditorState newState);
     void undo();
+    void redo();
+    // Apply an edit to the current state, and record it if a command log is being recorded.
+    // Returns true if the tool is finished.
+    bool perform(Action action);
+    void recordJournal();
     void updateStatus();
     void invalidateRenderMesh();
     void refreshAll();
@@ -58,12 +65,25 @@ public:
     void showStdException(std::exception const& e);
     bool removeViewport(ViewportWindow *viewport);
     void open(const wchar_t *path);
+    bool loading() const { return loader.busy(); }
+    bool busy() const { return loading() || job.busy(); } // editing is disabled while busy
     bool promptSaveChanges();
 
 private:
-    std::stack<EditorState> undoStack;
-    std::stack<EditorState> redoStack;
+    UndoHistory history;
+    Journal journal;
+    BackgroundSave autosave;
+    BackgroundLoad loader;
+    BackgroundJob job;
+    CommandLog commandLog;
+    std::vector<RenderMesh> previewBatches;
+    int64_t loadStart = 0; // trace time, the span is recorded here since the loader is short-lived
+    int autosaveCount = 0; // unsavedCount when the autosave snapshot was taken
+    bool autosavePending = false;
     int unsavedCount = 0;
+    bool compressFile = false; // save with compressed chunks
+    bool incrementalSave = false; // append changes instead of rewriting the file
+    SavedFile savedFile;
     wchar_t filePath[MAX_PATH] = L"", objFilePath[MAX_PATH] = L"";
 
     glm::mat3 userMatrix = glm::mat3(1);
@@ -78,12 +98,26 @@ private:
     void setTool(Tool tool);
     void closeExtraViewports();
     void resetModel();
+    void resetJournal();
+    void recoverSession();
     bool save();
     bool saveAs();
+    void startAutosave();
+    void finishAutosave();
+    void onSaveComplete(bool success);
+    void onLoadProgress();
+    void onLoadComplete(LPARAM loadNum);
+    void startJob(const wchar_t *name, BackgroundJob::JobFn fn);
+    void onJobProgress(LPARAM jobNum);
+    void onJobComplete(LPARAM jobNum);
+    void cancelBackground();
+    void showMemoryReport();
+    void toggleCommandLog();
 
     BOOL onCreate(HWND, LPCREATESTRUCT);
     void onClose(HWND);
     void onNCDestroy(HWND);
+    void onTimer(HWND, UINT);
     void onActivate(HWND, UINT, HWND, BOOL);
     void onSize(HWND, UINT, int, int);
     void onCommand(HWND, int, HWND, UINT);
@@ -0,0 +1,185 @@
+#include "memusage.h"
+#include <immer/detail/hamts/node.hpp>
+
+// This relies on the internal layout of immer's CHAMP trees (used by map and set): inner nodes have
+// a bitmap of children and a separately allocated (and shared) block of values, and nodes at the
+// maximum depth store hash collisions.
+
+namespace winged {
+
+using immer::detail::hamts::bits_t;
+using immer::detail::hamts::count_t;
+
+template<typename Node>
+struct NodeBits;
+template<typename T, typename Hash, typename Equal, typename MemoryPolicy, bits_t B>
+struct NodeBits<immer::detail::hamts::node<T, Hash, Equal, MemoryPolicy, B>> {
+    static constexpr count_t maxDepth = immer::detail::hamts::max_depth<B>;
+};
+
+bool NodeAccounting::addRef(const void *ptr, size_t bytes, Counter counter) {
+    auto &ref = refs[ptr];
+    ref.bytes = bytes;
+    if ((ref.*counter)++)
+        return false;
+    if (counter == &NodeRef::count) {
+        totalBytes += bytes;
+        if (!ref.refCount)
+            totalUniqueBytes += bytes;
+    } else if (ref.count) {
+        totalUniqueBytes -= bytes; // now shared with the reference state
+    }
+    return true;
+}
+
+bool NodeAccounting::removeRef(const void *ptr, Counter counter) {
+    auto found = refs.find(ptr);
+    if (found == refs.end() || --(found->second.*counter))
+        return false;
+    auto &ref = found->second;
+    if (counter == &NodeRef::count) {
+        totalBytes -= ref.bytes;
+        if (!ref.refCount)
+            totalUniqueBytes -= ref.bytes;
+    } else if (ref.count) {
+        totalUniqueBytes += ref.bytes;
+    }
+    if (!ref.count && !ref.refCount)
+        refs.erase(found);
+    return true;
+}
+
+template<typename Node>
+void NodeAccounting::retainNode(const Node *node, uint32_t depth, Counter counter) {
+    if (depth < NodeBits<Node>::maxDepth) {
+        auto numChildren = immer::detail::hamts::popcount(node->nodemap());
+        auto numValues = immer::detail::hamts::popcount(node->datamap());
+        if (!addRef(node, Node::sizeof_inner_n(numChildren), counter))
+            return; // children are already counted
+        if (numValues)
+            addRef(node->values(), Node::sizeof_values_n(numValues), counter);
+        for (count_t i = 0; i < numChildren; i++)
+            retainNode(node->children()[i], depth + 1, counter);
+    } else {
+        addRef(node, Node::sizeof_collision_n(node->collision_count()), counter);
+    }
+}
+
+template<typename Node>
+void NodeAccounting::releaseNode(const Node *node, uint32_t depth, Counter counter) {
+    if (!removeRef(node, counter))
+        return; // still referenced
+    if (depth < NodeBits<Node>::maxDepth) {
+        auto numChildren = immer::detail::hamts::popcount(node->nodemap());
+        if (immer::detail::hamts::popcount(node->datamap()))
+            removeRef(node->values(), counter);
+        for (count_t i = 0; i < numChildren; i++)
+            releaseNode(node->children()[i], depth + 1, counter);
+    }
+}
+
+void NodeAccounting::retainState(const EditorState &state, Counter counter) {
+    retainNode(state.surf.verts.impl().root, 0, counter);
+    retainNode(state.surf.faces.impl().root, 0, counter);
+    retainNode(state.surf.edges.impl().root, 0, counter);
+    retainNode(state.selVerts.impl().root, 0, counter);
+    retainNode(state.selFaces.impl().root, 0, counter);
+    retainNode(state.selEdges.impl().root, 0, counter);
+}
+
+void NodeAccounting::releaseState(const EditorState &state, Counter counter) {
+    releaseNode(state.surf.verts.impl().root, 0, counter);
+    releaseNode(state.surf.faces.impl().root, 0, counter);
+    releaseNode(state.surf.edges.impl().root, 0, counter);
+    releaseNode(state.selVerts.impl().root, 0, counter);
+    releaseNode(state.selFaces.impl().root, 0, counter);
+    releaseNode(state.selEdges.impl().root, 0, counter);
+}
+
+void NodeAccounting::retain(const EditorState &state) {
+    retainState(state, &NodeRef::count);
+}
+
+void NodeAccounting::release(const EditorState &state) {
+    releaseState(state, &NodeRef::count);
+}
+
+void NodeAccounting::setReference(const EditorState &state) {
+    // retain first, so nodes shared with the previous reference aren't visited
+    retainState(state, &NodeRef::refCount);
+    if (hasReference)
+        releaseState(reference, &NodeRef::refCount);
+    reference = state;
+    hasReference = true;
+}
+
+bool NodeAccounting::measureBlock(const void *ptr, size_t bytes,
+        std::unordered_set<const void *> *seen, NodeMemory *mem) const {
+    if (!seen->insert(ptr).second)
+        return false;
+    mem->bytes += bytes;
+    mem->nodes++;
+    auto found = refs.find(ptr);
+    if (found != refs.end() && found->second.count)
+        mem->sharedBytes += bytes;
+    return true;
+}
+
+template<typename Node>
+void NodeAccounting::measureNode(const Node *node, uint32_t depth,
+        std::unordered_set<const void *> *seen, NodeMemory *mem) const {
+    if (depth < NodeBits<Node>::maxDepth) {
+        auto numChildren = immer::detail::hamts::popcount(node->nodemap());
+        auto numValues = immer::detail::hamts::popcount(node->datamap());
+        if (!measureBlock(node, Node::sizeof_inner_n(numChildren), seen, mem))
+            return;
+        if (numValues)
+            measureBlock(node->values(), Node::sizeof_values_n(numValues), seen, mem);
+        for (count_t i = 0; i < numChildren; i++)
+            measureNode(node->children()[i], depth + 1, seen, mem);
+    } else {
+        measureBlock(node, Node::sizeof_collision_n(node->collision_count()), seen, mem);
+    }
+}
+
+StateMemory NodeAccounting::measure(const EditorState &state) const {
+    StateMemory mem;
+    std::unordered_set<const void *> seen;
+    measureNode(state.surf.verts.impl().root, 0, &seen, &mem.verts);
+    measureNode(state.surf.faces.impl().root, 0, &seen, &mem.faces);
+    measureNode(state.surf.edges.impl().root, 0, &seen, &mem.edges);
+    measureNode(state.selVerts.impl().root, 0, &seen, &mem.selection);
+    measureNode(state.selFaces.impl().root, 0, &seen, &mem.selection);
+    measureNode(state.selEdges.impl().root, 0, &seen, &mem.selection);
+    return mem;
+}
+
+void NodeAccounting::clear() {
+    refs.clear();
+    totalBytes = totalUniqueBytes = 0;
+    reference = {};
+    hasReference = false;
+}
+
+size_t renderMeshBytes(const RenderMesh &mesh) {
+    return (mesh.vertices.capacity() + mesh.normals.capacity()) * sizeof(glm::vec3)
+        + mesh.texCoords.capacity() * sizeof(glm::vec2) + mesh.indices.capacity() * sizeof(index_t)
+        + mesh.faceMeshes.capacity() * sizeof(RenderFaceMesh);
+}
+
+// each entry is a separately allocated node with a next pointer (and cached hash for strings)
+template<typename Map>
+static size_t hashTableBytes(const Map &map) {
+    return map.bucket_count() * sizeof(void *)
+        + map.size() * (sizeof(typename Map::value_type) + sizeof(void *) * 2);
+}
+
+size_t libraryBytes(const Library &library) {
+    size_t bytes = library.rootPath.capacity();
+    bytes += hashTableBytes(library.idPaths) + hashTableBytes(library.pathIds);
+    for (const auto &pair : library.idPaths)
+        bytes += pair.second.capacity() * 2; // stored in both tables
+    return bytes;
+}
+
+} // namespace
@@ -0,0 +1,73 @@
+// Measures the memory held by persistent data structures. Nodes shared between multiple states are
+// only counted once.
+
+#pragma once
+#include "common.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include "editor.h"
+#include "library.h"
+#include "rendermesh.h"
+
+namespace winged {
+
+struct NodeMemory {
+    size_t bytes = 0, nodes = 0;
+    size_t sharedBytes = 0; // part of bytes which is also held by another state
+};
+
+struct StateMemory {
+    NodeMemory verts, faces, edges, selection;
+};
+
+// Reference counts immer nodes reachable from a group of states. Adding or removing a state only
+// visits nodes which aren't shared with the rest of the group. A reference state outside the group
+// (the current model) can also be tracked, to find which nodes only the group keeps alive.
+class NodeAccounting {
+public:
+    void retain(const EditorState &state);
+    void release(const EditorState &state);
+    // Replace the reference state. Only visits nodes which differ from the previous one.
+    void setReference(const EditorState &state);
+    void clear();
+    size_t bytes() const { return totalBytes; }
+    // Part of bytes() not reachable from the reference state
+    size_t uniqueBytes() const { return totalUniqueBytes; }
+    // Nodes of a state which may not be in the group, and which of them are shared with the group
+    StateMemory measure(const EditorState &state) const;
+
+private:
+    struct NodeRef {
+        size_t count, refCount, bytes; // refCount is from the reference state
+    };
+    using Counter = size_t NodeRef::*;
+    std::unordered_map<const void *, NodeRef> refs;
+    size_t totalBytes = 0, totalUniqueBytes = 0;
+    EditorState reference;
+    bool hasReference = false;
+
+    // true if not previously counted by this counter
+    bool addRef(const void *ptr, size_t bytes, Counter counter);
+    bool removeRef(const void *ptr, Counter counter); // true if no longer counted by this counter
+    void retainState(const EditorState &state, Counter counter);
+    void releaseState(const EditorState &state, Counter counter);
+    template<typename Node>
+    void retainNode(const Node *node, uint32_t depth, Counter counter);
+    template<typename Node>
+    void releaseNode(const Node *node, uint32_t depth, Counter counter);
+    bool measureBlock(const void *ptr, size_t bytes, std::unordered_set<const void *> *seen,
+        NodeMemory *mem) const; // false if already seen
+    template<typename Node>
+    void measureNode(const Node *node, uint32_t depth, std::unordered_set<const void *> *seen,
+        NodeMemory *mem) const;
+};
+
+// Allocated capacity of the vectors
+size_t renderMeshBytes(const RenderMesh &mesh);
+// Estimate, including hash table overhead
+size_t libraryBytes(const Library &library);
+
+} // namespace
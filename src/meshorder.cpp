@@ -0,0 +1,197 @@
+#include "meshorder.h"
+#include <algorithm>
+
+namespace winged {
+
+const size_t NO_VERT = size_t(-1);
+
+template<typename Index>
+static float cacheACMR(const Index *indices, size_t count, size_t numVerts, unsigned cacheSize) {
+    if (count < 3)
+        return 0;
+    // a vertex is still in the cache if fewer than cacheSize vertices were added since
+    std::vector<size_t> addedTime(numVerts);
+    size_t time = cacheSize, misses = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (time - addedTime[indices[i]] >= cacheSize) {
+            addedTime[indices[i]] = time++;
+            misses++;
+        }
+    }
+    return float(misses) / float(count / 3);
+}
+
+float vertexCacheACMR(const uint32_t *indices, size_t count, size_t numVerts, unsigned cacheSize) {
+    return cacheACMR(indices, count, numVerts, cacheSize);
+}
+
+float vertexCacheACMR(const uint16_t *indices, size_t count, size_t numVerts, unsigned cacheSize) {
+    return cacheACMR(indices, count, numVerts, cacheSize);
+}
+
+// Emit all remaining triangles around one vertex at a time (a fan), then move to a vertex of those
+// triangles which will still be in the cache after its own fan is emitted. At a dead end, go back
+// to a recently used vertex with triangles left, or else the next one in index order.
+template<typename Index>
+static void tipsify(Index *indices, size_t count, size_t numVerts, unsigned cacheSize) {
+    auto numTris = count / 3;
+    if (!numTris)
+        return;
+    // triangles using each vertex, and how many of them are left
+    std::vector<uint32_t> adjStart(numVerts + 1), adjTris(numTris * 3), live(numVerts);
+    for (size_t i = 0; i < numTris * 3; i++)
+        live[indices[i]]++;
+    for (size_t v = 0; v < numVerts; v++)
+        adjStart[v + 1] = adjStart[v] + live[v];
+    std::vector<uint32_t> adjEnd(adjStart.begin(), adjStart.end() - 1);
+    for (size_t i = 0; i < numTris * 3; i++)
+        adjTris[adjEnd[indices[i]]++] = uint32_t(i / 3);
+
+    std::vector<size_t> cacheTime(numVerts);
+    std::vector<char> emitted(numTris);
+    std::vector<uint32_t> deadEnd, candidates;
+    std::vector<Index> output;
+    output.reserve(numTris * 3);
+    size_t time = cacheSize + 1, nextVert = 0, fan = 0;
+    while (fan != NO_VERT) {
+        candidates.clear();
+        for (auto a = adjStart[fan]; a < adjStart[fan + 1]; a++) {
+            auto tri = adjTris[a];
+            if (emitted[tri])
+                continue;
+            emitted[tri] = true;
+            for (size_t c = 0; c < 3; c++) {
+                auto v = indices[tri * 3 + c];
+                output.push_back(v);
+                deadEnd.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                if (time - cacheTime[v] > cacheSize)
+                    cacheTime[v] = time++;
+            }
+        }
+
+        fan = NO_VERT;
+        size_t bestPriority = 0;
+        for (auto v : candidates) {
+            if (!live[v])
+                continue;
+            size_t priority = 0;
+            if (time - cacheTime[v] + 2 * live[v] <= cacheSize)
+                priority = time - cacheTime[v];
+            if (fan == NO_VERT || priority > bestPriority) {
+                fan = v;
+                bestPriority = priority;
+            }
+        }
+        while (fan == NO_VERT && !deadEnd.empty()) {
+            auto v = deadEnd.back();
+            deadEnd.pop_back();
+            if (live[v])
+                fan = v;
+        }
+        if (fan == NO_VERT) {
+            while (nextVert < numVerts && !live[nextVert])
+                nextVert++;
+            if (nextVert < numVerts)
+                fan = nextVert;
+        }
+    }
+    std::copy(output.begin(), output.end(), indices);
+}
+
+void optimizeVertexCache(uint32_t *indices, size_t count, size_t numVerts, unsigned cacheSize) {
+    tipsify(indices, count, numVerts, cacheSize);
+}
+
+void optimizeVertexCache(uint16_t *indices, size_t count, size_t numVerts, unsigned cacheSize) {
+    tipsify(indices, count, numVerts, cacheSize);
+}
+
+std::vector<uint32_t> optimizeVertexFetch(uint32_t *indices, size_t count, size_t numVerts) {
+    const uint32_t UNUSED = uint32_t(-1);
+    std::vector<uint32_t> newIndices(numVerts, UNUSED), order;
+    for (size_t i = 0; i < count; i++) {
+        auto &newIndex = newIndices[indices[i]];
+        if (newIndex == UNUSED) {
+            newIndex = uint32_t(order.size());
+            order.push_back(indices[i]);
+        }
+        indices[i] = newIndex;
+    }
+    return order;
+}
+
+} // namespace
+
+#ifdef ENTRY_BENCH_MESHORDER
+#include <cstdio>
+#include <map>
+#include <tuple>
+#include "file.h"
+#include "rendermesh.h"
+using namespace winged;
+
+// ACMR of a connected grid of quads, as rendered in the viewport (each face has its own vertices)
+// and as exported (vertices shared between coplanar faces), in the original order and after
+// optimizing
+int main() {
+    initRenderMesh();
+    wchar_t dir[MAX_PATH];
+    GetTempPath(_countof(dir), dir);
+    auto objPath = narrow(std::wstring(dir) + L"winged_bench_grid.obj");
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+
+    wprintf(L"%10s %12s %12s %12s %12s %12s\n", L"faces", L"render", L"optimized",
+        L"shared", L"optimized", L"time (ms)");
+    for (int size = 30; size <= 120; size *= 2) {
+        FILE *obj = fopen(objPath.c_str(), "w");
+        for (int y = 0; y <= size; y++)
+            for (int x = 0; x <= size; x++)
+                fprintf(obj, "v %d %d 0\n", x, y);
+        for (int y = 0; y < size; y++) {
+            for (int x = 0; x < size; x++) {
+                int v = y * (size + 1) + x + 1;
+                fprintf(obj, "f %d %d %d %d\n", v, v + 1, v + size + 2, v + size + 1);
+            }
+        }
+        fclose(obj);
+        EditorState state;
+        state.surf = readObj(objPath);
+        RenderMesh mesh;
+        generateRenderMesh(&mesh, state);
+
+        std::vector<index_t> render;
+        for (const auto &faceMesh : mesh.faceMeshes) {
+            if (faceMesh.material != Paint::HOLE_MATERIAL)
+                render.insert(render.end(), mesh.indices.begin() + ptrdiff_t(faceMesh.range.start),
+                    mesh.indices.begin() + ptrdiff_t(faceMesh.range.start + faceMesh.range.count));
+        }
+        std::map<std::tuple<float, float, float>, uint32_t> welded;
+        std::vector<uint32_t> shared;
+        for (auto i : render) {
+            auto pos = mesh.vertices[i];
+            auto key = std::make_tuple(pos.x, pos.y, pos.z);
+            shared.push_back(welded.insert({key, uint32_t(welded.size())}).first->second);
+        }
+
+        auto renderBefore = vertexCacheACMR(render.data(), render.size(), mesh.vertices.size());
+        optimizeVertexCache(render.data(), render.size(), mesh.vertices.size());
+        auto renderAfter = vertexCacheACMR(render.data(), render.size(), mesh.vertices.size());
+
+        auto sharedBefore = vertexCacheACMR(shared.data(), shared.size(), welded.size());
+        LARGE_INTEGER t0, t1;
+        QueryPerformanceCounter(&t0);
+        optimizeVertexCache(shared.data(), shared.size(), welded.size());
+        optimizeVertexFetch(shared.data(), shared.size(), welded.size());
+        QueryPerformanceCounter(&t1);
+        auto sharedAfter = vertexCacheACMR(shared.data(), shared.size(), welded.size());
+
+        wprintf(L"%10d %12.3f %12.3f %12.3f %12.3f %12.2f\n", size * size,
+            double(renderBefore), double(renderAfter), double(sharedBefore), double(sharedAfter),
+            double(t1.QuadPart - t0.QuadPart) * 1000 / double(freq.QuadPart));
+    }
+    DeleteFileA(objPath.c_str());
+}
+#endif // ENTRY_BENCH_MESHORDER
@@ -0,0 +1,31 @@
+// Triangle and vertex ordering for faster rendering of indexed triangle lists. Triangles are
+// reordered so the GPU's post-transform vertex cache is reused, then vertices are renumbered in
+// order of first use so vertex data is fetched sequentially.
+
+#pragma once
+#include "common.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace winged {
+
+// Typical size of a FIFO post-transform cache
+const unsigned VERTEX_CACHE_SIZE = 16;
+
+// Average cache miss ratio: vertices transformed per triangle, from 0.5 (ideal for large grids) to 3
+float vertexCacheACMR(const uint32_t *indices, size_t count, size_t numVerts,
+    unsigned cacheSize = VERTEX_CACHE_SIZE);
+float vertexCacheACMR(const uint16_t *indices, size_t count, size_t numVerts,
+    unsigned cacheSize = VERTEX_CACHE_SIZE);
+// Reorder triangles in place (Tipsify, Sander et al. 2007), in linear time. Winding is preserved.
+void optimizeVertexCache(uint32_t *indices, size_t count, size_t numVerts,
+    unsigned cacheSize = VERTEX_CACHE_SIZE);
+void optimizeVertexCache(uint16_t *indices, size_t count, size_t numVerts,
+    unsigned cacheSize = VERTEX_CACHE_SIZE);
+// Renumber vertices in order of first use. Returns the old index of each new vertex, vertices
+// which aren't used are left out.
+std::vector<uint32_t> optimizeVertexFetch(uint32_t *indices, size_t count, size_t numVerts);
+
+} // namespace
@@ -1,5 +1,6 @@
 #include "ops.h"
 #include <unordered_map>
+#include <immer/map_transient.hpp>
 #include <glm/common.hpp>
 #ifdef CHROMA_DEBUG
 #include "winchroma.h"
@@ -30,24 +31,24 @@ static void eraseAll(immer::map<K, V> *map, std::initializer_list<K> keys) {
 static std::vector<edge_pair> makeEdgePairs(size_t count) {
     std::vector<edge_pair> edges;
     edges.reserve(count);
-    for (size_t i = 0; i < count; i++)
-        edges.push_back(makeEdgePair());
+    for (const auto &id : genIds(count))
+        edges.push_back({id, HEdge{}});
     return edges;
 }
 
 static std::vector<vert_pair> makeVertPairs(size_t count) {
     std::vector<vert_pair> verts;
     verts.reserve(count);
-    for (size_t i = 0; i < count; i++)
-        verts.push_back(makeVertPair());
+    for (const auto &id : genIds(count))
+        verts.push_back({id, Vertex{}});
     return verts;
 }
 
 static std::vector<face_pair> makeFacePairs(size_t count) {
     std::vector<face_pair> faces;
     faces.reserve(count);
-    for (size_t i = 0; i < count; i++)
-        faces.push_back(makeFacePair());
+    for (const auto &id : genIds(count))
+        faces.push_back({id, Face{}});
     return faces;
 }
 
@@ -428,31 +429,17 @@ Surface mergeFaces(Surface surf, edge_id e) {
     return surf;
 }
 
-Surface extrudeFace(Surface surf, face_id f, const immer::set<edge_id> &extEdges) {
+Surface extrudeFaces(Surface surf, const immer::set<face_id> &faces,
+        const immer::set<edge_id> &extEdges) {
     // ┌────────────┐
     // │╲   side   ╱│
-    // │ ╲        ╱ │ base (previous edges of face)
+    // │ ╲        ╱ │ base (previous edges of region)
     // │  ┌──────┐  │
-    // │  │ face │  │
+    // │  │region│  │
     // │  └──────┘  │
     // │ ╱        ╲ │
     // │╱          ╲│
     // └────────────┘
-    face_pair face = f.pair(surf);
-    std::vector<edge_pair> topEdges, baseTwins;
-    std::vector<vert_pair> baseVerts;
-    for (auto topEdge : FaceEdges(surf, face.second)) {
-        topEdges.push_back(topEdge);
-        baseTwins.push_back(topEdge.second.twin.pair(surf));
-        baseVerts.push_back(topEdge.second.vert.pair(surf));
-    }
-    auto size = topEdges.size();
-    std::vector<edge_pair> baseEdges = makeEdgePairs(size);
-    std::vector<edge_pair> topTwins = makeEdgePairs(size);
-    std::vector<edge_pair> joinEdges = makeEdgePairs(size);
-    std::vector<edge_pair> joinTwins = makeEdgePairs(size);
-    std::vector<vert_pair> topVerts = makeVertPairs(size);
-    std::vector<face_pair> sideFaces = makeFacePairs(size);
     //    topVert│  topEdge  │    │
     //           X───────────┘    │
     //          ╱   topTwin   ╲   │
@@ -461,69 +448,192 @@ Surface extrudeFace(Surface surf, face_id f, const immer::set<edge_id> &extEdges
     //       ╱      baseEdge     ╲│
     //      X─────────────────────┘
     // baseVert     baseTwin
+    // Boundary edges of the region become top edges, and are either extruded or act as a hinge.
+    // Interior edges move with the region. Each connected region with no edges in extEdges is
+    // extruded on all sides.
+    struct BoundaryEdge {
+        edge_id top;
+        size_t region;
+        bool ext;
+        size_t prev, next; // around the region boundary
+        vert_id topVert; // moved copy of the start vertex (unless both sides are hinges)
+        edge_id joinEdge, joinTwin; // at the start vertex
+        edge_id baseEdge, topTwin; // if extruded
+        face_id sideFace; // if extruded
+    };
+    std::unordered_map<face_id, size_t> faceRegions;
+    std::vector<bool> regionHasExt;
+    for (const auto &f : faces) {
+        if (faceRegions.count(f))
+            continue;
+        auto region = regionHasExt.size();
+        regionHasExt.push_back(false);
+        faceRegions[f] = region;
+        std::vector<face_id> toVisit = {f};
+        while (!toVisit.empty()) {
+            auto face = toVisit.back();
+            toVisit.pop_back();
+            for (auto faceEdge : FaceEdges(surf, face.in(surf))) {
+                face_id other = faceEdge.second.twin.in(surf).face;
+                if (faces.count(other) && faceRegions.emplace(other, region).second)
+                    toVisit.push_back(other);
+            }
+        }
+    }
+    std::vector<BoundaryEdge> boundary;
+    std::unordered_map<edge_id, size_t> boundaryIndex;
+    for (const auto &f : faces) {
+        for (auto faceEdge : FaceEdges(surf, f.in(surf))) {
+            edge_id twin = faceEdge.second.twin;
+            if (faces.count(twin.in(surf).face))
+                continue;
+            BoundaryEdge b = {};
+            b.top = faceEdge.first;
+            b.region = faceRegions[f];
+            b.ext = extEdges.count(b.top) || extEdges.count(twin);
+            if (b.ext)
+                regionHasExt[b.region] = true;
+            boundaryIndex[b.top] = boundary.size();
+            boundary.push_back(b);
+        }
+    }
+    bool anyExt = false;
+    for (auto &b : boundary) {
+        if (!regionHasExt[b.region])
+            b.ext = true;
+        anyExt |= b.ext;
+    }
+    if (!anyExt)
+        throw winged_error();
+    for (size_t i = 0; i < boundary.size(); i++) {
+        // rotate around the end vertex through interior edges
+        edge_id out = boundary[i].top.in(surf).next;
+        auto found = boundaryIndex.find(out);
+        while (found == boundaryIndex.end()) {
+            out = out.in(surf).twin.in(surf).next;
+            found = boundaryIndex.find(out);
+        }
+        boundary[i].next = found->second;
+        boundary[found->second].prev = i;
+    }
 
-    for (size_t i = 0, j = size - 1; i < size; j = i++) {
-        auto extrudeEdgeI = extEdges.empty() || extEdges.count(topEdges[i].first);
-        auto extrudeEdgeJ = extEdges.empty() || extEdges.count(topEdges[j].first);
-        if (!extrudeEdgeI && !extrudeEdgeJ)
+    // working copy of modified elements
+    std::unordered_map<edge_id, HEdge> edges;
+    std::unordered_map<vert_id, Vertex> verts;
+    std::vector<face_pair> sideFaces;
+    auto edge = [&](edge_id e) -> HEdge & {
+        auto it = edges.find(e);
+        if (it == edges.end())
+            it = edges.emplace(e, e.in(surf)).first;
+        return it->second;
+    };
+    auto newEdge = [&]() {
+        auto pair = makeEdgePair();
+        edges.insert(pair);
+        return pair.first;
+    };
+    auto link = [&](edge_id prev, edge_id next) {
+        edge(prev).next = next;
+        edge(next).prev = prev;
+    };
+
+    for (auto &b : boundary) {
+        if (b.ext) {
+            b.baseEdge = newEdge();
+            b.topTwin = newEdge();
+            face_pair side = {makeFacePair().first, b.top.in(surf).face.in(surf)}; // copy paint
+            side.second.edge = b.baseEdge;
+            b.sideFace = side.first;
+            sideFaces.push_back(side);
+        }
+        if (b.ext || boundary[b.prev].ext) {
+            b.joinEdge = newEdge();
+            b.joinTwin = newEdge();
+            b.topVert = makeVertPair().first;
+        }
+    }
+
+    for (const auto &b : boundary) {
+        const auto &in = boundary[b.prev];
+        if (!b.ext && !in.ext)
             continue;
+        vert_id baseVert = b.top.in(surf).vert;
+        Vertex topVert = baseVert.in(surf); // copy position
+        topVert.edge = b.joinEdge;
+        verts[b.topVert] = topVert;
+        verts[baseVert] = baseVert.in(surf);
+        verts[baseVert].edge = b.joinTwin;
+        // move region edges leaving this corner
+        for (edge_id e = in.top.in(surf).next; ; e = e.in(surf).twin.in(surf).next) {
+            edge(e).vert = b.topVert;
+            if (e == b.top)
+                break;
+        }
 
-        linkTwins(&joinEdges[i], &joinTwins[i]);
-        if (extrudeEdgeI) {
-            linkTwins(&topEdges[i], &topTwins[i]);
-            linkTwins(&baseEdges[i], &baseTwins[i]);
-            linkNext(&joinEdges[i], &baseEdges[i]);
+        edge(b.joinEdge).twin = b.joinTwin;
+        edge(b.joinTwin).twin = b.joinEdge;
+        edge(b.joinEdge).vert = b.topVert;
+        edge(b.joinTwin).vert = baseVert;
+        if (b.ext) {
+            edge(b.joinEdge).face = b.sideFace;
+            link(b.topTwin, b.joinEdge);
+            link(b.joinEdge, b.baseEdge);
         } else {
-            edge_pair baseTwinNextI = baseTwins[i].second.next.pair(surf);
-            if (baseTwinNextI.first == baseTwins[j].first) throw winged_error(L"Can't extrude!");
-            linkNext(&joinEdges[i], &baseTwinNextI);
-            insertAll(&surf.edges, {baseTwinNextI});
+            edge_id baseTwin = b.top.in(surf).twin;
+            edge_id baseTwinNext = edge(baseTwin).next;
+            if (baseTwinNext == in.top.in(surf).twin) throw winged_error(L"Can't extrude!");
+            edge(b.joinEdge).face = baseTwin.in(surf).face;
+            link(baseTwin, b.joinEdge);
+            link(b.joinEdge, baseTwinNext);
         }
-        if (extrudeEdgeJ) {
-            linkNext(&baseEdges[j], &joinTwins[i]);
+        if (in.ext) {
+            edge(b.joinTwin).face = in.sideFace;
+            link(in.baseEdge, b.joinTwin);
+            link(b.joinTwin, in.topTwin);
         } else {
-            edge_pair baseTwinPrevJ = baseTwins[j].second.prev.pair(surf);
-            if (baseTwinPrevJ.first == baseTwins[i].first) throw winged_error(L"Can't extrude!");
-            linkNext(&baseTwinPrevJ, &joinTwins[i]);
-            insertAll(&surf.edges, {baseTwinPrevJ});
-        }
-        linkNext(extrudeEdgeI ? &topTwins[i] : &baseTwins[i], &joinEdges[i]);
-        linkNext(&joinTwins[i], extrudeEdgeJ ? &topTwins[j] : &baseTwins[j]);
-
-        topVerts[i].second = baseVerts[i].second; // copy position
-        linkVert(&joinEdges[i], &topVerts[i]);
-        linkVert(&joinTwins[i], &baseVerts[i]);
-        topEdges[i].second.vert = topVerts[i].first;
-        topTwins[j].second.vert = topVerts[i].first;
-        baseEdges[i].second.vert = baseVerts[i].first;
-        if (!extrudeEdgeJ) baseTwins[j].second.vert = topVerts[i].first;
-
-        sideFaces[i].second = face.second; // copy paint
-        linkFace(&baseEdges[i], &sideFaces[i]);
-        topTwins[i].second.face = sideFaces[i].first;
-        topEdges[i].second.face = face.first;
-        joinEdges[i].second.face = extrudeEdgeI ? sideFaces[i].first : baseTwins[i].second.face;
-        joinTwins[i].second.face = extrudeEdgeJ ? sideFaces[j].first : baseTwins[j].second.face;
-    }
-
-    face.second.edge = topEdges[0].first;
-    insertAll(&surf.faces, {face});
-    for (size_t i = 0, j = size - 1; i < size; j = i++) {
-        insertAll(&surf.edges, {topEdges[i], baseTwins[i]});
-        insertAll(&surf.verts, {baseVerts[i]});
-        auto extrudeEdgeI = extEdges.empty() || extEdges.count(topEdges[i].first);
-        if (extrudeEdgeI) {
-            insertAll(&surf.edges, {baseEdges[i], topTwins[i]});
-            insertAll(&surf.faces, {sideFaces[i]});
-        }
-        if (extrudeEdgeI || extEdges.count(topEdges[j].first)) {
-            insertAll(&surf.edges, {joinEdges[i], joinTwins[i]});
-            insertAll(&surf.verts, {topVerts[i]});
+            edge_id baseTwin = in.top.in(surf).twin;
+            edge_id baseTwinPrev = edge(baseTwin).prev;
+            if (baseTwinPrev == b.top.in(surf).twin) throw winged_error(L"Can't extrude!");
+            edge(b.joinTwin).face = baseTwin.in(surf).face;
+            link(baseTwinPrev, b.joinTwin);
+            link(b.joinTwin, baseTwin);
+            edge(baseTwin).vert = b.topVert;
         }
     }
+
+    for (const auto &b : boundary) {
+        if (!b.ext)
+            continue;
+        const auto &top = b.top.in(surf);
+        edge(b.baseEdge).twin = top.twin;
+        edge(top.twin).twin = b.baseEdge;
+        edge(b.baseEdge).vert = top.vert;
+        edge(b.baseEdge).face = b.sideFace;
+        edge(b.topTwin).twin = b.top;
+        edge(b.top).twin = b.topTwin;
+        edge(b.topTwin).vert = boundary[b.next].topVert;
+        edge(b.topTwin).face = b.sideFace;
+    }
+
+    auto edgesTrans = surf.edges.transient();
+    for (const auto &pair : edges)
+        edgesTrans.set(pair.first, pair.second);
+    surf.edges = edgesTrans.persistent();
+    auto vertsTrans = surf.verts.transient();
+    for (const auto &pair : verts)
+        vertsTrans.set(pair.first, pair.second);
+    surf.verts = vertsTrans.persistent();
+    auto facesTrans = surf.faces.transient();
+    for (const auto &pair : sideFaces)
+        facesTrans.set(pair.first, pair.second);
+    surf.faces = facesTrans.persistent();
     return surf;
 }
 
+Surface extrudeFace(Surface surf, face_id f, const immer::set<edge_id> &extEdges) {
+    return extrudeFaces(std::move(surf), immer::set<face_id>{}.insert(f), extEdges);
+}
+
 Surface splitEdgeLoop(Surface surf, const std::vector<edge_id> &loop) {
     auto size = loop.size();
     std::vector<edge_pair> newEdges1 = makeEdgePairs(size);
@@ -687,14 +797,16 @@ Surface duplicate(Surface surf, const immer::set<edge_id> &edges,
     std::unordered_map<edge_id, edge_id> edgeMap;
     std::unordered_map<vert_id, vert_id> vertMap;
     std::unordered_map<face_id, face_id> faceMap;
+    auto newIds = genIds(edges.size() * 2 + verts.size() + faces.size());
+    auto nextId = newIds.begin();
     for (const auto &e : edges) {
-        edgeMap[e] = genId();
-        edgeMap[e.in(surf).twin] = genId();
+        edgeMap[e] = *nextId++;
+        edgeMap[e.in(surf).twin] = *nextId++;
     }
     for (const auto &v : verts)
-        vertMap[v] = genId();
+        vertMap[v] = *nextId++;
     for (const auto &f : faces)
-        faceMap[f] = genId();
+        faceMap[f] = *nextId++;
 
     for (const auto &pair : edgeMap) {
         edge_pair edge = {pair.second, pair.first.in(surf)};
@@ -718,6 +830,25 @@ Surface duplicate(Surface surf, const immer::set<edge_id> &edges,
     return surf;
 }
 
+template<typename K, typename V>
+static void insertMap(immer::map<K, V> *map, const immer::map<K, V> &other) {
+    if (map->empty()) {
+        *map = other;
+        return;
+    }
+    auto transient = map->transient();
+    for (const auto &pair : other)
+        transient.insert(pair);
+    *map = transient.persistent();
+}
+
+Surface addSurface(Surface surf, const Surface &other) {
+    insertMap(&surf.faces, other.faces);
+    insertMap(&surf.verts, other.verts);
+    insertMap(&surf.edges, other.edges);
+    return surf;
+}
+
 Surface flipAllNormals(Surface surf) {
     Surface newSurf = surf;
     for (auto edge : surf.edges) {
@@ -751,16 +882,30 @@ Surface flipNormals(Surface surf,
 }
 
 
-#ifndef CHROMA_DEBUG
-void validateSurface(const Surface &) {}
-#else
+#ifdef CHROMA_DEBUG
 void validateSurface(const Surface &surf) {
-    auto tooMany = winged_error(L"Too many geometry errors (see log)");
+    checkSurface(surf);
+}
+#else
+void validateSurface(const Surface &) {}
+#endif
+
+void checkSurface(const Surface &surf) {
+#ifdef CHROMA_DEBUG
+    #define SEE_LOG L" (see log)"
     #define CHECK_VALID(cond, message, ...)     \
         if (!(cond)) {                          \
             LOG_FORMAT(message, __VA_ARGS__);   \
             if (++invalid > 100) throw tooMany; \
         }
+#else
+    #define SEE_LOG L""
+    #define CHECK_VALID(cond, message, ...)     \
+        if (!(cond)) {                          \
+            if (++invalid > 100) throw tooMany; \
+        }
+#endif
+    auto tooMany = winged_error(L"Too many geometry errors" SEE_LOG);
 
     int invalid = 0;
     for (const auto &pair : surf.verts) {
@@ -784,8 +929,10 @@ void validateSurface(const Surface &surf) {
             name(pair), name(pair.second.face));
     }
     if (invalid) {
+#ifdef CHROMA_DEBUG
         LOG("---------");
-        throw winged_error(L"Invalid element IDs (see log)"); // can't do any more checks
+#endif
+        throw winged_error(L"Invalid element IDs" SEE_LOG); // can't do any more checks
     }
 
     for (const auto &pair : surf.verts) {
@@ -838,11 +985,98 @@ void validateSurface(const Surface &surf) {
             name(pair), name(pair.second.vert));
     }
     if (invalid) {
+#ifdef CHROMA_DEBUG
         LOG("---------");
-        throw winged_error(L"Invalid geometry (see log)"); // can't do any more checks
+#endif
+        throw winged_error(L"Invalid geometry" SEE_LOG);
     }
     #undef CHECK_VALID
+    #undef SEE_LOG
 }
-#endif
 
 } // namespace
+
+#ifdef ENTRY_TEST_EXTRUDE
+#include <cstdio>
+#include "actions.h"
+#include "resource.h"
+using namespace winged;
+
+static Surface makeSquare(Surface surf, float x, face_id *face) {
+    tie(surf, *face) = makePolygonPlane(std::move(surf),
+        {{x, 0, 0}, {x + 1, 0, 0}, {x + 1, 1, 0}, {x, 1, 0}});
+    return surf;
+}
+
+// Extrude a square with each of its edges selected. The selection afterwards should be the same
+// edge on top of the extrusion, even when the selected (primary) half-edge was the outside twin.
+static int checkExtrudeSelection() {
+    int failed = 0, outsideTwins = 0;
+    EditorState state;
+    face_id f;
+    state.surf = makeSquare(std::move(state.surf), 0, &f);
+    state.selFaces = immer::set<face_id>{}.insert(f);
+    for (auto faceEdge : FaceEdges(state.surf, f.in(state.surf))) {
+        auto sel = primaryEdge(faceEdge);
+        if (sel != faceEdge.first)
+            outsideTwins++;
+        state.selEdges = immer::set<edge_id>{}.insert(sel);
+        Action action;
+        action.id = IDM_EXTRUDE;
+        auto result = applyAction(state, action);
+        const auto &newSurf = result.state.surf;
+        if (result.state.selEdges.size() != 1) {
+            wprintf(L"FAIL: extrude selected %d edges, expected 1\n",
+                int(result.state.selEdges.size()));
+            failed++;
+            continue;
+        }
+        auto pair = result.state.selEdges.begin()->pair(newSurf);
+        if (!isPrimary(pair) || (pair.second.face != f && pair.second.twin.in(newSurf).face != f)) {
+            wprintf(L"FAIL: selected edge isn't the primary top edge (outside twin: %d)\n",
+                int(sel != faceEdge.first));
+            failed++;
+        }
+    }
+    if (!outsideTwins) {
+        wprintf(L"FAIL: no edge with its outside twin selected, change the seed\n");
+        failed++;
+    }
+    return failed;
+}
+
+// Two separate regions are selected, and only the first has a selected edge. The first should
+// have one side face, and the second should be extruded on all sides.
+int main() {
+    seedIds(1);
+    Surface surf;
+    face_id f1, f2;
+    surf = makeSquare(std::move(surf), 0, &f1);
+    surf = makeSquare(std::move(surf), 2, &f2);
+    auto faces = immer::set<face_id>{}.insert(f1).insert(f2);
+    auto numFaces = surf.faces.size();
+    int failed = 0;
+
+    auto partial = extrudeFaces(surf, faces, immer::set<edge_id>{}.insert(f1.in(surf).edge));
+    checkSurface(partial);
+    if (partial.faces.size() != numFaces + 1 + 4) {
+        wprintf(L"FAIL: one selected edge made %d side faces, expected 5\n",
+            int(partial.faces.size() - numFaces));
+        failed++;
+    }
+    auto all = extrudeFaces(surf, faces, {});
+    checkSurface(all);
+    if (all.faces.size() != numFaces + 8) {
+        wprintf(L"FAIL: no selected edges made %d side faces, expected 8\n",
+            int(all.faces.size() - numFaces));
+        failed++;
+    }
+    failed += checkExtrudeSelection();
+    if (failed) {
+        wprintf(L"%d failed\n", failed);
+        return 1;
+    }
+    wprintf(L"OK\n");
+    return 0;
+}
+#endif // ENTRY_TEST_EXTRUDE
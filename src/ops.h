@@ -32,6 +32,10 @@ tuple<Surface, edge_id> splitFace(Surface surf, edge_id e1, edge_id e2,
 Surface mergeFaces(Surface surf, edge_id e);
 // Creates new quad faces for each side of the given face
 Surface extrudeFace(Surface surf, face_id f, const immer::set<edge_id> &extEdges);
+// Creates new quad faces around the boundary of a region of faces, which move together. If extEdges
+// is not empty, only those boundary edges (in either direction) are extruded.
+Surface extrudeFaces(Surface surf, const immer::set<face_id> &faces,
+    const immer::set<edge_id> &extEdges);
 // Create a pair of opposing faces from the edge loop
 Surface splitEdgeLoop(Surface surf, const std::vector<edge_id> &loop);
 // Join two faces into a single edge loop
@@ -47,10 +51,15 @@ Surface transformPaint(Surface surf, const immer::set<face_id> &faces, const glm
 
 Surface duplicate(Surface surf, const immer::set<edge_id> &edges, 
     const immer::set<vert_id> &verts, const immer::set<face_id> &faces);
+// Add all elements of other, which must not share any IDs with surf
+Surface addSurface(Surface surf, const Surface &other);
 Surface flipAllNormals(Surface surf);
 Surface flipNormals(Surface surf,
     const immer::set<edge_id> &edges, const immer::set<vert_id> &verts);
 
-void validateSurface(const Surface &surf); // debug builds only
+// Throws winged_error if the half-edge structure is inconsistent. Details are logged in debug
+// builds.
+void checkSurface(const Surface &surf);
+void validateSurface(const Surface &surf); // checkSurface in debug builds only, for assertions
 
 } // namespace
@@ -0,0 +1,336 @@
+#include "parallel.h"
+#include <climits>
+#include <deque>
+#include <memory>
+#include <algorithm>
+
+namespace winged {
+
+const unsigned MAX_WORKERS = MAXIMUM_WAIT_OBJECTS;
+
+struct PoolTask {
+    std::function<void()> fn;
+    TaskGroup *group;
+
+    void run();
+};
+
+// The owner takes its newest task, so nested tasks finish depth first. Other threads take the
+// oldest, which is likely to be the largest piece of work.
+struct TaskQueue {
+    CRITICAL_SECTION lock;
+    std::deque<PoolTask *> tasks;
+
+    TaskQueue() { InitializeCriticalSection(&lock); }
+    ~TaskQueue() { DeleteCriticalSection(&lock); }
+
+    void push(PoolTask *task) {
+        EnterCriticalSection(&lock);
+        tasks.push_back(task);
+        LeaveCriticalSection(&lock);
+    }
+
+    // only take tasks of the group if not null
+    PoolTask * takeNewest(const TaskGroup *group) {
+        PoolTask *task = nullptr;
+        EnterCriticalSection(&lock);
+        for (auto it = tasks.end(); it != tasks.begin();) {
+            --it;
+            if (!group || (*it)->group == group) {
+                task = *it;
+                tasks.erase(it);
+                break;
+            }
+        }
+        LeaveCriticalSection(&lock);
+        return task;
+    }
+
+    PoolTask * takeOldest() {
+        PoolTask *task = nullptr;
+        EnterCriticalSection(&lock);
+        if (!tasks.empty()) {
+            task = tasks.front();
+            tasks.pop_front();
+        }
+        LeaveCriticalSection(&lock);
+        return task;
+    }
+};
+
+// Started on first use and never destroyed, worker threads end with the process
+struct ThreadPool {
+    size_t numQueues; // queue 0 is shared by threads outside the pool, then one for each worker
+    std::unique_ptr<TaskQueue[]> queues;
+    HANDLE wakeSemaphore; // released for each task added
+    DWORD queueTls; // index of the current thread's queue
+};
+
+static ThreadPool *g_pool = nullptr;
+static volatile LONG g_poolState = 0; // 0 = not started, 1 = starting, 2 = running
+static volatile LONG g_maxWorkers = 0;
+
+static unsigned hardwareThreads() {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return std::max(1u, std::min(unsigned(info.dwNumberOfProcessors), MAX_WORKERS));
+}
+
+unsigned numWorkers() {
+    auto limit = unsigned(g_maxWorkers);
+    return limit ? std::min(limit, hardwareThreads()) : hardwareThreads();
+}
+
+void setMaxWorkers(unsigned count) {
+    InterlockedExchange(&g_maxWorkers, LONG(count));
+}
+
+static size_t currentQueue() {
+    return size_t(TlsGetValue(g_pool->queueTls));
+}
+
+static PoolTask * findTask(size_t queue, const TaskGroup *group) {
+    if (queue == 0)
+        return g_pool->queues[0].takeNewest(group);
+    if (auto task = g_pool->queues[queue].takeNewest(nullptr))
+        return task;
+    if (auto task = g_pool->queues[0].takeOldest())
+        return task;
+    auto numWorkerQueues = g_pool->numQueues - 1;
+    for (size_t i = 1; i < numWorkerQueues; i++) {
+        auto victim = (queue - 1 + i) % numWorkerQueues + 1;
+        if (auto task = g_pool->queues[victim].takeOldest())
+            return task;
+    }
+    return nullptr;
+}
+
+static DWORD WINAPI workerThreadProc(LPVOID param) {
+    TlsSetValue(g_pool->queueTls, param);
+    auto queue = size_t(param);
+    while (true) {
+        if (auto task = findTask(queue, nullptr))
+            task->run();
+        else
+            WaitForSingleObject(g_pool->wakeSemaphore, INFINITE);
+    }
+}
+
+static ThreadPool * startPool() {
+    if (g_poolState == 2)
+        return g_pool;
+    if (InterlockedCompareExchange(&g_poolState, 1, 0) == 0) {
+        // the thread which waits also runs tasks, but postWhenDone needs at least one worker
+        auto numThreads = std::max(hardwareThreads() - 1, 1u);
+        g_pool = new ThreadPool{numThreads + 1, std::unique_ptr<TaskQueue[]>(
+            new TaskQueue[numThreads + 1]), CreateSemaphore(NULL, 0, LONG_MAX, NULL), TlsAlloc()};
+        for (size_t i = 1; i <= numThreads; i++) {
+            if (auto thread = CreateThread(NULL, 0, workerThreadProc, void_p(i), 0, NULL))
+                CloseHandle(thread);
+            else
+                break; // tasks in queue 0 will still run on the waiting threads
+        }
+        InterlockedExchange(&g_poolState, 2);
+    } else {
+        while (g_poolState != 2)
+            SwitchToThread();
+    }
+    return g_pool;
+}
+
+void PoolTask::run() {
+    std::exception_ptr error;
+    if (!group->canceled()) {
+        try {
+            fn();
+        } catch (...) {
+            error = std::current_exception();
+        }
+    }
+    auto taskGroup = group;
+    delete this;
+    taskGroup->finishTask(error);
+}
+
+TaskGroup::TaskGroup(const CancelToken *token)
+    : cancel(token), doneEvent(CreateEvent(NULL, true, true, NULL)) {
+    InitializeCriticalSection(&notifyLock);
+}
+
+TaskGroup::~TaskGroup() {
+    helpUntilDone();
+    while (finishing)
+        SwitchToThread();
+    MemoryBarrier();
+    DeleteCriticalSection(&notifyLock);
+    CloseHandle(doneEvent);
+}
+
+void TaskGroup::run(std::function<void()> fn) {
+    auto pool = startPool();
+    if (InterlockedIncrement(&pending) == 1)
+        ResetEvent(doneEvent);
+    pool->queues[currentQueue()].push(new PoolTask{std::move(fn), this});
+    ReleaseSemaphore(pool->wakeSemaphore, 1, NULL);
+}
+
+void TaskGroup::finishTask(std::exception_ptr error) {
+    InterlockedIncrement(&finishing);
+    if (error && !InterlockedExchange(&failed, true))
+        firstError = error;
+    if (InterlockedDecrement(&pending) == 0) {
+        EnterCriticalSection(&notifyLock);
+        auto wnd = notifyWnd;
+        auto msg = notifyMsg;
+        auto wParam = notifyWParam;
+        auto lParam = notifyLParam;
+        notifyWnd = NULL;
+        LeaveCriticalSection(&notifyLock);
+        if (wnd)
+            PostMessage(wnd, msg, wParam, lParam);
+        SetEvent(doneEvent);
+    }
+    InterlockedDecrement(&finishing); // the group may be destroyed after this
+}
+
+void TaskGroup::helpUntilDone() {
+    if (!pending)
+        return;
+    auto queue = currentQueue();
+    while (pending) {
+        if (auto task = findTask(queue, this)) {
+            task->run();
+        } else if (queue == 0) {
+            // remaining tasks of this group are running or in worker queues
+            WaitForSingleObject(doneEvent, INFINITE);
+            // tasks were added after the last one finished, but before the event was set
+            if (pending)
+                ResetEvent(doneEvent);
+        } else {
+            // a worker can run other tasks which are added later
+            WaitForSingleObject(doneEvent, 1);
+        }
+    }
+    MemoryBarrier(); // results of the tasks are visible after this
+}
+
+void TaskGroup::wait() {
+    helpUntilDone();
+    if (firstError) {
+        auto error = firstError;
+        firstError = nullptr;
+        failed = false;
+        std::rethrow_exception(error);
+    }
+}
+
+void TaskGroup::postWhenDone(HWND wnd, UINT msg, WPARAM wParam, LPARAM lParam) {
+    EnterCriticalSection(&notifyLock);
+    bool now = !pending;
+    if (!now) {
+        notifyWnd = wnd;
+        notifyMsg = msg;
+        notifyWParam = wParam;
+        notifyLParam = lParam;
+    }
+    LeaveCriticalSection(&notifyLock);
+    if (now)
+        PostMessage(wnd, msg, wParam, lParam);
+}
+
+void parallelFor(size_t count, size_t minBatch, const std::function<void(size_t, size_t)> &fn,
+        const CancelToken *cancel) {
+    if (count == 0)
+        return;
+    auto numTasks = std::min(size_t(numWorkers()), std::max(count / std::max(minBatch, size_t(1)),
+        size_t(1)));
+    if (numTasks == 1) {
+        if (!cancel || !cancel->canceled())
+            fn(0, count);
+        return;
+    }
+    TaskGroup group(cancel);
+    for (size_t i = 0; i < numTasks; i++) {
+        auto begin = count * i / numTasks, end = count * (i + 1) / numTasks;
+        group.run([&fn, begin, end]() { fn(begin, end); });
+    }
+    group.wait();
+}
+
+} // namespace
+
+#ifdef ENTRY_BENCH_PARALLEL
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include "file.h"
+#include "rendermesh.h"
+#include "strutil.h"
+using namespace winged;
+
+static double elapsedMs(LARGE_INTEGER start, LARGE_INTEGER end) {
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    return double(end.QuadPart - start.QuadPart) * 1000 / double(freq.QuadPart);
+}
+
+// Render mesh build time of a grid of hexagons (so faces aren't trivial to tesselate) with 1 to
+// all threads, and the overhead of an empty parallelFor
+int main() {
+    initRenderMesh();
+    wchar_t dir[MAX_PATH];
+    GetTempPath(_countof(dir), dir);
+    auto objPath = narrow(std::wstring(dir) + L"winged_bench_hex.obj");
+    auto maxWorkers = numWorkers();
+
+    wprintf(L"%10s %8s %12s %10s\n", L"faces", L"threads", L"time (ms)", L"speedup");
+    for (int size = 100; size <= 400; size *= 2) {
+        FILE *obj = fopen(objPath.c_str(), "w");
+        int numVerts = 0;
+        for (int y = 0; y < size; y++) {
+            for (int x = 0; x < size; x++) {
+                for (int i = 0; i < 6; i++) {
+                    auto angle = double(i) * 3.14159265358979 / 3;
+                    fprintf(obj, "v %f %f 0\n", x * 2 + (y % 2) + cos(angle) * 0.9,
+                        y * 1.8 + sin(angle) * 0.9);
+                }
+                fprintf(obj, "f %d %d %d %d %d %d\n", numVerts + 1, numVerts + 2, numVerts + 3,
+                    numVerts + 4, numVerts + 5, numVerts + 6);
+                numVerts += 6;
+            }
+        }
+        fclose(obj);
+        EditorState state;
+        state.surf = readObj(objPath);
+        RenderMesh mesh;
+
+        double oneThreadMs = 0;
+        for (unsigned workers = 1;; workers = std::min(workers * 2, maxWorkers)) {
+            setMaxWorkers(workers);
+            double best = INFINITY;
+            for (int run = 0; run < 5; run++) {
+                LARGE_INTEGER start, end;
+                QueryPerformanceCounter(&start);
+                generateRenderMesh(&mesh, state);
+                QueryPerformanceCounter(&end);
+                best = std::min(best, elapsedMs(start, end));
+            }
+            if (workers == 1)
+                oneThreadMs = best;
+            wprintf(L"%10d %8u %12.2f %10.2f\n", size * size, workers, best, oneThreadMs / best);
+            if (workers == maxWorkers)
+                break;
+        }
+    }
+    setMaxWorkers(0);
+    DeleteFileA(objPath.c_str());
+
+    const int CALLS = 10000;
+    LARGE_INTEGER start, end;
+    QueryPerformanceCounter(&start);
+    for (int i = 0; i < CALLS; i++)
+        parallelFor(maxWorkers, 1, [](size_t, size_t) {});
+    QueryPerformanceCounter(&end);
+    wprintf(L"\nparallelFor overhead: %.2f us\n", elapsedMs(start, end) * 1000 / CALLS);
+}
+#endif // ENTRY_BENCH_PARALLEL
@@ -0,0 +1,77 @@
+// Fork-join parallelism on a shared pool of Win32 threads. Each worker has its own queue of tasks
+// and takes tasks from the other queues when it runs out (work stealing). Threads which wait for
+// tasks run queued tasks in the meantime, so tasks can wait for other tasks.
+
+#pragma once
+#include "common.h"
+
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include "winchroma.h"
+
+namespace winged {
+
+// Number of threads used by parallelFor, including the calling thread
+unsigned numWorkers();
+// Limit numWorkers() to measure scaling, 0 for no limit
+void setMaxWorkers(unsigned count);
+
+// Set from any thread to ask tasks to stop early
+class CancelToken {
+public:
+    void cancel() { InterlockedExchange(&flag, true); }
+    void reset() { InterlockedExchange(&flag, false); }
+    bool canceled() const { return flag != 0; }
+
+private:
+    volatile LONG flag = false;
+};
+
+// Tasks which are waited for together. Tasks can be added by the thread which created the group,
+// or by its own tasks.
+class TaskGroup {
+public:
+    // Tasks which haven't started when the token is canceled are skipped
+    explicit TaskGroup(const CancelToken *cancel = nullptr);
+    ~TaskGroup(); // waits for tasks, ignoring errors
+    TaskGroup(const TaskGroup &) = delete;
+    TaskGroup & operator=(const TaskGroup &) = delete;
+
+    void run(std::function<void()> fn);
+    // Run this group's tasks on the calling thread until all have finished. If any task threw, the
+    // first exception is rethrown.
+    void wait();
+    // Instead of waiting, post a message to the window when all tasks have finished (immediately if
+    // they already have). Then check error() and destroy the group.
+    void postWhenDone(HWND wnd, UINT msg, WPARAM wParam, LPARAM lParam);
+    bool done() const { return pending == 0; }
+    bool canceled() const { return cancel && cancel->canceled(); }
+    std::exception_ptr error() const { return firstError; } // valid when done
+
+private:
+    const CancelToken *cancel;
+    volatile LONG pending = 0;
+    volatile LONG finishing = 0; // threads in finishTask, which may still use the group
+    volatile LONG failed = false;
+    std::exception_ptr firstError;
+    HANDLE doneEvent;
+    CRITICAL_SECTION notifyLock;
+    HWND notifyWnd = NULL;
+    UINT notifyMsg = 0;
+    WPARAM notifyWParam = 0;
+    LPARAM notifyLParam = 0;
+
+    friend struct PoolTask;
+    void finishTask(std::exception_ptr error);
+    void helpUntilDone();
+};
+
+// Call fn(begin, end) on contiguous ranges which together cover [0, count), in parallel, and wait
+// for all to finish. Ranges have at least minBatch elements. If any call throws, the first
+// exception is rethrown after all have finished. Ranges which haven't started when cancel is set
+// are skipped, so check the token afterwards.
+void parallelFor(size_t count, size_t minBatch, const std::function<void(size_t, size_t)> &fn,
+    const CancelToken *cancel = nullptr);
+
+} // namespace
@@ -1,13 +1,19 @@
 #include "rendermesh.h"
+#include <algorithm>
 #include <memory>
 #include <unordered_map>
 #include "winchroma.h" // required for GLU
 #include <GL/glu.h>
 #include <glm/gtc/type_ptr.hpp>
 #include "main.h"
+#include "parallel.h"
+#include "trace.h"
 
 namespace winged {
 
+// faces per task when tesselating on multiple threads
+const size_t TESSELATE_BATCH = 2048;
+
 struct FaceTessState {
     std::vector<index_t> *indices;
     GLenum mode;
@@ -46,36 +52,57 @@ static void CALLBACK tessErrorCallback(GLenum error, void *data) {
     reinterpret_cast<FaceTessState *>(data)->error = error;
 }
 
-bool tesselateFace(std::vector<index_t> &faceIsOut, const Surface &surf, const Face &face,
-        glm::vec3 normal, index_t vertI) {
+static bool tesselate(GLUtesselator *tess, std::vector<index_t> &faceIsOut, const Surface &surf,
+        const Face &face, glm::vec3 normal, index_t vertI) {
     // https://www.glprogramming.com/red/chapter11.html
     auto initialSize = faceIsOut.size();
     FaceTessState state;
     state.indices = &faceIsOut;
-    gluTessNormal(g_tess, normal.x, normal.y, normal.z);
-    gluTessBeginPolygon(g_tess, &state);
-    gluTessBeginContour(g_tess);
+    gluTessNormal(tess, normal.x, normal.y, normal.z);
+    gluTessBeginPolygon(tess, &state);
+    gluTessBeginContour(tess);
     for (auto ep : FaceEdges(surf, face)) {
         glm::dvec3 dPos = ep.second.vert.in(surf).pos;
-        gluTessVertex(g_tess, glm::value_ptr(dPos), void_p(size_t(vertI++)));
+        gluTessVertex(tess, glm::value_ptr(dPos), void_p(size_t(vertI++)));
     }
-    gluTessEndContour(g_tess);
-    gluTessEndPolygon(g_tess);
+    gluTessEndContour(tess);
+    gluTessEndPolygon(tess);
 
     if (state.error)
         faceIsOut.erase(faceIsOut.begin() + initialSize, faceIsOut.end());
     return !state.error;
 }
 
-void initRenderMesh() {
-    g_tess = gluNewTess();
+bool tesselateFace(std::vector<index_t> &faceIsOut, const Surface &surf, const Face &face,
+        glm::vec3 normal, index_t vertI) {
+    return tesselate(g_tess, faceIsOut, surf, face, normal, vertI);
+}
+
+static GLUtesselator * newTesselator() {
+    auto tess = gluNewTess();
     using callback_fn_t = GLvoid (CALLBACK*) ();
-    gluTessCallback(g_tess, GLU_TESS_BEGIN_DATA, callback_fn_t(tessBeginCallback));
-    // gluTessCallback(g_tess, GLU_TESS_END, callback_fn_t(tessEndCallback));
-    gluTessCallback(g_tess, GLU_TESS_VERTEX_DATA, callback_fn_t(tessVertexCallback));
-    gluTessCallback(g_tess, GLU_TESS_ERROR_DATA, callback_fn_t(tessErrorCallback));
-    // gluTessCallback(g_tess, GLU_TESS_COMBINE_DATA, callback_fn_t(tessCombineCallback));
-    // gluTessCallback(g_tess, GLU_TESS_EDGE_FLAG_DATA, callback_fn_t(tessEdgeFlagCallback));
+    gluTessCallback(tess, GLU_TESS_BEGIN_DATA, callback_fn_t(tessBeginCallback));
+    // gluTessCallback(tess, GLU_TESS_END, callback_fn_t(tessEndCallback));
+    gluTessCallback(tess, GLU_TESS_VERTEX_DATA, callback_fn_t(tessVertexCallback));
+    gluTessCallback(tess, GLU_TESS_ERROR_DATA, callback_fn_t(tessErrorCallback));
+    // gluTessCallback(tess, GLU_TESS_COMBINE_DATA, callback_fn_t(tessCombineCallback));
+    // gluTessCallback(tess, GLU_TESS_EDGE_FLAG_DATA, callback_fn_t(tessEdgeFlagCallback));
+    return tess;
+}
+
+void initRenderMesh() {
+    g_tess = newTesselator();
+}
+
+FaceTesselator::FaceTesselator() : tess(newTesselator()) {}
+
+FaceTesselator::~FaceTesselator() {
+    gluDeleteTess(tess);
+}
+
+bool FaceTesselator::tesselate(std::vector<index_t> &faceIsOut, const Surface &surf,
+        const Face &face, glm::vec3 normal, index_t startIndex) {
+    return winged::tesselate(tess, faceIsOut, surf, face, normal, startIndex);
 }
 
 void RenderMesh::clear() {
@@ -88,18 +115,46 @@ void RenderMesh::clear() {
     faceMeshes.clear();
 }
 
+// Results are in the same order as the faces, on any number of threads
+static void tesselateFaces(RenderMesh *mesh, std::vector<Face> &errFacesOut,
+        const std::unordered_map<edge_id, index_t> &edgeIDIndices, const std::vector<Face> &faces,
+        const Surface &surf) {
+    auto numChunks = (faces.size() + TESSELATE_BATCH - 1) / TESSELATE_BATCH;
+    if (numChunks <= 1 || numWorkers() == 1) {
+        for (const auto &face : faces) {
+            auto normal = mesh->normals[edgeIDIndices.at(face.edge)];
+            auto startI = edgeIDIndices.at(face.edge);
+            if (!tesselateFace(mesh->indices, surf, face, normal, startI))
+                errFacesOut.push_back(face);
+        }
+        return;
+    }
+    std::vector<std::vector<index_t>> chunkIndices(numChunks);
+    std::vector<std::vector<Face>> chunkErrFaces(numChunks);
+    parallelFor(numChunks, 1, [&](size_t begin, size_t end) {
+        FaceTesselator tess;
+        for (size_t c = begin; c < end; c++) {
+            auto chunkEnd = std::min(faces.size(), (c + 1) * TESSELATE_BATCH);
+            for (size_t f = c * TESSELATE_BATCH; f < chunkEnd; f++) {
+                auto startI = edgeIDIndices.at(faces[f].edge);
+                if (!tess.tesselate(chunkIndices[c], surf, faces[f], mesh->normals[startI], startI))
+                    chunkErrFaces[c].push_back(faces[f]);
+            }
+        }
+    });
+    for (size_t c = 0; c < numChunks; c++) {
+        mesh->indices.insert(mesh->indices.end(), chunkIndices[c].begin(), chunkIndices[c].end());
+        errFacesOut.insert(errFacesOut.end(), chunkErrFaces[c].begin(), chunkErrFaces[c].end());
+    }
+}
+
 void insertFaces(RenderMesh *mesh, std::vector<Face> &errFacesOut,
         const std::unordered_map<edge_id, index_t> &edgeIDIndices,
         const std::unordered_map<id_t, std::vector<Face>> &matFaces, const Surface &surf,
         RenderFaceMesh::State state) {
     for (const auto &pair : matFaces) {
         IndexRange range = {mesh->indices.size(), 0};
-        for (const auto &face : pair.second) {
-            auto normal = mesh->normals[edgeIDIndices.at(face.edge)];
-            auto startI = edgeIDIndices.at(face.edge);
-            if (!tesselateFace(mesh->indices, surf, face, normal, startI))
-                errFacesOut.push_back(face);
-        }
+        tesselateFaces(mesh, errFacesOut, edgeIDIndices, pair.second, surf);
         range.count = mesh->indices.size() - range.start;
         auto faceMesh = RenderFaceMesh{pair.first, range, state};
         mesh->faceMeshes.push_back(faceMesh);
@@ -107,6 +162,8 @@ void insertFaces(RenderMesh *mesh, std::vector<Face> &errFacesOut,
 }
 
 void generateRenderMesh(RenderMesh *mesh, const EditorState &state) {
+    TraceScope trace("generateRenderMesh");
+    trace.counter("faces", int64_t(state.surf.faces.size()));
     mesh->clear();
 
     std::unordered_map<edge_id, index_t> edgeIDIndices;
@@ -266,6 +323,47 @@ void generateRenderMesh(RenderMesh *mesh, const EditorState &state) {
         }
     }
     mesh->ranges[ELEM_ERR_FACE].count = mesh->indices.size() - mesh->ranges[ELEM_ERR_FACE].start;
+    trace.counter("vertices", int64_t(mesh->vertices.size()));
+    trace.counter("indices", int64_t(mesh->indices.size()));
+}
+
+void mergeRenderMeshes(RenderMesh *mesh, const std::vector<RenderMesh> &parts) {
+    mesh->clear();
+    size_t numParts = 0;
+    for (const auto &part : parts) {
+        if (mesh->vertices.size() + part.vertices.size() > size_t(index_t(-1)) + 1)
+            break;
+        mesh->vertices.insert(mesh->vertices.end(), part.vertices.begin(), part.vertices.end());
+        mesh->normals.insert(mesh->normals.end(), part.normals.begin(), part.normals.end());
+        mesh->texCoords.insert(mesh->texCoords.end(), part.texCoords.begin(), part.texCoords.end());
+        numParts++;
+    }
+
+    size_t startI = 0;
+    for (size_t p = 0; p < numParts; p++) {
+        auto range = parts[p].ranges[ELEM_REG_EDGE];
+        for (size_t i = range.start; i < range.start + range.count; i++)
+            mesh->indices.push_back(index_t(startI + parts[p].indices[i]));
+        startI += parts[p].vertices.size();
+    }
+    mesh->ranges[ELEM_REG_EDGE] = {0, mesh->indices.size()};
+
+    std::unordered_map<id_t, std::vector<index_t>> matIndices;
+    startI = 0;
+    for (size_t p = 0; p < numParts; p++) {
+        for (const auto &faceMesh : parts[p].faceMeshes) {
+            auto &indices = matIndices[faceMesh.material];
+            auto range = faceMesh.range;
+            for (size_t i = range.start; i < range.start + range.count; i++)
+                indices.push_back(index_t(startI + parts[p].indices[i]));
+        }
+        startI += parts[p].vertices.size();
+    }
+    for (const auto &pair : matIndices) {
+        mesh->faceMeshes.push_back({pair.first, {mesh->indices.size(), pair.second.size()},
+            RenderFaceMesh::REG});
+        mesh->indices.insert(mesh->indices.end(), pair.second.begin(), pair.second.end());
+    }
 }
 
 } // namespace
@@ -7,6 +7,8 @@
 #include "editor.h"
 #include <vector>
 
+struct GLUtesselator;
+
 namespace winged {
 
 using index_t = unsigned short; // GLushort
@@ -41,7 +43,24 @@ struct RenderMesh {
 
 void initRenderMesh();
 void generateRenderMesh(RenderMesh *mesh, const EditorState &state);
+// Combine meshes which only have edges and regular faces, as many as index_t can address
+void mergeRenderMeshes(RenderMesh *mesh, const std::vector<RenderMesh> &parts);
 bool tesselateFace(std::vector<index_t> &faceIsOut, const Surface &surf, const Face &face,
     glm::vec3 normal, index_t startIndex = 0);
 
+// tesselateFace can only be used on the main thread. Other threads need their own tesselator.
+class FaceTesselator {
+public:
+    FaceTesselator();
+    ~FaceTesselator();
+    FaceTesselator(const FaceTesselator &) = delete;
+    FaceTesselator & operator=(const FaceTesselator &) = delete;
+
+    bool tesselate(std::vector<index_t> &faceIsOut, const Surface &surf, const Face &face,
+        glm::vec3 normal, index_t startIndex = 0);
+
+private:
+    GLUtesselator *tess;
+};
+
 } // namespace
@@ -55,6 +55,19 @@
 #define IDM_RELOAD_ASSETS                   153
 #define IDM_PAINT_MATRIX                    154
 #define IDM_MARK_HOLE                       155
+#define IDM_SELECT_LOOP                     156
+#define IDM_SELECT_RING                     157
+#define IDM_SELECT_BOUNDARY                 158
+#define IDM_GROW_SELECT                     159
+#define IDM_SHRINK_SELECT                   160
+#define IDM_COMPRESS_FILE                   161
+#define IDM_INCREMENTAL_SAVE                162
+#define IDM_IMPORT_OBJ                      163
+#define IDM_EXPORT_GLB                      164
+#define IDM_SAVE_TRACE                      165
+#define IDM_INPUT_LATENCY                   166
+#define IDM_MEMORY_REPORT                   167
+#define IDM_RECORD_LOG                      168
 
 #define IDR_VERT_UNLIT                      100
 #define IDR_FRAG_SOLID                      101
@@ -66,7 +79,7 @@
     #ifndef APSTUDIO_READONLY_SYMBOLS
         #define _APS_NO_MFC                 1
         #define _APS_NEXT_RESOURCE_VALUE    105
-        #define _APS_NEXT_COMMAND_VALUE     156
+        #define _APS_NEXT_COMMAND_VALUE     169
         #define _APS_NEXT_CONTROL_VALUE     1000
         #define _APS_NEXT_SYMED_VALUE       300
     #endif
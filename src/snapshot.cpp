@@ -0,0 +1,306 @@
+#include "snapshot.h"
+#include <unordered_map>
+#include <immer/algorithm.hpp>
+#include <immer/map_transient.hpp>
+#include <immer/set_transient.hpp>
+
+namespace winged {
+
+const size_t SAVE_DATA_SIZE = sizeof(EditorState) - offsetof(EditorState, SAVE_DATA);
+
+static void putSaveData(std::vector<char> *buf, const EditorState &state) {
+    auto saveData = reinterpret_cast<const char *>(&state.SAVE_DATA);
+    buf->insert(buf->end(), saveData, saveData + SAVE_DATA_SIZE);
+}
+
+static void takeSaveData(EditorState *state, const char **ptr, const char *end) {
+    if (size_t(end - *ptr) < SAVE_DATA_SIZE)
+        throw winged_error(L"State data is corrupt");
+    memcpy(&state->SAVE_DATA, *ptr, SAVE_DATA_SIZE);
+    *ptr += SAVE_DATA_SIZE;
+}
+
+/* Full states: elements refer to each other by index within the record */
+
+template<typename T>
+static void putSet(std::vector<char> *buf, const immer::set<T> &set,
+        const std::unordered_map<T, uint32_t> &indices) {
+    put(buf, uint32_t(set.size()));
+    for (const auto &v : set)
+        put(buf, indices.at(v));
+}
+
+template<typename T>
+static T takeIndexed(const char **ptr, const char *end, const std::vector<T> &ids) {
+    auto index = take<uint32_t>(ptr, end);
+    if (index >= ids.size())
+        throw winged_error(L"State data is corrupt");
+    return ids[index];
+}
+
+template<typename T>
+static immer::set<T> takeSet(const char **ptr, const char *end, const std::vector<T> &ids) {
+    auto set = immer::set<T>{}.transient();
+    auto size = take<uint32_t>(ptr, end);
+    for (uint32_t i = 0; i < size; i++)
+        set.insert(takeIndexed(ptr, end, ids));
+    return set.persistent();
+}
+
+void putState(std::vector<char> *buf, const EditorState &state) {
+    const auto &surf = state.surf;
+    std::unordered_map<vert_id, uint32_t> vertIndices;
+    std::unordered_map<face_id, uint32_t> faceIndices;
+    std::unordered_map<edge_id, uint32_t> edgeIndices;
+    std::unordered_map<const Paint *, uint32_t> paintIndices;
+    std::vector<const Paint *> paints;
+    vertIndices.reserve(surf.verts.size());
+    faceIndices.reserve(surf.faces.size());
+    edgeIndices.reserve(surf.edges.size());
+    for (const auto &pair : surf.verts)
+        vertIndices.insert({pair.first, uint32_t(vertIndices.size())});
+    for (const auto &pair : surf.faces) {
+        faceIndices.insert({pair.first, uint32_t(faceIndices.size())});
+        auto paint = &pair.second.paint.get();
+        if (paint != &Face::DEF_PAINT.get() && !paintIndices.count(paint)) {
+            paintIndices[paint] = uint32_t(paints.size());
+            paints.push_back(paint);
+        }
+    }
+    for (const auto &pair : surf.edges)
+        edgeIndices.insert({pair.first, uint32_t(edgeIndices.size())});
+
+    buf->reserve(buf->size() + 16 + paints.size() * sizeof(Paint) + surf.verts.size() * 32
+        + surf.faces.size() * 24 + surf.edges.size() * 36);
+    put(buf, uint32_t(paints.size()));
+    put(buf, uint32_t(surf.verts.size()));
+    put(buf, uint32_t(surf.faces.size()));
+    put(buf, uint32_t(surf.edges.size()));
+    for (const auto &paint : paints)
+        put(buf, *paint);
+    for (const auto &pair : surf.verts) {
+        put(buf, id_t(pair.first));
+        put(buf, edgeIndices.at(pair.second.edge));
+        put(buf, pair.second.pos);
+    }
+    for (const auto &pair : surf.faces) {
+        put(buf, id_t(pair.first));
+        put(buf, edgeIndices.at(pair.second.edge));
+        auto paint = &pair.second.paint.get();
+        put(buf, (paint == &Face::DEF_PAINT.get()) ? uint32_t(-1) : paintIndices[paint]);
+    }
+    for (const auto &pair : surf.edges) {
+        const auto &edge = pair.second;
+        put(buf, id_t(pair.first));
+        put(buf, edgeIndices.at(edge.twin));
+        put(buf, edgeIndices.at(edge.next));
+        put(buf, edgeIndices.at(edge.prev));
+        put(buf, vertIndices.at(edge.vert));
+        put(buf, faceIndices.at(edge.face));
+    }
+    putSet(buf, state.selVerts, vertIndices);
+    putSet(buf, state.selFaces, faceIndices);
+    putSet(buf, state.selEdges, edgeIndices);
+    putSaveData(buf, state);
+}
+
+EditorState takeState(const char **ptr, const char *end) {
+    auto numPaints = take<uint32_t>(ptr, end);
+    auto numVerts = take<uint32_t>(ptr, end);
+    auto numFaces = take<uint32_t>(ptr, end);
+    auto numEdges = take<uint32_t>(ptr, end);
+    std::vector<immer::box<Paint>> paints;
+    for (uint32_t i = 0; i < numPaints; i++)
+        paints.push_back(take<Paint>(ptr, end));
+
+    // IDs come first in each record, read them before resolving references
+    const size_t vertSize = sizeof(id_t) + 4 + sizeof(glm::vec3);
+    const size_t faceSize = sizeof(id_t) + 8;
+    const size_t edgeSize = sizeof(id_t) + 20;
+    if (uint64_t(end - *ptr) < uint64_t(numVerts) * vertSize + uint64_t(numFaces) * faceSize
+            + uint64_t(numEdges) * edgeSize)
+        throw winged_error(L"State data is corrupt");
+    std::vector<vert_id> vertIds(numVerts);
+    std::vector<face_id> faceIds(numFaces);
+    std::vector<edge_id> edgeIds(numEdges);
+    const char *vertPtr = *ptr, *facePtr = vertPtr + numVerts * vertSize;
+    const char *edgePtr = facePtr + numFaces * faceSize;
+    for (uint32_t i = 0; i < numVerts; i++)
+        memcpy(&vertIds[i], vertPtr + i * vertSize, sizeof(id_t));
+    for (uint32_t i = 0; i < numFaces; i++)
+        memcpy(&faceIds[i], facePtr + i * faceSize, sizeof(id_t));
+    for (uint32_t i = 0; i < numEdges; i++)
+        memcpy(&edgeIds[i], edgePtr + i * edgeSize, sizeof(id_t));
+
+    EditorState state;
+    auto verts = state.surf.verts.transient();
+    for (uint32_t i = 0; i < numVerts; i++) {
+        *ptr += sizeof(id_t);
+        Vertex vert;
+        vert.edge = takeIndexed(ptr, end, edgeIds);
+        vert.pos = take<glm::vec3>(ptr, end);
+        verts.set(vertIds[i], vert);
+    }
+    auto faces = state.surf.faces.transient();
+    for (uint32_t i = 0; i < numFaces; i++) {
+        *ptr += sizeof(id_t);
+        Face face;
+        face.edge = takeIndexed(ptr, end, edgeIds);
+        auto paintIndex = take<uint32_t>(ptr, end);
+        if (paintIndex != uint32_t(-1)) {
+            if (paintIndex >= paints.size())
+                throw winged_error(L"State data is corrupt");
+            face.paint = paints[paintIndex];
+        }
+        faces.set(faceIds[i], face);
+    }
+    auto edges = state.surf.edges.transient();
+    for (uint32_t i = 0; i < numEdges; i++) {
+        *ptr += sizeof(id_t);
+        HEdge edge;
+        edge.twin = takeIndexed(ptr, end, edgeIds);
+        edge.next = takeIndexed(ptr, end, edgeIds);
+        edge.prev = takeIndexed(ptr, end, edgeIds);
+        edge.vert = takeIndexed(ptr, end, vertIds);
+        edge.face = takeIndexed(ptr, end, faceIds);
+        edges.set(edgeIds[i], edge);
+    }
+    state.surf.verts = verts.persistent();
+    state.surf.faces = faces.persistent();
+    state.surf.edges = edges.persistent();
+    state.selVerts = takeSet(ptr, end, vertIds);
+    state.selFaces = takeSet(ptr, end, faceIds);
+    state.selEdges = takeSet(ptr, end, edgeIds);
+    takeSaveData(&state, ptr, end);
+    return state;
+}
+
+/* Deltas: elements are referenced by ID, since indices aren't stable between states */
+
+static void putValue(std::vector<char> *buf, const Vertex &vert) {
+    put(buf, id_t(vert.edge));
+    put(buf, vert.pos);
+}
+
+static void takeValue(Vertex *vert, const char **ptr, const char *end) {
+    vert->edge = take<id_t>(ptr, end);
+    vert->pos = take<glm::vec3>(ptr, end);
+}
+
+static void putValue(std::vector<char> *buf, const Face &face) {
+    put(buf, id_t(face.edge));
+    bool defPaint = &face.paint.get() == &Face::DEF_PAINT.get();
+    put(buf, uint8_t(defPaint ? 0 : 1));
+    if (!defPaint)
+        put(buf, *face.paint);
+}
+
+static void takeValue(Face *face, const char **ptr, const char *end) {
+    face->edge = take<id_t>(ptr, end);
+    if (take<uint8_t>(ptr, end))
+        face->paint = take<Paint>(ptr, end);
+}
+
+static void putValue(std::vector<char> *buf, const HEdge &edge) {
+    put(buf, id_t(edge.twin));
+    put(buf, id_t(edge.next));
+    put(buf, id_t(edge.prev));
+    put(buf, id_t(edge.vert));
+    put(buf, id_t(edge.face));
+}
+
+static void takeValue(HEdge *edge, const char **ptr, const char *end) {
+    edge->twin = take<id_t>(ptr, end);
+    edge->next = take<id_t>(ptr, end);
+    edge->prev = take<id_t>(ptr, end);
+    edge->vert = take<id_t>(ptr, end);
+    edge->face = take<id_t>(ptr, end);
+}
+
+template<typename K, typename V>
+static void putMapDelta(std::vector<char> *buf, const immer::map<K, V> &from,
+        const immer::map<K, V> &to) {
+    std::vector<const std::pair<K, V> *> changed;
+    std::vector<K> erased;
+    immer::diff(from, to,
+        [&](const std::pair<K, V> &added) { changed.push_back(&added); },
+        [&](const std::pair<K, V> &removed) { erased.push_back(removed.first); },
+        [&](const std::pair<K, V> &, const std::pair<K, V> &changedTo) {
+            changed.push_back(&changedTo);
+        });
+    put(buf, uint32_t(changed.size()));
+    for (const auto &pair : changed) {
+        put(buf, id_t(pair->first));
+        putValue(buf, pair->second);
+    }
+    put(buf, uint32_t(erased.size()));
+    for (const auto &id : erased)
+        put(buf, id_t(id));
+}
+
+template<typename K, typename V>
+static immer::map<K, V> takeMapDelta(immer::map<K, V> map, const char **ptr, const char *end) {
+    auto trans = std::move(map).transient();
+    auto numChanged = take<uint32_t>(ptr, end);
+    for (uint32_t i = 0; i < numChanged; i++) {
+        K id = K(take<id_t>(ptr, end));
+        V value;
+        takeValue(&value, ptr, end);
+        trans.set(id, value);
+    }
+    auto numErased = take<uint32_t>(ptr, end);
+    for (uint32_t i = 0; i < numErased; i++)
+        trans.erase(K(take<id_t>(ptr, end)));
+    return trans.persistent();
+}
+
+template<typename T>
+static void putSetDelta(std::vector<char> *buf, const immer::set<T> &from,
+        const immer::set<T> &to) {
+    std::vector<T> added, erased;
+    immer::diff(from, to,
+        [&](const T &v) { added.push_back(v); },
+        [&](const T &v) { erased.push_back(v); },
+        [&](const T &, const T &) {});
+    put(buf, uint32_t(added.size()));
+    for (const auto &id : added)
+        put(buf, id_t(id));
+    put(buf, uint32_t(erased.size()));
+    for (const auto &id : erased)
+        put(buf, id_t(id));
+}
+
+template<typename T>
+static immer::set<T> takeSetDelta(immer::set<T> set, const char **ptr, const char *end) {
+    auto trans = std::move(set).transient();
+    auto numAdded = take<uint32_t>(ptr, end);
+    for (uint32_t i = 0; i < numAdded; i++)
+        trans.insert(T(take<id_t>(ptr, end)));
+    auto numErased = take<uint32_t>(ptr, end);
+    for (uint32_t i = 0; i < numErased; i++)
+        trans.erase(T(take<id_t>(ptr, end)));
+    return trans.persistent();
+}
+
+void putStateDelta(std::vector<char> *buf, const EditorState &from, const EditorState &to) {
+    putMapDelta(buf, from.surf.verts, to.surf.verts);
+    putMapDelta(buf, from.surf.faces, to.surf.faces);
+    putMapDelta(buf, from.surf.edges, to.surf.edges);
+    putSetDelta(buf, from.selVerts, to.selVerts);
+    putSetDelta(buf, from.selFaces, to.selFaces);
+    putSetDelta(buf, from.selEdges, to.selEdges);
+    putSaveData(buf, to);
+}
+
+EditorState takeStateDelta(EditorState state, const char **ptr, const char *end) {
+    state.surf.verts = takeMapDelta(std::move(state.surf.verts), ptr, end);
+    state.surf.faces = takeMapDelta(std::move(state.surf.faces), ptr, end);
+    state.surf.edges = takeMapDelta(std::move(state.surf.edges), ptr, end);
+    state.selVerts = takeSetDelta(std::move(state.selVerts), ptr, end);
+    state.selFaces = takeSetDelta(std::move(state.selFaces), ptr, end);
+    state.selEdges = takeSetDelta(std::move(state.selEdges), ptr, end);
+    takeSaveData(&state, ptr, end);
+    return state;
+}
+
+} // namespace
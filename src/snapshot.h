@@ -0,0 +1,37 @@
+// Binary encoding of editor states which preserves element IDs, for temporary storage within a
+// session (undo history, crash recovery). Saved files use the format in file.h instead.
+
+#pragma once
+#include "common.h"
+
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include "editor.h"
+
+namespace winged {
+
+template<typename T>
+void put(std::vector<char> *buf, const T &val) {
+    auto bytes = reinterpret_cast<const char *>(&val);
+    buf->insert(buf->end(), bytes, bytes + sizeof(T));
+}
+
+template<typename T>
+T take(const char **ptr, const char *end) {
+    if (end - *ptr < ptrdiff_t(sizeof(T)))
+        throw winged_error(L"State data is corrupt");
+    T val;
+    memcpy(&val, *ptr, sizeof(T));
+    *ptr += sizeof(T);
+    return val;
+}
+
+void putState(std::vector<char> *buf, const EditorState &state);
+EditorState takeState(const char **ptr, const char *end);
+// Only elements which differ between the two states are written. States are compared by their
+// shared structure, so this is proportional to the size of the change.
+void putStateDelta(std::vector<char> *buf, const EditorState &from, const EditorState &to);
+EditorState takeStateDelta(EditorState state, const char **ptr, const char *end);
+
+} // namespace
@@ -0,0 +1,100 @@
+#include "stream.h"
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace winged {
+
+// enough for any single line of text
+const size_t MIN_PRINT_SPACE = 256;
+
+OutStream::OutStream(HANDLE handle, size_t bufferSize)
+    : handle(handle)
+    , buffer(std::make_unique<char[]>(bufferSize))
+    , capacity(bufferSize) {}
+
+void OutStream::write(const void *data, size_t size) {
+    if (used + size > capacity) {
+        flush();
+        if (size >= capacity) {
+            writeDirect(data, size);
+            return;
+        }
+    }
+    memcpy(buffer.get() + used, data, size);
+    used += size;
+}
+
+void OutStream::print(const char *format, ...) {
+    if (capacity - used < MIN_PRINT_SPACE)
+        flush();
+    va_list args;
+    va_start(args, format);
+    auto len = vsnprintf(buffer.get() + used, capacity - used, format, args);
+    va_end(args);
+    if (len < 0)
+        throw winged_error(L"Error writing to file");
+    if (size_t(len) < capacity - used) {
+        used += size_t(len);
+    } else {
+        std::vector<char> text(size_t(len) + 1);
+        va_start(args, format);
+        vsnprintf(text.data(), text.size(), format, args);
+        va_end(args);
+        write(text.data(), size_t(len));
+    }
+}
+
+void OutStream::flush() {
+    if (used) {
+        writeDirect(buffer.get(), used);
+        used = 0;
+    }
+}
+
+void OutStream::writeDirect(const void *data, size_t size) {
+    if (!CHECKERR(WriteFile(handle, data, DWORD(size), NULL, NULL)))
+        throw winged_error(L"Error writing to file");
+}
+
+InStream::InStream(HANDLE handle) {
+    LARGE_INTEGER size;
+    if (!CHECKERR(GetFileSizeEx(handle, &size)) || size_t(size.QuadPart) != uint64_t(size.QuadPart))
+        throw winged_error(L"Error reading file");
+    if (size.QuadPart == 0)
+        return; // can't map an empty file
+    mapping = CreateFileMapping(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!CHECKERR(mapping))
+        throw winged_error(L"Error reading file");
+    mappedView = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!CHECKERR(mappedView)) {
+        CloseHandle(mapping);
+        throw winged_error(L"Error reading file");
+    }
+    start = ptr = static_cast<const char *>(mappedView);
+    end = start + size_t(size.QuadPart);
+}
+
+InStream::~InStream() {
+    if (mappedView)
+        UnmapViewOfFile(mappedView);
+    if (mapping)
+        CloseHandle(mapping);
+}
+
+const char * InStream::view(size_t size) {
+    if (size > remaining())
+        throw winged_error(L"Error reading file");
+    auto data = ptr;
+    ptr += size;
+    return data;
+}
+
+const char * InStream::at(size_t offset, size_t size) const {
+    if (offset > size_t(end - start) || size > size_t(end - start) - offset)
+        throw winged_error(L"Error reading file");
+    return start + offset;
+}
+
+} // namespace
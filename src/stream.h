@@ -0,0 +1,73 @@
+// Buffered file output and memory-mapped file input, so that reading and writing many small fields
+// doesn't need a system call for each one
+
+#pragma once
+#include "common.h"
+
+#include <memory>
+#include <cstring>
+#include <vector>
+#include "winchroma.h"
+
+namespace winged {
+
+class OutStream {
+public:
+    // Handle is not owned. Call flush() before closing it; the destructor discards unwritten data.
+    explicit OutStream(HANDLE handle, size_t bufferSize = 1 << 16);
+    OutStream(const OutStream &) = delete;
+    OutStream & operator=(const OutStream &) = delete;
+
+    void write(const void *data, size_t size);
+    template<typename T>
+    void put(const T &val) { write(&val, sizeof(T)); }
+    // printf-style formatted text
+    void print(const char *format, ...);
+    void flush();
+
+private:
+    HANDLE handle;
+    std::unique_ptr<char[]> buffer;
+    size_t capacity, used = 0;
+
+    void writeDirect(const void *data, size_t size);
+};
+
+// Reading past the end throws winged_error
+class InStream {
+public:
+    // Maps the entire file. Handle is not owned and may be closed afterwards.
+    explicit InStream(HANDLE handle);
+    // Reads from memory owned by the caller
+    InStream(const char *data, size_t size) : start(data), ptr(data), end(data + size) {}
+    ~InStream();
+    InStream(const InStream &) = delete;
+    InStream & operator=(const InStream &) = delete;
+
+    // Returns a pointer to the next size bytes in the file, valid for the life of the stream
+    const char * view(size_t size);
+    void read(void *buf, size_t size) { memcpy(buf, view(size), size); }
+    template<typename T>
+    T get() {
+        T val;
+        read(&val, sizeof(T));
+        return val;
+    }
+    template<typename T>
+    void readArray(std::vector<T> *vec, size_t count) {
+        if (count > remaining() / sizeof(T))
+            throw winged_error(L"Error reading file");
+        vec->resize(count);
+        read(vec->data(), count * sizeof(T));
+    }
+    size_t remaining() const { return size_t(end - ptr); }
+    // Range of the stream by absolute offset, without moving the read position
+    const char * at(size_t offset, size_t size) const;
+
+private:
+    HANDLE mapping = NULL;
+    const void *mappedView = nullptr;
+    const char *start = nullptr, *ptr = nullptr, *end = nullptr;
+};
+
+} // namespace
@@ -1,6 +1,12 @@
 #include "strutil.h"
 #include "winchroma.h"
 #include <memory>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <stringapiset.h>
 #include <winnls.h>
 
@@ -34,14 +40,227 @@ std::wstring widen(const std::string &s) {
     return widen(s.c_str());
 }
 
+static const double POW10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12};
+
+// Digits of value, most significant first
+static char * formatUnsigned(char *buf, uint64_t value, int minDigits = 1) {
+    char digits[20];
+    int count = 0;
+    do {
+        digits[count++] = char('0' + value % 10);
+        value /= 10;
+    } while (value);
+    for (; count < minDigits; minDigits--)
+        *buf++ = '0';
+    while (count)
+        *buf++ = digits[--count];
+    return buf;
+}
+
+static char * formatPrintf(char *buf, const char *format, int precision, float value) {
+    auto len = snprintf(buf, FLOAT_TEXT_SIZE, format, precision, double(value));
+    return buf + (len < 0 ? 0 : std::min(size_t(len), FLOAT_TEXT_SIZE - 1));
+}
+
+char * formatFixed(char *buf, float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint32_t expBits = (bits >> 23) & 0xFF;
+    uint64_t mantissa = bits & 0x7FFFFF;
+    int exp = -149;
+    if (expBits) {
+        mantissa |= 0x800000;
+        exp = int(expBits) - 150;
+    }
+    if (expBits == 0xFF || exp > 12) // inf/nan or more than 17 significant digits
+        return formatPrintf(buf, "%.*f", 6, value);
+
+    // value = mantissa * 2^exp exactly, round to 6 decimals with ties away from zero like msvcrt
+    uint64_t intPart = 0, fracPart = 0;
+    if (exp >= 0) {
+        intPart = mantissa << exp; // < 2^36, 11 digits
+    } else if (exp > -64) {
+        int shift = -exp;
+        uint64_t mask = (uint64_t(1) << shift) - 1;
+        intPart = mantissa >> shift;
+        uint64_t scaled = (mantissa & mask) * 1000000; // < 2^44
+        fracPart = scaled >> shift;
+        uint64_t rem = scaled & mask, half = uint64_t(1) << (shift - 1);
+        if (rem >= half)
+            fracPart++;
+        if (fracPart == 1000000) {
+            intPart++;
+            fracPart = 0;
+        }
+    } // else rounds to zero
+
+    if (bits >> 31)
+        *buf++ = '-';
+    buf = formatUnsigned(buf, intPart);
+    *buf++ = '.';
+    return formatUnsigned(buf, fracPart, 6);
+}
+
+// double would round to a different float than its exact decimal source might
+static bool isFloatMidpoint(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return (bits & 0x1FFFFFFF) == 0x10000000;
+}
+
+char * formatShortest(char *buf, float value) {
+    if (value == 0) {
+        if (std::signbit(value))
+            *buf++ = '-';
+        *buf++ = '0';
+        return buf;
+    }
+    float absVal = std::abs(value);
+    if (!(absVal >= 1e-4f && absVal < 1e9f)) {
+        // rare, use exponent notation
+        for (int precision = 1; precision < 9; precision++) { // 9 digits always read back
+            auto end = formatPrintf(buf, "%.*g", precision, value);
+            *end = 0;
+            if (strtof(buf, nullptr) == value)
+                return end;
+        }
+        return formatPrintf(buf, "%.*g", 9, value);
+    }
+
+    // Try each number of significant digits. The candidate digits come from inexact double math,
+    // but the check is exact: multiplying by a power of 10 is exact, dividing is correctly rounded
+    // and then only a float midpoint could round differently from the exact decimal.
+    int magnitude = -4; // of the first significant digit
+    while (magnitude < 8 && (magnitude < -1 ? double(absVal) * POW10[-1 - magnitude] >= 1
+            : double(absVal) >= POW10[magnitude + 1]))
+        magnitude++;
+    for (int digits = 1; digits <= 9; digits++) {
+        int decimals = digits - 1 - magnitude;
+        double scaled = decimals >= 0 ? double(absVal) * POW10[decimals]
+            : double(absVal) / POW10[-decimals];
+        double rounded = std::nearbyint(scaled);
+        double check = decimals >= 0 ? rounded / POW10[decimals] : rounded * POW10[-decimals];
+        if (float(check) != absVal || (decimals > 0 && isFloatMidpoint(check)))
+            continue;
+
+        if (value < 0)
+            *buf++ = '-';
+        auto num = uint64_t(rounded);
+        if (decimals <= 0) {
+            buf = formatUnsigned(buf, num);
+            for (; decimals < 0; decimals++)
+                *buf++ = '0';
+            return buf;
+        }
+        char digitBuf[24];
+        auto digitEnd = formatUnsigned(digitBuf, num, decimals + 1);
+        auto point = digitEnd - decimals;
+        while (digitEnd > point && digitEnd[-1] == '0')
+            digitEnd--;
+        buf = std::copy(digitBuf, point, buf);
+        if (digitEnd > point) {
+            *buf++ = '.';
+            buf = std::copy(point, digitEnd, buf);
+        }
+        return buf;
+    }
+    return formatPrintf(buf, "%.*g", 9, value);
+}
+
+char * formatInt(char *buf, int value) {
+    auto mag = uint64_t(value < 0 ? -int64_t(value) : int64_t(value));
+    if (value < 0)
+        *buf++ = '-';
+    return formatUnsigned(buf, mag);
+}
+
 } // namespace
 
 #ifdef ENTRY_TEST_STRUTIL
 #include <cstdio>
 using namespace winged;
 
+static int g_failed = 0;
+
+static uint32_t randomBits() { // xorshift, the same sequence every run
+    static uint32_t state = 2463534242;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+static float fromBits(uint32_t bits) {
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static void checkFixed(float value) {
+    char buf[FLOAT_TEXT_SIZE + 1], expected[FLOAT_TEXT_SIZE + 1];
+    *formatFixed(buf, value) = 0;
+    snprintf(expected, sizeof(expected), "%f", double(value));
+    if (strcmp(buf, expected) != 0 && g_failed++ < 20)
+        wprintf(L"FAIL: formatFixed(%.9g) = %S, printf = %S\n", double(value), buf, expected);
+}
+
+static void checkShortest(float value) {
+    char buf[FLOAT_TEXT_SIZE + 1];
+    *formatShortest(buf, value) = 0;
+    float read = strtof(buf, nullptr);
+    if ((read != value || std::signbit(read) != std::signbit(value)) && g_failed++ < 20)
+        wprintf(L"FAIL: formatShortest(%.9g) = %S, reads back as %.9g\n",
+            double(value), buf, double(read));
+}
+
 int main() {
     wprintf(L"Narrow: ==%S==\n", narrow(L"Test string").c_str());
     wprintf(L"Widen: ==%s==\n", widen("Test string").c_str());
+
+    const float special[] = {0.0f, -0.0f, 1.0f, -1.0f, 0.5f, 0.0078125f, -0.0078125f,
+        4e-7f, -4e-7f, 4.99e-7f, -4.99e-7f, 5e-7f, -5e-7f, -1e-30f, 0.1f, 1e9f, 3.4e38f};
+    for (float value : special) {
+        checkFixed(value);
+        checkShortest(value);
+    }
+    // odd multiples of 2^-7 end in 5 in the 7th decimal, exactly halfway between two outputs
+    for (int i = 1; i < 1 << 17; i += 2) {
+        checkFixed(float(i) / 128);
+        checkFixed(-float(i) / 128);
+    }
+    // subnormals
+    for (uint32_t bits = 1; bits < 0x800000; bits += 997) {
+        checkFixed(fromBits(bits));
+        checkFixed(fromBits(bits | 0x80000000));
+        checkShortest(fromBits(bits));
+        checkShortest(fromBits(bits | 0x80000000));
+    }
+    // past 2^36 the integer math gives way to printf
+    const float limits[] = {68719476736.0f, -68719476736.0f, 34359738368.0f};
+    for (float limit : limits) {
+        float below = limit, above = limit;
+        for (int i = 0; i < 1000; i++) {
+            checkFixed(below);
+            checkFixed(above);
+            below = std::nextafter(below, 0.0f);
+            above = std::nextafter(above, limit * 2);
+        }
+    }
+    for (int i = 0; i < 1000000; i++) {
+        float value = fromBits(randomBits());
+        if (!std::isfinite(value))
+            continue;
+        checkFixed(value);
+        checkShortest(value);
+        // the range of typical coordinates, where every digit counts
+        checkFixed(float(int32_t(randomBits())) / 1048576);
+    }
+
+    if (g_failed) {
+        wprintf(L"%d failed\n", g_failed);
+        return 1;
+    }
+    wprintf(L"OK\n");
+    return 0;
 }
 #endif // ENTRY_TEST_STRUTIL
@@ -12,4 +12,14 @@ std::wstring widen(const char *s);
 std::string narrow(const std::wstring &s);
 std::wstring widen(const std::string &s);
 
+// Number formatting for text file formats, much faster than printf. buf must have room for
+// FLOAT_TEXT_SIZE chars, no null terminator is written, and the end of the text is returned.
+const size_t FLOAT_TEXT_SIZE = 48;
+// Same text as msvcrt printf("%f")
+char * formatFixed(char *buf, float value);
+// Shortest text which reads back as exactly the same value
+char * formatShortest(char *buf, float value);
+// Same text as printf("%d")
+char * formatInt(char *buf, int value);
+
 } // namespace
@@ -24,6 +24,31 @@ const id_t Paint::HOLE_MATERIAL =
 const immer::box<Paint> Face::DEF_PAINT;
 
 
+bool operator==(const Vertex &a, const Vertex &b) {
+    return a.edge == b.edge && a.pos == b.pos;
+}
+
+bool operator!=(const Vertex &a, const Vertex &b) {
+    return !(a == b);
+}
+
+bool operator==(const Face &a, const Face &b) {
+    return a.edge == b.edge && &a.paint.get() == &b.paint.get();
+}
+
+bool operator!=(const Face &a, const Face &b) {
+    return !(a == b);
+}
+
+bool operator==(const HEdge &a, const HEdge &b) {
+    return a.twin == b.twin && a.next == b.next && a.prev == b.prev
+        && a.vert == b.vert && a.face == b.face;
+}
+
+bool operator!=(const HEdge &a, const HEdge &b) {
+    return !(a == b);
+}
+
 bool isPrimary(const edge_pair &pair) {
     return memcmp(&pair.first, &pair.second.twin, sizeof(edge_id)) < 0;
 }
@@ -128,6 +128,14 @@ struct Surface {
     immer::map<edge_id, HEdge>  edges;
 };
 
+// used for diffing states (paints are compared by identity)
+bool operator==(const Vertex &a, const Vertex &b);
+bool operator!=(const Vertex &a, const Vertex &b);
+bool operator==(const Face &a, const Face &b);
+bool operator!=(const Face &a, const Face &b);
+bool operator==(const HEdge &a, const HEdge &b);
+bool operator!=(const HEdge &a, const HEdge &b);
+
 // for each pair of twins there is one primary edge (arbitrary)
 bool isPrimary(const edge_pair &pair);
 edge_id primaryEdge(const edge_pair &pair);
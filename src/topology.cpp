@@ -0,0 +1,209 @@
+#include "topology.h"
+#include <unordered_map>
+#include <immer/set_transient.hpp>
+
+namespace winged {
+
+// outgoing loop edges from a vertex
+struct LoopVertEdges {
+    edge_id a = {}, b = {};
+};
+
+std::vector<edge_id> sortEdgeLoop(const Surface &surf, const immer::set<edge_id> &edges) {
+    if (edges.empty())
+        throw winged_error();
+    std::unordered_map<vert_id, LoopVertEdges> vertEdges;
+    vertEdges.reserve(edges.size());
+    auto addVertEdge = [&](vert_id v, edge_id e) {
+        auto &slots = vertEdges[v];
+        if (slots.a == edge_id{})
+            slots.a = e;
+        else if (slots.b == edge_id{})
+            slots.b = e;
+        else
+            throw winged_error(L"Edges must form a loop");
+    };
+    for (const auto &e : edges) {
+        const auto &edge = e.in(surf);
+        addVertEdge(edge.vert, e);
+        addVertEdge(edge.twin.in(surf).vert, edge.twin);
+    }
+
+    std::vector<edge_id> loop;
+    loop.reserve(edges.size());
+    loop.push_back(*edges.begin());
+    auto startVert = loop[0].in(surf).vert;
+    while (1) {
+        const auto &last = loop.back().in(surf);
+        auto nextVert = last.twin.in(surf).vert;
+        if (nextVert == startVert)
+            break;
+        const auto &slots = vertEdges[nextVert];
+        edge_id next = (slots.a == last.twin) ? slots.b : slots.a;
+        if (next == edge_id{} || loop.size() == edges.size())
+            throw winged_error(L"Edges must form a loop");
+        loop.push_back(next);
+    }
+    if (loop.size() != edges.size())
+        throw winged_error(L"Edges must form a loop"); // multiple loops
+    return loop;
+}
+
+// number of edges on the vertex, up to max + 1
+static size_t vertDegree(const Surface &surf, const Vertex &vert, size_t max) {
+    size_t degree = 0;
+    for (auto vertEdge : VertEdges(surf, vert)) {
+        (void)vertEdge;
+        if (++degree > max)
+            break;
+    }
+    return degree;
+}
+
+// edge continuing straight through the end vertex, or null if the vertex doesn't have four edges
+static edge_id loopNext(const Surface &surf, edge_id e) {
+    const auto &next = e.in(surf).next.in(surf);
+    if (vertDegree(surf, next.vert.in(surf), 4) != 4)
+        return {};
+    return next.twin.in(surf).next;
+}
+
+// edge opposite the twin of this edge, or null if the twin's face is not a quad
+static edge_id ringNext(const Surface &surf, edge_id e) {
+    edge_id t = e.in(surf).twin;
+    const auto &next = t.in(surf).next.in(surf);
+    const auto &opposite = next.next.in(surf);
+    if (opposite.next.in(surf).next != t)
+        return {};
+    return next.next;
+}
+
+// follow the sequence of edges in both directions, until it ends or returns to the start
+template<typename F>
+static std::vector<edge_id> walkBothWays(const Surface &surf, edge_id e, F step) {
+    std::vector<edge_id> edges = {e};
+    for (edge_id cur = step(surf, e); cur != edge_id{}; cur = step(surf, cur)) {
+        if (cur == e || edges.size() > surf.edges.size())
+            return edges; // closed
+        edges.push_back(cur);
+    }
+    edge_id twin = e.in(surf).twin;
+    for (edge_id cur = step(surf, twin); cur != edge_id{}; cur = step(surf, cur)) {
+        if (cur == twin || edges.size() > surf.edges.size())
+            break;
+        edges.push_back(cur);
+    }
+    return edges;
+}
+
+std::vector<edge_id> edgeLoop(const Surface &surf, edge_id e) {
+    return walkBothWays(surf, e, loopNext);
+}
+
+std::vector<edge_id> edgeRing(const Surface &surf, edge_id e) {
+    return walkBothWays(surf, e, ringNext);
+}
+
+std::vector<edge_id> regionBoundary(const Surface &surf, const immer::set<face_id> &faces) {
+    std::vector<edge_id> boundary;
+    for (const auto &f : faces) {
+        for (auto faceEdge : FaceEdges(surf, f.in(surf))) {
+            if (!faces.count(faceEdge.second.twin.in(surf).face))
+                boundary.push_back(faceEdge.first);
+        }
+    }
+    return boundary;
+}
+
+EditorState selectEdgeLoops(EditorState state) {
+    auto edges = state.selEdges.transient();
+    for (const auto &e : state.selEdges)
+        for (const auto &loopEdge : edgeLoop(state.surf, e))
+            edges.insert(primaryEdge(loopEdge.pair(state.surf)));
+    state.selEdges = edges.persistent();
+    return state;
+}
+
+EditorState selectEdgeRings(EditorState state) {
+    auto edges = state.selEdges.transient();
+    for (const auto &e : state.selEdges)
+        for (const auto &ringEdge : edgeRing(state.surf, e))
+            edges.insert(primaryEdge(ringEdge.pair(state.surf)));
+    state.selEdges = edges.persistent();
+    return state;
+}
+
+EditorState selectBoundary(EditorState state) {
+    auto edges = state.selEdges.transient();
+    for (const auto &e : regionBoundary(state.surf, state.selFaces))
+        edges.insert(primaryEdge(e.pair(state.surf)));
+    state.selEdges = edges.persistent();
+    state.selFaces = {};
+    return state;
+}
+
+EditorState growSelection(EditorState state) {
+    const auto &surf = state.surf;
+    auto verts = state.selVerts.transient();
+    auto faces = state.selFaces.transient();
+    auto edges = state.selEdges.transient();
+    for (const auto &v : state.selVerts)
+        for (auto vertEdge : VertEdges(surf, v.in(surf)))
+            verts.insert(vertEdge.second.twin.in(surf).vert);
+    for (const auto &f : state.selFaces)
+        for (auto faceEdge : FaceEdges(surf, f.in(surf)))
+            faces.insert(faceEdge.second.twin.in(surf).face);
+    for (const auto &e : state.selEdges) {
+        const auto &edge = e.in(surf);
+        for (auto v : {edge.vert, edge.twin.in(surf).vert})
+            for (auto vertEdge : VertEdges(surf, v.in(surf)))
+                edges.insert(primaryEdge(vertEdge));
+    }
+    state.selVerts = verts.persistent();
+    state.selFaces = faces.persistent();
+    state.selEdges = edges.persistent();
+    return state;
+}
+
+EditorState shrinkSelection(EditorState state) {
+    const auto &surf = state.surf;
+    auto verts = state.selVerts.transient();
+    auto faces = state.selFaces.transient();
+    auto edges = state.selEdges.transient();
+    for (const auto &v : state.selVerts) {
+        for (auto vertEdge : VertEdges(surf, v.in(surf))) {
+            if (!state.selVerts.count(vertEdge.second.twin.in(surf).vert)) {
+                verts.erase(v);
+                break;
+            }
+        }
+    }
+    for (const auto &f : state.selFaces) {
+        for (auto faceEdge : FaceEdges(surf, f.in(surf))) {
+            if (!state.selFaces.count(faceEdge.second.twin.in(surf).face)) {
+                faces.erase(f);
+                break;
+            }
+        }
+    }
+    for (const auto &e : state.selEdges) {
+        const auto &edge = e.in(surf);
+        bool border = false;
+        for (auto v : {edge.vert, edge.twin.in(surf).vert}) {
+            for (auto vertEdge : VertEdges(surf, v.in(surf))) {
+                if (!state.selEdges.count(primaryEdge(vertEdge))) {
+                    border = true;
+                    break;
+                }
+            }
+        }
+        if (border)
+            edges.erase(e);
+    }
+    state.selVerts = verts.persistent();
+    state.selFaces = faces.persistent();
+    state.selEdges = edges.persistent();
+    return state;
+}
+
+} // namespace
@@ -0,0 +1,31 @@
+// Queries on the connectivity of a surface (edge loops, rings, region boundaries) and selection
+// operations built on them. Adjacency is indexed by vertex/face, so all queries are linear in the
+// number of elements involved.
+
+#pragma once
+#include "common.h"
+
+#include <vector>
+#include <immer/set.hpp>
+#include "surface.h"
+#include "editor.h"
+
+namespace winged {
+
+// Sort a set of (primary) edges forming a single closed loop. Returned edges all point in the same
+// direction around the loop.
+std::vector<edge_id> sortEdgeLoop(const Surface &surf, const immer::set<edge_id> &edges);
+// Continue the edge straight through vertices with exactly four edges, in both directions
+std::vector<edge_id> edgeLoop(const Surface &surf, edge_id e);
+// Continue the edge across opposite sides of quads, in both directions
+std::vector<edge_id> edgeRing(const Surface &surf, edge_id e);
+// Edges of the region which border faces outside the region
+std::vector<edge_id> regionBoundary(const Surface &surf, const immer::set<face_id> &faces);
+
+EditorState selectEdgeLoops(EditorState state);
+EditorState selectEdgeRings(EditorState state);
+EditorState selectBoundary(EditorState state);
+EditorState growSelection(EditorState state);
+EditorState shrinkSelection(EditorState state);
+
+} // namespace
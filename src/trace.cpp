@@ -0,0 +1,128 @@
+#include "trace.h"
+#include "winchroma.h"
+#include "stream.h"
+
+namespace winged {
+
+const LONG TRACE_BUFFER_SIZE = 1 << 12; // spans per thread, must be a power of 2
+// when a buffer is full, the oldest spans may be overwritten while writing the trace
+const LONG TRACE_WRITE_MARGIN = 64;
+
+struct TraceSpan {
+    const char *name;
+    int64_t start, end;
+    TraceCounter counters[MAX_TRACE_COUNTERS];
+    int numCounters;
+};
+
+// Only written by its own thread. Buffers are never freed, so they can be read at any time, but
+// this means short-lived threads shouldn't record spans.
+struct TraceBuffer {
+    TraceBuffer *nextBuffer;
+    DWORD threadId;
+    volatile LONG count; // total spans recorded, may wrap
+    TraceSpan spans[TRACE_BUFFER_SIZE];
+};
+
+bool g_traceOn = false;
+static TraceBuffer * volatile g_traceBuffers = nullptr;
+static DWORD g_traceTls = TLS_OUT_OF_INDEXES;
+static DWORD g_mainThreadId;
+static int64_t g_traceStart, g_traceFreq;
+
+void initTrace() {
+    wchar_t buf[8];
+    if (!GetEnvironmentVariable(L"WINGED_TRACE", buf, _countof(buf)) || buf[0] == '0')
+        return;
+    g_traceTls = TlsAlloc();
+    if (g_traceTls == TLS_OUT_OF_INDEXES)
+        return;
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    g_traceFreq = freq.QuadPart;
+    g_traceStart = traceTime();
+    g_mainThreadId = GetCurrentThreadId();
+    g_traceOn = true;
+}
+
+int64_t traceTime() {
+    LARGE_INTEGER time;
+    QueryPerformanceCounter(&time);
+    return time.QuadPart;
+}
+
+static TraceBuffer * threadBuffer() {
+    auto buffer = static_cast<TraceBuffer *>(TlsGetValue(g_traceTls));
+    if (!buffer) {
+        buffer = new TraceBuffer();
+        buffer->threadId = GetCurrentThreadId();
+        TlsSetValue(g_traceTls, buffer);
+        // lock-free push to the front of the list
+        TraceBuffer *head;
+        do {
+            head = g_traceBuffers;
+            buffer->nextBuffer = head;
+        } while (InterlockedCompareExchangePointer(reinterpret_cast<void * volatile *>(
+            &g_traceBuffers), buffer, head) != head);
+    }
+    return buffer;
+}
+
+void recordTrace(const char *name, int64_t start, int64_t end,
+        const TraceCounter *counters, int numCounters) {
+    auto buffer = threadBuffer();
+    auto &span = buffer->spans[buffer->count & (TRACE_BUFFER_SIZE - 1)];
+    span.name = name;
+    span.start = start;
+    span.end = end;
+    span.numCounters = numCounters;
+    for (int i = 0; i < numCounters; i++)
+        span.counters[i] = counters[i];
+    InterlockedIncrement(&buffer->count); // publish the span
+}
+
+static double traceMicros(int64_t time) {
+    return double(time - g_traceStart) * 1e6 / double(g_traceFreq);
+}
+
+void writeTrace(const std::string &file) {
+    if (!g_traceOn)
+        throw winged_error(L"Tracing is off (set WINGED_TRACE=1 before starting)");
+    auto handle = CreateFileA(file.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE)
+        throw winged_error(L"Error saving trace");
+    try {
+        OutStream out(handle);
+        out.print("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        bool first = true;
+        for (auto buffer = g_traceBuffers; buffer; buffer = buffer->nextBuffer) {
+            out.print("%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%lu,"
+                "\"args\":{\"name\":\"%s\"}}", first ? "" : ",\n", buffer->threadId,
+                buffer->threadId == g_mainThreadId ? "main" : "worker");
+            first = false;
+            auto count = ULONG(buffer->count);
+            ULONG begin = 0;
+            if (count > ULONG(TRACE_BUFFER_SIZE))
+                begin = count - ULONG(TRACE_BUFFER_SIZE - TRACE_WRITE_MARGIN);
+            for (auto i = begin; i != count; i++) {
+                const auto &span = buffer->spans[i & ULONG(TRACE_BUFFER_SIZE - 1)];
+                out.print(",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%lu,"
+                    "\"ts\":%.3f,\"dur\":%.3f,\"args\":{", span.name, buffer->threadId,
+                    traceMicros(span.start), traceMicros(span.end) - traceMicros(span.start));
+                for (int c = 0; c < span.numCounters; c++)
+                    out.print("%s\"%s\":%I64d", c ? "," : "", span.counters[c].name,
+                        span.counters[c].value);
+                out.print("}}");
+            }
+        }
+        out.print("\n]}\n");
+        out.flush();
+    } catch (...) {
+        CloseHandle(handle);
+        throw;
+    }
+    CloseHandle(handle);
+}
+
+} // namespace
@@ -0,0 +1,58 @@
+// Lightweight timing of hot paths, saved as Chrome trace_event JSON (open in chrome://tracing or
+// https://ui.perfetto.dev). Recording is off unless the WINGED_TRACE environment variable is set,
+// in which case each thread keeps its most recent spans in its own ring buffer.
+
+#pragma once
+#include "common.h"
+
+#include <cstdint>
+#include <string>
+
+namespace winged {
+
+const int MAX_TRACE_COUNTERS = 3;
+
+struct TraceCounter {
+    const char *name;
+    int64_t value;
+};
+
+// Only set by initTrace, before other threads start
+extern bool g_traceOn;
+
+void initTrace();
+int64_t traceTime();
+// name and counter names must stay valid until the trace is written (use string literals)
+void recordTrace(const char *name, int64_t start, int64_t end,
+    const TraceCounter *counters, int numCounters);
+// Spans recorded on other threads while writing may be missing
+void writeTrace(const std::string &file);
+
+// Records a span from construction to destruction. When tracing is off, this only checks a flag.
+class TraceScope {
+public:
+    explicit TraceScope(const char *spanName) : name(g_traceOn ? spanName : nullptr) {
+        if (name)
+            start = traceTime();
+    }
+    ~TraceScope() {
+        if (name)
+            recordTrace(name, start, traceTime(), counters, numCounters);
+    }
+    TraceScope(const TraceScope &) = delete;
+    TraceScope & operator=(const TraceScope &) = delete;
+
+    // Attach a value to the span, like an element count or buffer size
+    void counter(const char *counterName, int64_t value) {
+        if (name && numCounters < MAX_TRACE_COUNTERS)
+            counters[numCounters++] = {counterName, value};
+    }
+
+private:
+    const char *name;
+    int64_t start = 0;
+    TraceCounter counters[MAX_TRACE_COUNTERS];
+    int numCounters = 0;
+};
+
+} // namespace
@@ -1,12 +1,11 @@
 #include "viewport.h"
+#include <algorithm>
 #include <cfloat>
 #include <shlwapi.h>
-#include <queue>
 #include <glad.h>
 #include <glad_wgl.h>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
-#include <immer/set_transient.hpp>
 #include "main.h"
 #include "ops.h"
 #include "image.h"
@@ -14,6 +13,7 @@
 #include "stdutil.h"
 #include "resource.h"
 #include "strutil.h"
+#include "trace.h"
 
 using namespace chroma;
 
@@ -138,205 +138,6 @@ bool initViewport() {
     return true;
 }
 
-static edge_pair edgeOnHoverFace(const Surface &surf, vert_id v) {
-    // TODO: what if there are multiple?
-    for (auto edge : VertEdges(surf, v.in(surf))) {
-        if (edge.second.face == g_hoverFace)
-            return edge;
-    }
-    throw winged_error();
-}
-
-static tuple<edge_id, edge_id> findClosestOpposingEdges(
-        const Surface &surf, Face face1, Face face2) {
-    float closestDist = FLT_MAX;
-    edge_id e1 = face1.edge, e2 = face2.edge;
-    for (auto f1Edge : FaceEdges(surf, face1)) {
-        auto v1 = f1Edge.second.vert.in(surf).pos;
-        for (auto f2Edge : FaceEdges(surf, face2)) {
-            auto dist = glm::distance(v1, f2Edge.second.vert.in(surf).pos);
-            if (dist < closestDist) {
-                e1 = f1Edge.first;
-                e2 = f2Edge.second.prev;
-                closestDist = dist;
-            }
-        }
-    }
-    return {e1, e2};
-}
-
-static PickType hoverType() {
-    switch (g_hover.type) {
-        case PICK_VERT: return g_hover.vert.find(g_state.surf) ? PICK_VERT : PICK_NONE;
-        case PICK_FACE: return g_hover.face.find(g_state.surf) ? PICK_FACE : PICK_NONE;
-        case PICK_EDGE: return g_hover.edge.find(g_state.surf) ? PICK_EDGE : PICK_NONE;
-        default: return g_hover.type;
-    }
-}
-
-static EditorState select(EditorState state, const PickResult pick, bool toggle) {
-    if (state.selMode == SEL_ELEMENTS) {
-        switch (pick.type) {
-            case PICK_VERT:
-                if (state.surf.verts.count(pick.vert)) {
-                    if (toggle && state.selVerts.count(pick.vert))
-                        state.selVerts = std::move(state.selVerts).erase(pick.vert);
-                    else
-                        state.selVerts = std::move(state.selVerts).insert(pick.vert);
-                }
-                break;
-            case PICK_FACE:
-                if (auto face = pick.face.find(state.surf)) {
-                    if (toggle && state.selFaces.count(pick.face)) {
-                        state.selFaces = std::move(state.selFaces).erase(pick.face);
-                    } else {
-                        state.selFaces = std::move(state.selFaces).insert(pick.face);
-                        state.workPlane = facePlane(state.surf, *face);
-                    }
-                }
-                break;
-            case PICK_EDGE:
-                if (auto edge = pick.edge.find(state.surf)) {
-                    edge_id e = primaryEdge({pick.edge, *edge});
-                    if (toggle && state.selEdges.count(pick.edge))
-                        state.selEdges = std::move(state.selEdges).erase(e);
-                    else
-                        state.selEdges = std::move(state.selEdges).insert(e);
-                }
-                break;
-        }
-    } else if (state.selMode == SEL_SOLIDS) {
-        if (auto face = pick.face.find(state.surf)) {
-            auto erase = toggle && state.selFaces.count(pick.face);
-            auto verts = state.selVerts.transient();
-            auto faces = state.selFaces.transient();
-            auto edges = state.selEdges.transient();
-            std::unordered_set<edge_id> visited;
-            // flood-fill
-            std::queue<edge_id> toSelect;
-            toSelect.push(face->edge);
-            while (!toSelect.empty()) {
-                auto e = toSelect.front();
-                toSelect.pop();
-                if (!visited.count(e)) {
-                    auto edge = e.pair(state.surf);
-                    visited.insert(e);
-                    if (erase) {
-                        if (isPrimary(edge)) edges.erase(e);
-                        verts.erase(edge.second.vert);
-                        faces.erase(edge.second.face);
-                    } else {
-                        if (isPrimary(edge)) edges.insert(e);
-                        verts.insert(edge.second.vert);
-                        faces.insert(edge.second.face);
-                    }
-                    toSelect.push(edge.second.twin);
-                    toSelect.push(edge.second.next);
-                }
-            }
-            state.selVerts = verts.persistent();
-            state.selFaces = faces.persistent();
-            state.selEdges = edges.persistent();
-        }
-    }
-    return state;
-}
-
-static EditorState knifeToVert(EditorState state, vert_id vert) {
-    if (state.selVerts.size() == 1 && g_hoverFace.find(state.surf)) {
-        auto e1 = edgeOnHoverFace(state.surf, *state.selVerts.begin());
-        auto e2 = edgeOnHoverFace(state.surf, vert);
-
-        if (e1.first == e2.first) {
-            if (g_drawVerts.empty())
-                return state; // clicked same vertex twice, nothing to do
-            // loop must be clockwise in this case
-            auto start = vert.in(state.surf).pos;
-            glm::vec3 loopNorm = accumPolyNormal(start, g_drawVerts[0]);
-            for (size_t i = 1; i < g_drawVerts.size(); i++)
-                loopNorm += accumPolyNormal(g_drawVerts[i - 1], g_drawVerts[i]);
-            loopNorm += accumPolyNormal(g_drawVerts.back(), start);
-
-            auto faceNorm = faceNormalNonUnit(state.surf, g_hoverFace.in(state.surf));
-            if (glm::dot(loopNorm, faceNorm) > 0)
-                std::reverse(g_drawVerts.begin(), g_drawVerts.end());
-        }
-
-        edge_id newEdge;
-        tie(state.surf, newEdge) = splitFace(std::move(state.surf),
-            e1.first, e2.first, g_drawVerts);
-        for (size_t i = 0; i < g_drawVerts.size() + 1; i++) {
-            auto pair = newEdge.pair(state.surf);
-            state.selEdges = std::move(state.selEdges).insert(primaryEdge(pair));
-            newEdge = pair.second.next;
-        }
-    }
-
-    state.selVerts = immer::set<vert_id>{}.insert(vert);
-    state.selFaces = {};
-    g_drawVerts.clear();
-    return state;
-}
-
-static EditorState knifeToDrawVert(EditorState state, int loopI) {
-    if (state.selVerts.size() != 1 || !g_hoverFace.find(state.surf))
-        throw winged_error();
-
-    glm::vec3 loopNorm = {};
-    for (size_t i = loopI, j = g_drawVerts.size() - 1; i < g_drawVerts.size(); j = i++)
-        loopNorm += accumPolyNormal(g_drawVerts[j], g_drawVerts[i]);
-    auto faceNorm = faceNormalNonUnit(state.surf, g_hoverFace.in(state.surf));
-    if (glm::dot(loopNorm, faceNorm) > 0)
-        std::reverse(g_drawVerts.begin() + loopI + 1, g_drawVerts.end());
-
-    auto e = edgeOnHoverFace(state.surf, *state.selVerts.begin());
-    edge_id newEdge;
-    tie(state.surf, newEdge) = splitFace(std::move(state.surf),
-        e.first, e.first, g_drawVerts, loopI);
-    for (size_t i = 0; i < g_drawVerts.size() + 1; i++) {
-        auto pair = newEdge.pair(state.surf);
-        state.selEdges = std::move(state.selEdges).insert(primaryEdge(pair));
-        if (int(i) == loopI + 1)
-            state.selVerts = immer::set<vert_id>{}.insert(pair.second.vert);
-        newEdge = pair.second.next;
-    }
-    state.selFaces = {};
-    g_drawVerts.clear();
-    return state;
-}
-
-static EditorState join(EditorState state) {
-    if (g_hover.vert.find(state.surf) && state.selVerts.size() == 1) {
-        auto e1 = edgeOnHoverFace(state.surf, *state.selVerts.begin()).first;
-        auto e2 = edgeOnHoverFace(state.surf, g_hover.vert).first;
-        state.surf = joinVerts(std::move(state.surf), e1, e2);
-    } else if (auto hovEdge = g_hover.edge.find(state.surf)) {
-        if (state.selEdges.size() != 1) throw winged_error();
-        edge_pair edge1 = state.selEdges.begin()->pair(state.surf);
-        edge_pair twin1 = edge1.second.twin.pair(state.surf);
-        edge_pair edge2 = {g_hover.edge, *hovEdge};
-        edge_pair twin2 = edge2.second.twin.pair(state.surf);
-        if (edge1.second.face == edge2.second.face) {} // do nothing
-        else if (edge1.second.face == twin2.second.face) {
-            std::swap(edge2, twin2);
-        } else if (twin1.second.face == edge2.second.face) {
-            std::swap(edge1, twin1);
-        } else if (twin1.second.face == twin2.second.face) {
-            std::swap(edge1, twin1); std::swap(edge2, twin2);
-        }
-        state.surf = joinEdges(state.surf, edge1.first, edge2.first);
-    } else if (auto face2 = g_hover.face.find(state.surf)) {
-        if (state.selFaces.size() != 1) throw winged_error();
-        const auto &face1 = state.selFaces.begin()->in(state.surf);
-        auto edges = findClosestOpposingEdges(state.surf, face1, *face2);
-        state.surf = joinEdgeLoops(std::move(state.surf), get<0>(edges), get<1>(edges));
-        // TODO: select edge loop
-    } else {
-        throw winged_error();
-    }
-    return state;
-}
-
 void ViewportWindow::invalidateRenderMesh() {
     renderMeshDirtyLocal = true;
 }
@@ -353,6 +154,7 @@ void ViewportWindow::clearTextureCache() {
     for (const auto &pair : loadedTextures)
         glDeleteTextures(1, &pair.second);
     loadedTextures.clear();
+    textureBytes = 0;
 }
 
 void ViewportWindow::lockMouse(POINT clientPos, MouseMode mode) {
@@ -402,6 +204,8 @@ glm::vec3 ViewportWindow::forwardAxis() {
 }
 
 void ViewportWindow::updateHover(POINT pos) {
+    TraceScope trace("updateHover");
+    trace.counter("faces", int64_t(g_state.surf.faces.size()));
     auto normCur = screenPosToNDC({pos.x, pos.y}, viewportDim);
     auto project = projMat * mvMat;
     auto grid = g_state.gridOn ? g_state.gridSize : 0;
@@ -484,7 +288,7 @@ void ViewportWindow::startToolAdjust(POINT pos) {
         moved = {};
         snapAccum = 0;
         lockMouse(pos, MOUSE_TOOL);
-        g_mainWindow.pushUndo();
+        g_mainWindow.perform(Action{ACT_DRAG_START});
     }
 }
 
@@ -529,9 +333,10 @@ void ViewportWindow::toolAdjust(POINT pos, SIZE delta, UINT keyFlags) {
                 moved = diff;
             }
             if (amount != glm::vec3(0)) {
-                auto verts = selAttachedVerts(g_state);
-                g_state.surf = transformVertices(std::move(g_state.surf), verts,
-                    glm::translate(glm::mat4(1), amount));
+                Action action;
+                action.type = ACT_DRAG;
+                action.vec = amount;
+                g_mainWindow.perform(action);
                 g_mainWindow.updateStatus();
             }
             break;
@@ -772,57 +577,24 @@ bool ViewportWindow::onSetCursor(HWND, HWND cursorWnd, UINT hitTest, UINT msg) {
 }
 
 void ViewportWindow::onLButtonDown(HWND, BOOL, int x, int y, UINT keyFlags) {
+    if (g_mainWindow.busy())
+        return;
     try {
-        if (g_tool == TOOL_KNIFE) {
-            switch (hoverType()) {
-                case PICK_EDGE: {
-                    EditorState newState = g_state;
-                    newState.surf = splitEdge(g_state.surf, g_hover.edge, g_hover.point);
-                    auto newVert = g_hover.edge.in(newState.surf).next.in(newState.surf).vert;
-                    newState = knifeToVert(std::move(newState), newVert);
-                    g_mainWindow.pushUndo(std::move(newState));
-                    break;
-                }
-                case PICK_VERT:
-                    g_mainWindow.pushUndo(knifeToVert(g_state, g_hover.vert));
-                    break;
-                case PICK_DRAWVERT:
-                    g_mainWindow.pushUndo(knifeToDrawVert(g_state, int(g_hover.val)));
-                    break;
-                case PICK_FACE:
-                    if (g_state.selVerts.size() != 1)
-                        throw winged_error(); // TODO
-                    g_drawVerts.push_back(g_hover.point);
-                    break;
-                case PICK_NONE:
-                    g_state = clearSelection(std::move(g_state));
-                    break;
-            }
-        } else if (g_tool == TOOL_POLY) {
-            if (g_hover.type == PICK_WORKPLANE) {
-                g_drawVerts.push_back(g_hover.point);
-            } else if (g_hover.type == PICK_DRAWVERT && g_hover.val == 0) {
-                EditorState newState = clearSelection(g_state);
-                face_id newFace;
-                tie(newState.surf, newFace) = makePolygonPlane(g_state.surf, g_drawVerts);
-                newState.selFaces = std::move(newState.selFaces).insert(newFace);
-                g_mainWindow.pushUndo(std::move(newState));
-                g_drawVerts.clear();
-                if (!(keyFlags & MK_SHIFT))
-                    g_tool = TOOL_SELECT;
-            } else {
-                throw winged_error();
-            }
-        } else if (g_tool == TOOL_JOIN && hasSelection(g_state) && g_hover.type) {
-            g_mainWindow.pushUndo(join(g_state));
-            g_mainWindow.flashSel();
-            if (!(keyFlags & MK_SHIFT))
+        Action action;
+        action.keyFlags = keyFlags;
+        action.pick = g_hover;
+        action.hoverFace = g_hoverFace;
+        if (g_tool == TOOL_KNIFE || g_tool == TOOL_POLY
+                || (g_tool == TOOL_JOIN && hasSelection(g_state) && g_hover.type)) {
+            action.type = (g_tool == TOOL_KNIFE) ? ACT_KNIFE
+                : (g_tool == TOOL_POLY) ? ACT_POLY : ACT_JOIN;
+            if (g_mainWindow.perform(action) && !(keyFlags & MK_SHIFT))
                 g_tool = TOOL_SELECT;
         } else {
-            auto toggle = bool(keyFlags & MK_SHIFT);
+            action.type = ACT_SELECT;
             auto alreadySelected = hasSelection(g_state);
             if (!alreadySelected) {
-                g_state = select(std::move(g_state), g_hover, toggle);
+                g_mainWindow.perform(action);
                 g_mainWindow.refreshAllImmediate();
             }
             if (DragDetect(wnd, clientToScreen(wnd, {x, y}))) {
@@ -830,14 +602,10 @@ void ViewportWindow::onLButtonDown(HWND, BOOL, int x, int y, UINT keyFlags) {
                 g_hover = {};
             } else if (GetKeyState(VK_MENU) < 0 && !g_state.selFaces.empty()
                     && g_hoverFace.find(g_state.surf)) {
-                auto paint = g_state.selFaces.begin()->in(g_state.surf).paint;
-                EditorState newState = g_state;
-                newState.surf = assignPaint(g_state.surf, {g_hoverFace}, paint);
-                g_mainWindow.pushUndo(std::move(newState));
+                action.type = ACT_COPY_PAINT;
+                g_mainWindow.perform(action);
             } else if (alreadySelected) {
-                if (!toggle)
-                    g_state = clearSelection(std::move(g_state));
-                g_state = select(std::move(g_state), g_hover, toggle);
+                g_mainWindow.perform(action);
             }
         }
     } catch (winged_error const& err) {
@@ -868,6 +636,8 @@ void ViewportWindow::onButtonUp(HWND, int, int, UINT) {
         ReleaseCapture();
         if (mouseMode != MOUSE_TOOL)
             ShowCursor(true);
+        else
+            g_mainWindow.recordJournal(); // end of drag
         mouseMode = MOUSE_NONE;
         moved = {};
         g_mainWindow.updateStatus();
@@ -876,6 +646,7 @@ void ViewportWindow::onButtonUp(HWND, int, int, UINT) {
 }
 
 void ViewportWindow::onMouseMove(HWND, int x, int y, UINT keyFlags) {
+    latency.input(traceTime());
     g_mainWindow.hoveredViewport = this;
     if (!trackMouse) {
         TrackMouseEvent(tempPtr(TRACKMOUSEEVENT{sizeof(TRACKMOUSEEVENT), TME_LEAVE, wnd}));
@@ -924,6 +695,9 @@ void ViewportWindow::onMouseMove(HWND, int x, int y, UINT keyFlags) {
             lastCurPos = curPos;
         }
     }
+    latency.stage(LAT_HANDLED, traceTime());
+    if (!GetUpdateRect(wnd, NULL, false))
+        latency.cancel(); // nothing to show
 }
 
 void ViewportWindow::onMouseLeave(HWND) {
@@ -958,6 +732,22 @@ bool ViewportWindow::onCommand(HWND, int id, HWND, UINT) {
             view.showElem ^= PICK_FACE;
             refresh();
             return true;
+        case IDM_INPUT_LATENCY: {
+            auto stats = latency.stats();
+            // ms from mouse input to the end of each stage
+            std::wstring text = L"Samples: " + std::to_wstring(stats.count)
+                + L"\n\nStage\tp50\tp95\tp99\n";
+            for (int i = 0; i < LAT_STAGE_COUNT; i++) {
+                wchar_t line[64];
+                _swprintf(line, L"%s\t%.1f\t%.1f\t%.1f\n", LATENCY_STAGE_NAMES[i],
+                    double(stats.p50[i]), double(stats.p95[i]), double(stats.p99[i]));
+                text += line;
+            }
+            text += L"\nMilliseconds after mouse movement, for the last "
+                + std::to_wstring(LATENCY_WINDOW) + L" movements with a visible result.";
+            MessageBox(wnd, text.c_str(), L"Input Latency", MB_OK);
+            return true;
+        }
         // presets
         case IDM_VIEW_TOP:
             view.rotX = glm::half_pi<float>();
@@ -1003,6 +793,8 @@ void ViewportWindow::onDropFiles(HWND, HDROP drop) {
                 g_library.rootPath = narrow(path);
             } else if (lstrcmpi(ext, L".wing") == 0) {
                 g_mainWindow.open(path);
+            } else if (g_mainWindow.busy()) {
+                throw winged_error();
             } else { // assume image
                 auto texFileStr = narrow(path);
                 id_t texId = g_library.pathIds[texFileStr];
@@ -1010,9 +802,10 @@ void ViewportWindow::onDropFiles(HWND, HDROP drop) {
                     texId = genId();
                     g_library.addFile(texId, texFileStr);
                 }
-                EditorState newState = g_state;
-                newState.surf = assignPaint(g_state.surf, g_state.selFaces, Paint{texId});
-                g_mainWindow.pushUndo(std::move(newState));
+                Action action;
+                action.type = ACT_ASSIGN_PAINT;
+                action.material = texId;
+                g_mainWindow.perform(action);
             }
         }
         DragFinish(drop);
@@ -1043,7 +836,9 @@ static void setColor(glm::vec4 color) {
 }
 
 void ViewportWindow::onPaint(HWND) {
-    if (g_renderMeshDirty) {
+    TraceScope trace("paint");
+    // while loading, the render mesh holds the preview
+    if (g_renderMeshDirty && !g_mainWindow.loading()) {
         g_renderMeshDirty = false;
 #ifndef CHROMA_DEBUG
         try {
@@ -1067,6 +862,7 @@ void ViewportWindow::onPaint(HWND) {
         }
 #endif
     }
+    latency.stage(LAT_MESH, traceTime());
 
     PAINTSTRUCT ps;
     BeginPaint(wnd, &ps);
@@ -1151,12 +947,18 @@ void ViewportWindow::onPaint(HWND) {
             glEnable(GL_DEPTH_TEST);
     }
 
+    latency.stage(LAT_DRAWN, traceTime());
     SwapBuffers(ps.hdc);
+    latency.stage(LAT_PRESENTED, traceTime());
     EndPaint(wnd, &ps);
     CHECKERR(wglMakeCurrent(NULL, NULL));
 }
 
 void ViewportWindow::drawMesh(const RenderMesh &mesh) {
+    TraceScope trace("drawMesh");
+    trace.counter("indices", int64_t(mesh.indices.size()));
+    trace.counter("faceMeshes", int64_t(mesh.faceMeshes.size()));
+    trace.counter("uploaded", renderMeshDirtyLocal ? int64_t(mesh.vertices.size()) : 0);
     if (renderMeshDirtyLocal) {
         renderMeshDirtyLocal = false;
         glBindBuffer(GL_ARRAY_BUFFER, verticesBuffer.id);
@@ -1268,6 +1070,7 @@ void ViewportWindow::bindTexture(id_t texture) {
     if (name) {
         glBindTexture(GL_TEXTURE_2D, name);
     } else {
+        TraceScope trace("loadTexture");
         glGenTextures(1, &name);
         glBindTexture(GL_TEXTURE_2D, name);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -1277,8 +1080,13 @@ void ViewportWindow::bindTexture(id_t texture) {
         if (auto path = tryGet(g_library.idPaths, texture)) {
             auto image = loadImage(*path);
             if (image.data) {
+                trace.counter("width", image.width);
+                trace.counter("height", image.height);
                 texImageMipmaps(GL_TEXTURE_2D, GL_RGBA, image.width, image.height,
                     GL_BGRA, GL_UNSIGNED_BYTE, image.data.get());
+                auto imageBytes = size_t(image.width) * size_t(image.height) * 4;
+                peakImageBytes = std::max(peakImageBytes, imageBytes);
+                textureBytes += imageBytes * 4 / 3; // mipmap chain adds a third
             }
         }
         loadedTextures[texture] = name;
@@ -10,6 +10,7 @@
 #include <shellapi.h>
 #include "editor.h"
 #include "rendermesh.h"
+#include "latency.h"
 #include <unordered_map>
 #include <glm/vec2.hpp>
 #include <glm/mat4x4.hpp>
@@ -49,6 +50,7 @@ public:
     ViewState view;
     MouseMode mouseMode = MOUSE_NONE;
     glm::vec3 moved;
+    LatencyTracker latency;
 
     void destroy();
     void invalidateRenderMesh();
@@ -59,6 +61,9 @@ public:
     void updateHover(POINT pos);
     glm::vec3 forwardAxis();
     bool onCommand(HWND, int, HWND, UINT);
+    size_t numTextures() const { return loadedTextures.size(); }
+    size_t textureMemory() const { return textureBytes; } // estimate, including mipmaps
+    size_t peakImageMemory() const { return peakImageBytes; } // largest decoded image
 
 private:
     HGLRC context;
@@ -77,6 +82,7 @@ private:
     SizedBuffer indicesBuffer;
     unsigned int defTexture;
     std::unordered_map<id_t, unsigned int> loadedTextures;
+    size_t textureBytes = 0, peakImageBytes = 0;
 
     void lockMouse(POINT clientPos, MouseMode mode);
     void setViewMode(ViewMode mode);